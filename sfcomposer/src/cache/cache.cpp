@@ -0,0 +1,181 @@
+#include "cache.h"
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <vector>
+#include <random>
+
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+	const char* EntryExtension = ".sf2";
+	const char* TempExtension = ".tmp";
+	const char* MetaExtension = ".meta";
+
+	/*
+		a copy sharing the data blocks of the source, false if the file system can not
+	*/
+	bool reflink(const std::string& source, const std::string& target)
+	{
+#if defined(__linux__) && !defined(__EMSCRIPTEN__) && defined(FICLONE)
+		int src = open(source.c_str(), O_RDONLY);
+		if (src < 0) {
+			return false;
+		}
+		int dst = open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (dst < 0) {
+			close(src);
+			return false;
+		}
+		bool cloned = ioctl(dst, FICLONE, src) == 0;
+		close(src);
+		close(dst);
+		if (!cloned) {
+			unlink(target.c_str());
+		}
+		return cloned;
+#else
+		(void)source;
+		(void)target;
+		return false;
+#endif
+	}
+}
+
+namespace cache {
+
+	ComposeCache::ComposeCache(const std::string& directory, uint64_t byteBudget)
+		: _directory(directory), _byteBudget(byteBudget)
+	{
+		std::error_code ec;
+		fs::create_directories(_directory, ec);
+		if (!fs::is_directory(_directory)) {
+			throw std::runtime_error("could not create cache directory: " + _directory);
+		}
+	}
+
+	std::string ComposeCache::entryPath(const std::string& key) const
+	{
+		return (fs::path(_directory) / (key + EntryExtension)).string();
+	}
+
+	std::string ComposeCache::metaPath(const std::string& key) const
+	{
+		return (fs::path(_directory) / (key + MetaExtension)).string();
+	}
+
+	std::string ComposeCache::tempPath(const std::string& key) const
+	{
+		static std::atomic<unsigned> counter(0);
+		auto unique = std::to_string(std::random_device()()) + "." + std::to_string(counter++);
+		return (fs::path(_directory) / (key + "." + unique + TempExtension)).string();
+	}
+
+	/*
+		a copy and not a hard link, the output may be written in place later (--extend, --patch, a compose to the same path)
+	*/
+	void ComposeCache::provide(const std::string& entry, const std::string& outPath)
+	{
+		std::error_code ec;
+		fs::remove(outPath, ec);
+		if (!reflink(entry, outPath)) {
+			fs::copy_file(entry, outPath, fs::copy_options::overwrite_existing);
+		}
+	}
+
+	bool ComposeCache::fetch(const std::string& key, const std::string& outPath, std::string* meta)
+	{
+		auto entry = entryPath(key);
+		std::error_code ec;
+		if (!fs::is_regular_file(entry, ec)) {
+			return false;
+		}
+		// the modification time is the age for the eviction
+		fs::last_write_time(entry, fs::file_time_type::clock::now(), ec);
+		try {
+			provide(entry, outPath);
+		}
+		catch (const fs::filesystem_error&) {
+			// evicted in the meantime
+			return false;
+		}
+		if (meta) {
+			std::ifstream file(metaPath(key), std::ios_base::binary);
+			std::stringstream ss;
+			ss << file.rdbuf();
+			*meta = ss.str();
+		}
+		return true;
+	}
+
+	void ComposeCache::insert(const std::string& key, const std::string& tempPath, const std::string& outPath, const std::string& meta)
+	{
+		auto entry = entryPath(key);
+		if (!meta.empty()) {
+			// before the entry, so that no entry is found without its meta text
+			auto metaTemp = fs::path(tempPath).replace_extension(std::string(MetaExtension) + TempExtension).string();
+			{
+				std::ofstream file(metaTemp, std::ios_base::binary);
+				file << meta;
+			}
+			fs::rename(metaTemp, metaPath(key));
+		}
+		fs::rename(tempPath, entry);
+		provide(entry, outPath);
+		evict();
+	}
+
+	void ComposeCache::evict()
+	{
+		struct Entry {
+			fs::path path;
+			uint64_t size;
+			fs::file_time_type time;
+		};
+		std::vector<Entry> entries;
+		uint64_t total = 0;
+		std::error_code ec;
+		auto now = fs::file_time_type::clock::now();
+		for (const auto& file : fs::directory_iterator(_directory, ec)) {
+			if (file.path().extension() == TempExtension && now - file.last_write_time(ec) > std::chrono::hours(1)) {
+				// left over by a crashed insert
+				fs::remove(file.path(), ec);
+				continue;
+			}
+			if (file.path().extension() != EntryExtension) {
+				continue;
+			}
+			Entry entry = { file.path(), file.file_size(ec), file.last_write_time(ec) };
+			if (ec) {
+				continue;
+			}
+			total += entry.size;
+			entries.push_back(entry);
+		}
+		if (total <= _byteBudget) {
+			return;
+		}
+		std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+			return a.time < b.time;
+		});
+		for (const auto& entry : entries) {
+			if (total <= _byteBudget) {
+				break;
+			}
+			fs::remove(entry.path, ec);
+			fs::remove(fs::path(entry.path).replace_extension(MetaExtension), ec);
+			total -= entry.size;
+		}
+	}
+}
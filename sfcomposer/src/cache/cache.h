@@ -0,0 +1,43 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <string>
+#include <cstdint>
+
+/*
+	on disk cache for composed soundfonts.
+	every entry is a file named after its key: {cacheDir}/{key}.sf2
+	entries are inserted atomically via rename, the least recently used
+	entries are removed as soon as the byte budget is exceeded.
+	a short text can be kept with an entry ({key}.meta), e.g. its content hash.
+*/
+
+namespace cache {
+	class ComposeCache {
+	public:
+		ComposeCache(const std::string& directory, uint64_t byteBudget);
+		/*
+			provides a copy of the cached file at outPath (reflink where supported) and its meta text
+			returns false if there is no entry for the key
+		*/
+		bool fetch(const std::string& key, const std::string& outPath, std::string* meta = nullptr);
+		/*
+			a unique path inside the cache directory where a new entry can be written
+		*/
+		std::string tempPath(const std::string& key) const;
+		/*
+			moves the file at tempPath into the cache, provides it at outPath
+			and evicts old entries if the budget is exceeded
+		*/
+		void insert(const std::string& key, const std::string& tempPath, const std::string& outPath, const std::string& meta = "");
+		void evict();
+	private:
+		std::string entryPath(const std::string& key) const;
+		std::string metaPath(const std::string& key) const;
+		void provide(const std::string& entry, const std::string& outPath);
+		std::string _directory;
+		uint64_t _byteBudget;
+	};
+}
+
+#endif
@@ -0,0 +1,134 @@
+#include "samplecache.h"
+#include <sstream>
+
+namespace cache {
+
+	SampleCache::SampleCache(uint64_t byteBudget, int numShards)
+		: _shards(numShards > 0 ? numShards : 1), _byteBudget(byteBudget),
+		_hits(0), _misses(0), _bytesServed(0), _insertions(0), _evictions(0)
+	{
+		_shardBudget = _byteBudget / _shards.size();
+		// 80% of a shard may be used by entries which were hit at least twice
+		_protectedBudget = _shardBudget / 5 * 4;
+	}
+
+	SampleCache::Shard& SampleCache::shard(const SampleKey& key)
+	{
+		return _shards[SampleKeyHash()(key) % _shards.size()];
+	}
+
+	SfTools::SampleBuffer SampleCache::get(const SampleKey& key)
+	{
+		auto& s = shard(key);
+		std::lock_guard<std::mutex> lock(s.mutex);
+		auto it = s.index.find(key);
+		if (it == s.index.end()) {
+			++_misses;
+			return nullptr;
+		}
+		auto entry = it->second;
+		if (entry->isProtected) {
+			s.protectedSegment.splice(s.protectedSegment.begin(), s.protectedSegment, entry);
+		}
+		else {
+			entry->isProtected = true;
+			s.protectedBytes += entry->size;
+			s.protectedSegment.splice(s.protectedSegment.begin(), s.probation, entry);
+			while (s.protectedBytes > _protectedBudget && s.protectedSegment.size() > 1) {
+				// demote the least recently used protected entry
+				auto demoted = std::prev(s.protectedSegment.end());
+				demoted->isProtected = false;
+				s.protectedBytes -= demoted->size;
+				s.probation.splice(s.probation.begin(), s.protectedSegment, demoted);
+			}
+		}
+		++_hits;
+		_bytesServed += entry->size;
+		return entry->buffer;
+	}
+
+	SfTools::SampleBuffer SampleCache::getOrLoad(const SampleKey& key, const Loader& loader)
+	{
+		auto buffer = get(key);
+		if (buffer) {
+			return buffer;
+		}
+		buffer = loader();
+		if (buffer) {
+			insert(key, buffer);
+		}
+		return buffer;
+	}
+
+	void SampleCache::insert(const SampleKey& key, SfTools::SampleBuffer buffer)
+	{
+		uint64_t size = buffer->size() * sizeof(short);
+		if (size > _shardBudget) {
+			return;
+		}
+		auto& s = shard(key);
+		std::lock_guard<std::mutex> lock(s.mutex);
+		if (s.index.find(key) != s.index.end()) {
+			// loaded concurrently
+			return;
+		}
+		s.probation.push_front({ key, buffer, size, false });
+		s.index.insert(std::make_pair(key, s.probation.begin()));
+		s.bytes += size;
+		++_insertions;
+		evict(s);
+	}
+
+	void SampleCache::evict(Shard& s)
+	{
+		while (s.bytes > _shardBudget) {
+			Segment& segment = s.probation.empty() ? s.protectedSegment : s.probation;
+			if (segment.empty()) {
+				return;
+			}
+			auto& victim = segment.back();
+			s.bytes -= victim.size;
+			if (victim.isProtected) {
+				s.protectedBytes -= victim.size;
+			}
+			s.index.erase(victim.key);
+			segment.pop_back();
+			++_evictions;
+		}
+	}
+
+	SampleCacheStats SampleCache::stats() const
+	{
+		SampleCacheStats result;
+		result.hits = _hits;
+		result.misses = _misses;
+		result.bytesServed = _bytesServed;
+		result.insertions = _insertions;
+		result.evictions = _evictions;
+		result.byteBudget = _byteBudget;
+		for (const auto& s : _shards) {
+			std::lock_guard<std::mutex> lock(s.mutex);
+			result.entries += s.index.size();
+			result.bytes += s.bytes;
+		}
+		return result;
+	}
+
+	std::string SampleCache::statsJson() const
+	{
+		auto s = stats();
+		auto lookups = s.hits + s.misses;
+		std::stringstream ss;
+		ss << "{\"hits\": " << s.hits
+			<< ", \"misses\": " << s.misses
+			<< ", \"hitRate\": " << (lookups > 0 ? (double)s.hits / lookups : 0.0)
+			<< ", \"bytesServed\": " << s.bytesServed
+			<< ", \"insertions\": " << s.insertions
+			<< ", \"evictions\": " << s.evictions
+			<< ", \"entries\": " << s.entries
+			<< ", \"bytes\": " << s.bytes
+			<< ", \"byteBudget\": " << s.byteBudget
+			<< "}";
+		return ss.str();
+	}
+}
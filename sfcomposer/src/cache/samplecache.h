@@ -0,0 +1,114 @@
+#ifndef SAMPLECACHE_H
+#define SAMPLECACHE_H
+
+#include "sf3/sfont.h"
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+/*
+	in memory cache for sample data shared by all composes of a process.
+	the entries are read only buffers, a hit hands out a reference without copying.
+	every shard is a segmented LRU: new entries start in the probation segment and
+	are moved to the protected segment when they are hit again. Evictions take
+	the probation segment first, so one large compose can not flush the samples
+	which are used over and over again.
+*/
+
+namespace cache {
+	/*
+		identifies a sample, not the folder it is read from: by its skeleton and id if the
+		skeleton has a checksum, so the sample is cached once for all folders and composes
+		of the skeleton (the checksum and length guard against a replaced skeleton),
+		otherwise by the sample file with its size and modification time, so a replaced
+		file is read again
+	*/
+	struct SampleKey {
+		std::string skeleton; // empty if keyed by the file
+		int sample = -1;
+		uint32_t crc32c = 0;
+		uint64_t bytes = 0;
+		std::string path; // empty if keyed by the skeleton
+		int64_t modified = 0;
+		bool operator==(const SampleKey& other) const
+		{
+			return sample == other.sample && crc32c == other.crc32c && bytes == other.bytes && modified == other.modified
+				&& path == other.path && skeleton == other.skeleton;
+		}
+	};
+
+	struct SampleKeyHash {
+		size_t operator()(const SampleKey& key) const
+		{
+			uint64_t h = std::hash<std::string>()(key.path) ^ std::hash<std::string>()(key.skeleton);
+			h = (h ^ (uint32_t)key.sample) * 0x9E3779B97F4A7C15ULL;
+			h = (h ^ key.crc32c) * 0x9E3779B97F4A7C15ULL;
+			h = (h ^ key.bytes) * 0x9E3779B97F4A7C15ULL;
+			h = (h ^ (uint64_t)key.modified) * 0x9E3779B97F4A7C15ULL;
+			return (size_t)(h ^ (h >> 32));
+		}
+	};
+
+	struct SampleCacheStats {
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t bytesServed = 0;
+		uint64_t insertions = 0;
+		uint64_t evictions = 0;
+		uint64_t entries = 0;
+		uint64_t bytes = 0;
+		uint64_t byteBudget = 0;
+	};
+
+	class SampleCache {
+	public:
+		typedef std::function<SfTools::SampleBuffer()> Loader;
+		enum { DefaultShards = 16 };
+		explicit SampleCache(uint64_t byteBudget, int numShards = DefaultShards);
+		/*
+			returns nullptr if not cached
+		*/
+		SfTools::SampleBuffer get(const SampleKey& key);
+		/*
+			on a miss the loader is called without holding a lock
+		*/
+		SfTools::SampleBuffer getOrLoad(const SampleKey& key, const Loader& loader);
+		void insert(const SampleKey& key, SfTools::SampleBuffer buffer);
+		SampleCacheStats stats() const;
+		std::string statsJson() const;
+	private:
+		struct Entry {
+			SampleKey key;
+			SfTools::SampleBuffer buffer;
+			uint64_t size;
+			bool isProtected;
+		};
+		typedef std::list<Entry> Segment;
+		struct Shard {
+			mutable std::mutex mutex;
+			Segment probation;
+			Segment protectedSegment;
+			std::unordered_map<SampleKey, Segment::iterator, SampleKeyHash> index;
+			uint64_t bytes = 0;
+			uint64_t protectedBytes = 0;
+		};
+		Shard& shard(const SampleKey& key);
+		void evict(Shard& shard);
+		std::vector<Shard> _shards;
+		uint64_t _byteBudget;
+		uint64_t _shardBudget;
+		uint64_t _protectedBudget;
+		std::atomic<uint64_t> _hits;
+		std::atomic<uint64_t> _misses;
+		std::atomic<uint64_t> _bytesServed;
+		std::atomic<uint64_t> _insertions;
+		std::atomic<uint64_t> _evictions;
+	};
+}
+
+#endif
@@ -78,6 +78,15 @@ enum Generator
     Gen_Dummy
 };
 
+enum SampleType
+{
+    MonoSample = 1,
+    RightSample = 2,
+    LeftSample = 4,
+    LinkedSample = 8,
+    RomSample = 0x8000
+};
+
 enum Transform
 {
     Linear
@@ -9,6 +9,8 @@
 	representation for soundfont splits:
 	gm.sf.skeleton: the sf header without the sample data
 	gm.sf.{sampleId}.smpl: the sample data
+	the containers are written one after another, each with its byte size first.
+	skeletons written before the sample checksums end after sample2Instruments
 */
 
 namespace dat {
@@ -26,6 +28,7 @@ namespace dat {
 		::Generator dst = Gen_StartAddrOfs;
 		int amount = 0;
 	};
+	static_assert(sizeof(Modulator) == 5 * sizeof(int), "modulator records are written as they are");
 	union GeneratorAmount {
 		short sword;
 		unsigned short uword;
@@ -39,7 +42,10 @@ namespace dat {
 		For for_ = ForUndefined;
 		::Generator gen = Gen_StartAddrOfs;
 		GeneratorAmount amount = {0};
+		// the alignment gap, explicit so that the written record has no undefined bytes
+		unsigned short padding = 0;
 	};
+	static_assert(sizeof(Generator) == 4 * sizeof(int) + 2 * sizeof(short), "generator records are written as they are");
 
 	struct Preset {
 		Id id = Unknown;
@@ -51,12 +57,14 @@ namespace dat {
 		int genre = 0;
 		int morphology = 0;
 	};
+	static_assert(sizeof(Preset) == 7 * sizeof(int) + StringLength, "preset records are written as they are");
 
 	struct Instrument {
 		Id id = Unknown;
 		StringType name = { 0 };
 		int index = 0;
 	};
+	static_assert(sizeof(Instrument) == 2 * sizeof(int) + StringLength, "instrument records are written as they are");
 
 	struct Instrument2Preset
 	{
@@ -64,6 +72,7 @@ namespace dat {
 		Id preset = Unknown;
 		Id zone = Unknown;
 	};
+	static_assert(sizeof(Instrument2Preset) == 3 * sizeof(int), "relation records are written as they are");
 
 	struct SampleHeader {
 		Id id = Unknown;
@@ -79,6 +88,7 @@ namespace dat {
 		int sampleLink = 0;
 		int sampletype = 0;
 	};
+	static_assert(sizeof(SampleHeader) == 10 * sizeof(int) + StringLength, "sample header records are written as they are");
 
 	struct Sample2Instrument
 	{
@@ -86,9 +96,19 @@ namespace dat {
 		Id sample = Unknown;
 		Id zone = Unknown;
 	};
+	static_assert(sizeof(Sample2Instrument) == 3 * sizeof(int), "relation records are written as they are");
+
+	/*
+		CRC-32C of the content of a sample file
+	*/
+	struct SampleChecksum {
+		Id sample = Unknown;
+		unsigned int crc32c = 0;
+	};
+	static_assert(sizeof(SampleChecksum) == 2 * sizeof(int), "checksum records are written as they are");
 
 	struct SoundFontHeader {
-		sfVersionTag version = { 0 };
+		sfVersionTag version = { 0, 0 };
 		StringType engine = { 0 };
 		StringType name = { 0 };
 		StringType date = { 0 };
@@ -98,8 +118,9 @@ namespace dat {
 		StringType product = { 0 };
 		StringType copyright = { 0 };
 		StringType irom = { 0 };
-		sfVersionTag iver = { 0 };
+		sfVersionTag iver = { 0, 0 };
 	};
+	static_assert(sizeof(SoundFontHeader) == 2 * sizeof(sfVersionTag) + 9 * StringLength, "the header is written as it is");
 
 	struct Skeleton {
 		SoundFontHeader header;
@@ -110,6 +131,8 @@ namespace dat {
 		Container<Instrument2Preset> instrument2Preset;
 		Container<SampleHeader> samples;
 		Container<Sample2Instrument> sample2Instruments;
+		// sorted by sample id, empty for older skeletons
+		Container<SampleChecksum> sampleChecksums;
 	};
 }
 
@@ -0,0 +1,213 @@
+#include "crc32c.h"
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(_M_X64)) && !defined(__EMSCRIPTEN__)
+#define CRC32C_SSE42 1
+#include <nmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CRC32C_TARGET
+#else
+#define CRC32C_TARGET __attribute__((target("sse4.2")))
+#endif
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define CRC32C_ARMV8 1
+#include <arm_acle.h>
+#define CRC32C_TARGET
+#endif
+
+namespace {
+	const uint32_t Polynomial = 0x82F63B78; // reflected
+
+	/*
+		slicing by 8: table[k][n] is the crc of byte n followed by k zero bytes
+	*/
+	struct Tables {
+		uint32_t table[8][256];
+		Tables()
+		{
+			for (uint32_t n = 0; n < 256; ++n) {
+				uint32_t crc = n;
+				for (int k = 0; k < 8; ++k) {
+					crc = crc & 1 ? (crc >> 1) ^ Polynomial : crc >> 1;
+				}
+				table[0][n] = crc;
+			}
+			for (uint32_t n = 0; n < 256; ++n) {
+				for (int k = 1; k < 8; ++k) {
+					table[k][n] = (table[k - 1][n] >> 8) ^ table[0][table[k - 1][n] & 0xFF];
+				}
+			}
+		}
+	};
+
+	const Tables& tables()
+	{
+		static const Tables instance;
+		return instance;
+	}
+
+	inline uint64_t read64(const unsigned char* p)
+	{
+		uint64_t value;
+		memcpy(&value, p, sizeof(value));
+		return value;
+	}
+
+	uint32_t crc32cTable(uint32_t crc, const unsigned char* p, size_t length)
+	{
+		const auto& t = tables().table;
+		for (; length >= 8; p += 8, length -= 8) {
+			uint64_t word = read64(p) ^ crc;
+			crc = t[7][word & 0xFF] ^ t[6][(word >> 8) & 0xFF] ^ t[5][(word >> 16) & 0xFF] ^ t[4][(word >> 24) & 0xFF]
+				^ t[3][(word >> 32) & 0xFF] ^ t[2][(word >> 40) & 0xFF] ^ t[1][(word >> 48) & 0xFF] ^ t[0][word >> 56];
+		}
+		for (; length > 0; ++p, --length) {
+			crc = (crc >> 8) ^ t[0][(crc ^ *p) & 0xFF];
+		}
+		return crc;
+	}
+
+#if defined(CRC32C_SSE42) || defined(CRC32C_ARMV8)
+	/*
+		the crc instruction has a latency of about three cycles but a throughput
+		of one per cycle, so three blocks are checksummed at once and combined:
+		shift(crc) appends Block zero bytes to crc (a linear operator over GF(2))
+	*/
+	const size_t Block = 4096;
+
+	struct ShiftTables {
+		uint32_t table[4][256];
+
+		static uint32_t times(const uint32_t* matrix, uint32_t vector)
+		{
+			uint32_t sum = 0;
+			for (; vector; vector >>= 1, ++matrix) {
+				if (vector & 1) {
+					sum ^= *matrix;
+				}
+			}
+			return sum;
+		}
+
+		static void square(uint32_t* result, const uint32_t* matrix)
+		{
+			for (int n = 0; n < 32; ++n) {
+				result[n] = times(matrix, matrix[n]);
+			}
+		}
+
+		ShiftTables()
+		{
+			// the operator for one zero bit, squared until it appends Block zero bytes
+			uint32_t op[32];
+			uint32_t squared[32];
+			op[0] = Polynomial;
+			for (int n = 1; n < 32; ++n) {
+				op[n] = 1u << (n - 1);
+			}
+			for (size_t bits = 1; bits < Block * 8; bits *= 2) {
+				square(squared, op);
+				memcpy(op, squared, sizeof(op));
+			}
+			for (uint32_t n = 0; n < 256; ++n) {
+				for (int k = 0; k < 4; ++k) {
+					table[k][n] = times(op, n << (k * 8));
+				}
+			}
+		}
+
+		uint32_t shift(uint32_t crc) const
+		{
+			return table[0][crc & 0xFF] ^ table[1][(crc >> 8) & 0xFF] ^ table[2][(crc >> 16) & 0xFF] ^ table[3][crc >> 24];
+		}
+	};
+
+	const ShiftTables& shiftTables()
+	{
+		static const ShiftTables instance;
+		return instance;
+	}
+
+#ifdef CRC32C_SSE42
+	CRC32C_TARGET inline uint64_t step64(uint64_t crc, uint64_t value) { return _mm_crc32_u64(crc, value); }
+	CRC32C_TARGET inline uint32_t step8(uint32_t crc, unsigned char value) { return _mm_crc32_u8(crc, value); }
+#else
+	inline uint64_t step64(uint64_t crc, uint64_t value) { return __crc32cd((uint32_t)crc, value); }
+	inline uint32_t step8(uint32_t crc, unsigned char value) { return __crc32cb(crc, value); }
+#endif
+
+	CRC32C_TARGET uint32_t crc32cHardware(uint32_t crc, const unsigned char* p, size_t length)
+	{
+		const auto& shift = shiftTables();
+		uint64_t crc0 = crc;
+		while (length >= 3 * Block) {
+			uint64_t crc1 = 0, crc2 = 0;
+			for (const unsigned char* end = p + Block; p < end; p += 8) {
+				crc0 = step64(crc0, read64(p));
+				crc1 = step64(crc1, read64(p + Block));
+				crc2 = step64(crc2, read64(p + 2 * Block));
+			}
+			crc0 = shift.shift((uint32_t)crc0) ^ (uint32_t)crc1;
+			crc0 = shift.shift((uint32_t)crc0) ^ (uint32_t)crc2;
+			p += 2 * Block;
+			length -= 3 * Block;
+		}
+		for (; length >= 8; p += 8, length -= 8) {
+			crc0 = step64(crc0, read64(p));
+		}
+		uint32_t result = (uint32_t)crc0;
+		for (; length > 0; ++p, --length) {
+			result = step8(result, *p);
+		}
+		return result;
+	}
+#endif
+
+	bool hardwareSupported()
+	{
+#if defined(CRC32C_SSE42) && defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 1);
+		return (info[2] & (1 << 20)) != 0;
+#elif defined(CRC32C_SSE42)
+		return __builtin_cpu_supports("sse4.2");
+#elif defined(CRC32C_ARMV8)
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	typedef uint32_t (*Implementation)(uint32_t, const unsigned char*, size_t);
+
+	Implementation implementation()
+	{
+#if defined(CRC32C_SSE42) || defined(CRC32C_ARMV8)
+		static const Implementation selected = hardwareSupported() ? crc32cHardware : crc32cTable;
+#else
+		static const Implementation selected = crc32cTable;
+#endif
+		return selected;
+	}
+}
+
+namespace hash {
+
+	uint32_t crc32c(const void* data, size_t length, uint32_t crc)
+	{
+		return ~implementation()(~crc, static_cast<const unsigned char*>(data), length);
+	}
+
+	const char* crc32cImplementation()
+	{
+		if (!hardwareSupported()) {
+			return "table";
+		}
+#ifdef CRC32C_ARMV8
+		return "armv8";
+#else
+		return "sse4.2";
+#endif
+	}
+}
@@ -0,0 +1,22 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <cstdint>
+#include <cstddef>
+
+/*
+	CRC-32C (Castagnoli), the checksum of the sample files.
+	uses the crc32 instructions of SSE 4.2 (checked at runtime) or ARMv8
+	(if compiled for them), a table driven version otherwise
+*/
+
+namespace hash {
+	/*
+		crc continues a checksum: crc32c(b, crc32c(a)) == crc32c(a + b)
+	*/
+	uint32_t crc32c(const void* data, size_t length, uint32_t crc = 0);
+	// "sse4.2", "armv8" or "table"
+	const char* crc32cImplementation();
+}
+
+#endif
@@ -0,0 +1,262 @@
+#include "hash.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+	const uint64_t Prime1 = 11400714785074694791ULL;
+	const uint64_t Prime2 = 14029467366897019727ULL;
+	const uint64_t Prime3 = 1609587929392839161ULL;
+	const uint64_t Prime4 = 9650029242287828579ULL;
+	const uint64_t Prime5 = 2870177450012600261ULL;
+
+	inline uint64_t rotl(uint64_t x, int r)
+	{
+		return (x << r) | (x >> (64 - r));
+	}
+
+	inline uint64_t read64(const unsigned char* p)
+	{
+		uint64_t val;
+		memcpy(&val, p, sizeof(val));
+		return val;
+	}
+
+	inline uint32_t read32(const unsigned char* p)
+	{
+		uint32_t val;
+		memcpy(&val, p, sizeof(val));
+		return val;
+	}
+
+	inline uint64_t round(uint64_t acc, uint64_t input)
+	{
+		acc += input * Prime2;
+		acc = rotl(acc, 31);
+		return acc * Prime1;
+	}
+
+	inline uint64_t mergeRound(uint64_t acc, uint64_t val)
+	{
+		acc ^= round(0, val);
+		return acc * Prime1 + Prime4;
+	}
+
+	const uint32_t Sha256Constants[64] = {
+		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+		0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+	};
+
+	inline uint32_t rotr(uint32_t x, int r)
+	{
+		return (x >> r) | (x << (32 - r));
+	}
+
+	inline uint32_t readBe32(const unsigned char* p)
+	{
+		return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+	}
+}
+
+namespace hash {
+
+	XXHash64::XXHash64(uint64_t seed) : _seed(seed)
+	{
+		_state[0] = seed + Prime1 + Prime2;
+		_state[1] = seed + Prime2;
+		_state[2] = seed;
+		_state[3] = seed - Prime1;
+	}
+
+	void XXHash64::update(const void* data, size_t length)
+	{
+		auto p = static_cast<const unsigned char*>(data);
+		auto end = p + length;
+		_totalLength += length;
+		if (_bufferSize + length < 32) {
+			memcpy(_buffer + _bufferSize, p, length);
+			_bufferSize += length;
+			return;
+		}
+		if (_bufferSize > 0) {
+			auto fill = 32 - _bufferSize;
+			memcpy(_buffer + _bufferSize, p, fill);
+			p += fill;
+			for (int i = 0; i < 4; ++i) {
+				_state[i] = round(_state[i], read64(_buffer + i * 8));
+			}
+			_bufferSize = 0;
+		}
+		uint64_t v1 = _state[0], v2 = _state[1], v3 = _state[2], v4 = _state[3];
+		for (; p + 32 <= end; p += 32) {
+			v1 = round(v1, read64(p));
+			v2 = round(v2, read64(p + 8));
+			v3 = round(v3, read64(p + 16));
+			v4 = round(v4, read64(p + 24));
+		}
+		_state[0] = v1; _state[1] = v2; _state[2] = v3; _state[3] = v4;
+		if (p < end) {
+			_bufferSize = end - p;
+			memcpy(_buffer, p, _bufferSize);
+		}
+	}
+
+	uint64_t XXHash64::digest() const
+	{
+		uint64_t h;
+		if (_totalLength >= 32) {
+			h = rotl(_state[0], 1) + rotl(_state[1], 7) + rotl(_state[2], 12) + rotl(_state[3], 18);
+			for (int i = 0; i < 4; ++i) {
+				h = mergeRound(h, _state[i]);
+			}
+		}
+		else {
+			h = _seed + Prime5;
+		}
+		h += _totalLength;
+		const unsigned char* p = _buffer;
+		const unsigned char* end = _buffer + _bufferSize;
+		for (; p + 8 <= end; p += 8) {
+			h ^= round(0, read64(p));
+			h = rotl(h, 27) * Prime1 + Prime4;
+		}
+		if (p + 4 <= end) {
+			h ^= (uint64_t)read32(p) * Prime1;
+			h = rotl(h, 23) * Prime2 + Prime3;
+			p += 4;
+		}
+		for (; p < end; ++p) {
+			h ^= (*p) * Prime5;
+			h = rotl(h, 11) * Prime1;
+		}
+		h ^= h >> 33;
+		h *= Prime2;
+		h ^= h >> 29;
+		h *= Prime3;
+		h ^= h >> 32;
+		return h;
+	}
+
+	Sha256::Sha256()
+	{
+		const uint32_t initial[8] = {
+			0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+		};
+		memcpy(_state, initial, sizeof(_state));
+	}
+
+	void Sha256::transform(const unsigned char* block)
+	{
+		uint32_t w[64];
+		for (int i = 0; i < 16; ++i) {
+			w[i] = readBe32(block + i * 4);
+		}
+		for (int i = 16; i < 64; ++i) {
+			uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+			uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+		uint32_t a = _state[0], b = _state[1], c = _state[2], d = _state[3];
+		uint32_t e = _state[4], f = _state[5], g = _state[6], h = _state[7];
+		for (int i = 0; i < 64; ++i) {
+			uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + Sha256Constants[i] + w[i];
+			uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+			h = g; g = f; f = e; e = d + t1;
+			d = c; c = b; b = a; a = t1 + t2;
+		}
+		_state[0] += a; _state[1] += b; _state[2] += c; _state[3] += d;
+		_state[4] += e; _state[5] += f; _state[6] += g; _state[7] += h;
+	}
+
+	void Sha256::update(const void* data, size_t length)
+	{
+		auto p = static_cast<const unsigned char*>(data);
+		_totalLength += length;
+		if (_bufferSize > 0) {
+			auto fill = std::min(64 - _bufferSize, length);
+			memcpy(_buffer + _bufferSize, p, fill);
+			_bufferSize += fill;
+			p += fill;
+			length -= fill;
+			if (_bufferSize < 64) {
+				return;
+			}
+			transform(_buffer);
+			_bufferSize = 0;
+		}
+		for (; length >= 64; p += 64, length -= 64) {
+			transform(p);
+		}
+		memcpy(_buffer, p, length);
+		_bufferSize = length;
+	}
+
+	void Sha256::digest(unsigned char* out)
+	{
+		uint64_t bits = _totalLength * 8;
+		unsigned char padding[72] = { 0x80 };
+		size_t padLength = (_bufferSize < 56 ? 56 : 120) - _bufferSize;
+		for (int i = 0; i < 8; ++i) {
+			padding[padLength + i] = (unsigned char)(bits >> (56 - i * 8));
+		}
+		update(padding, padLength + 8);
+		for (int i = 0; i < 8; ++i) {
+			for (int j = 0; j < 4; ++j) {
+				out[i * 4 + j] = (unsigned char)(_state[i] >> (24 - j * 8));
+			}
+		}
+	}
+
+	uint64_t xxh64(const void* data, size_t length, uint64_t seed)
+	{
+		XXHash64 hasher(seed);
+		hasher.update(data, length);
+		return hasher.digest();
+	}
+
+	uint64_t xxh64File(const std::string& path, uint64_t seed)
+	{
+		std::fstream file(path.c_str(), std::ios_base::in | std::ios_base::binary);
+		if (!file.is_open()) {
+			throw std::runtime_error("could not open: " + path);
+		}
+		XXHash64 hasher(seed);
+		std::vector<char> bff(1 << 16);
+		while (file) {
+			file.read(bff.data(), bff.size());
+			hasher.update(bff.data(), (size_t)file.gcount());
+		}
+		return hasher.digest();
+	}
+
+	std::string toHex(uint64_t value)
+	{
+		const char* digits = "0123456789abcdef";
+		std::string result(16, '0');
+		for (int i = 15; i >= 0; --i) {
+			result[i] = digits[value & 0xF];
+			value >>= 4;
+		}
+		return result;
+	}
+
+	std::string toHex(const unsigned char* data, size_t length)
+	{
+		const char* digits = "0123456789abcdef";
+		std::string result;
+		result.reserve(length * 2);
+		for (size_t i = 0; i < length; ++i) {
+			result.push_back(digits[data[i] >> 4]);
+			result.push_back(digits[data[i] & 0xF]);
+		}
+		return result;
+	}
+}
@@ -0,0 +1,53 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+/*
+	fast non cryptographic hashing (xxHash64)
+	used to identify skeletons, samples and composed files,
+	and SHA-256 where a cryptographic digest is asked for
+*/
+
+namespace hash {
+	class XXHash64 {
+	public:
+		explicit XXHash64(uint64_t seed = 0);
+		void update(const void* data, size_t length);
+		uint64_t digest() const;
+	private:
+		uint64_t _state[4];
+		unsigned char _buffer[32];
+		size_t _bufferSize = 0;
+		uint64_t _totalLength = 0;
+		uint64_t _seed;
+	};
+
+	class Sha256 {
+	public:
+		Sha256();
+		void update(const void* data, size_t length);
+		/*
+			the 32 byte digest, the hasher can not be updated afterwards
+		*/
+		void digest(unsigned char* out);
+	private:
+		void transform(const unsigned char* block);
+		uint32_t _state[8];
+		unsigned char _buffer[64];
+		size_t _bufferSize = 0;
+		uint64_t _totalLength = 0;
+	};
+
+	uint64_t xxh64(const void* data, size_t length, uint64_t seed = 0);
+	/*
+		hashes the whole content of a file, throws if the file can not be read
+	*/
+	uint64_t xxh64File(const std::string& path, uint64_t seed = 0);
+	std::string toHex(uint64_t value);
+	std::string toHex(const unsigned char* data, size_t length);
+}
+
+#endif
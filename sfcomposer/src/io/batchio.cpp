@@ -0,0 +1,562 @@
+#include "batchio.h"
+#include "hash/crc32c.h"
+#include "hash/hash.h"
+#include <stdexcept>
+#include <sstream>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+#define IO_URING_SUPPORTED 1
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <atomic>
+#endif
+
+namespace {
+	const int CreateMode = 0644;
+
+	std::string errorText(const std::string& what, const std::string& path, int error)
+	{
+		return what + " " + path + ": " + strerror(error);
+	}
+
+	/*
+		the checksum and digests of one job, updated chunk by chunk as it is copied
+	*/
+	struct JobHasher {
+		hash::XXHash64 xxh64;
+		hash::Sha256 sha256;
+
+		void update(io::CopyJob& job, const void* data, size_t n)
+		{
+			if (job.checksum) {
+				job.crc32c = hash::crc32c(data, n, job.crc32c);
+			}
+			if (job.hash) {
+				xxh64.update(data, n);
+			}
+			if (job.sha256) {
+				sha256.update(data, n);
+			}
+		}
+
+		void finish(io::CopyJob& job)
+		{
+			if (job.hash) {
+				job.xxh64 = xxh64.digest();
+			}
+			if (job.sha256) {
+				sha256.digest(job.sha256Digest.data());
+			}
+		}
+	};
+
+#ifndef WIN32
+	/*
+		open/pread/pwrite/close for every job
+	*/
+	void copyPread(std::vector<io::CopyJob>& jobs, const io::IoOptions& options, io::IoStats& stats)
+	{
+		std::vector<char> bff(options.bufferSize);
+		for (auto& job : jobs) {
+			int src = job.srcFd;
+			int dst = job.dstFd;
+			if (src < 0) {
+				++stats.syscalls;
+				src = open(job.srcPath.c_str(), O_RDONLY);
+				if (src < 0 && errno == ENOENT) {
+					job.skipped = true;
+					continue;
+				}
+				if (src < 0) {
+					throw std::runtime_error(errorText("could not open", job.srcPath, errno));
+				}
+				++stats.files;
+			}
+			if (job.checkSize) {
+				struct stat info;
+				++stats.syscalls;
+				if (fstat(src, &info) != 0) {
+					int error = errno;
+					if (job.srcFd < 0) {
+						close(src);
+					}
+					throw std::runtime_error(errorText("could not stat", job.srcPath, error));
+				}
+				job.srcSize = (uint64_t)info.st_size;
+				job.sizeMismatch = job.srcSize != job.srcOffset + job.length;
+				if (job.sizeMismatch) {
+					if (job.srcFd < 0) {
+						++stats.syscalls;
+						close(src);
+					}
+					continue;
+				}
+			}
+			if (dst < 0) {
+				++stats.syscalls;
+				dst = open(job.dstPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, CreateMode);
+				if (dst < 0) {
+					int error = errno;
+					if (job.srcFd < 0) {
+						close(src);
+					}
+					throw std::runtime_error(errorText("could not open", job.dstPath, error));
+				}
+				++stats.files;
+			}
+			uint64_t done = 0;
+			std::string error;
+			JobHasher hasher;
+			while (done < job.length) {
+				auto chunk = (size_t)std::min<uint64_t>(bff.size(), job.length - done);
+				++stats.syscalls;
+				auto n = pread(src, bff.data(), chunk, job.srcOffset + done);
+				if (n <= 0) {
+					error = "unexpected end of file " + job.srcPath;
+					break;
+				}
+				stats.bytesRead += n;
+				hasher.update(job, bff.data(), n);
+				++stats.syscalls;
+				if (pwrite(dst, bff.data(), n, job.dstOffset + done) != n) {
+					error = errorText("write error", job.dstPath, errno);
+					break;
+				}
+				stats.bytesWritten += n;
+				done += n;
+			}
+			if (job.srcFd < 0) {
+				++stats.syscalls;
+				close(src);
+			}
+			if (job.dstFd < 0) {
+				++stats.syscalls;
+				close(dst);
+			}
+			if (!error.empty()) {
+				throw std::runtime_error(error);
+			}
+			hasher.finish(job);
+		}
+	}
+#endif
+
+#ifdef IO_URING_SUPPORTED
+	class Uring {
+	public:
+		Uring(unsigned entries, io::IoStats& stats) : _stats(stats)
+		{
+			io_uring_params params;
+			memset(&params, 0, sizeof(params));
+			++_stats.syscalls;
+			_fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+			if (_fd < 0) {
+				throw std::runtime_error(std::string("io_uring_setup failed: ") + strerror(errno));
+			}
+			if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+				close(_fd);
+				throw std::runtime_error("io_uring: kernel too old");
+			}
+			_ringSize = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+				params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+			++_stats.syscalls;
+			_ring = mmap(nullptr, _ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+			if (_ring == MAP_FAILED) {
+				close(_fd);
+				throw std::runtime_error("io_uring: mmap failed");
+			}
+			_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+			++_stats.syscalls;
+			_sqes = (io_uring_sqe*)mmap(nullptr, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+			if (_sqes == MAP_FAILED) {
+				munmap(_ring, _ringSize);
+				close(_fd);
+				throw std::runtime_error("io_uring: mmap failed");
+			}
+			auto base = (char*)_ring;
+			_sqHead = (std::atomic<unsigned>*)(base + params.sq_off.head);
+			_sqTail = (std::atomic<unsigned>*)(base + params.sq_off.tail);
+			_sqMask = *(unsigned*)(base + params.sq_off.ring_mask);
+			_sqArray = (unsigned*)(base + params.sq_off.array);
+			_cqHead = (std::atomic<unsigned>*)(base + params.cq_off.head);
+			_cqTail = (std::atomic<unsigned>*)(base + params.cq_off.tail);
+			_cqMask = *(unsigned*)(base + params.cq_off.ring_mask);
+			_cqes = (io_uring_cqe*)(base + params.cq_off.cqes);
+		}
+
+		~Uring()
+		{
+			_stats.syscalls += 3;
+			munmap(_sqes, _sqesSize);
+			munmap(_ring, _ringSize);
+			close(_fd);
+		}
+
+		void registerBuffers(std::vector<iovec>& buffers)
+		{
+			++_stats.syscalls;
+			if (syscall(__NR_io_uring_register, _fd, IORING_REGISTER_BUFFERS, buffers.data(), (unsigned)buffers.size()) < 0) {
+				throw std::runtime_error(std::string("io_uring: register buffers failed: ") + strerror(errno));
+			}
+		}
+
+		io_uring_sqe* nextSqe()
+		{
+			unsigned tail = _sqTail->load(std::memory_order_relaxed);
+			unsigned index = tail & _sqMask;
+			auto sqe = &_sqes[index];
+			memset(sqe, 0, sizeof(*sqe));
+			_sqArray[index] = index;
+			_sqTail->store(tail + 1, std::memory_order_release);
+			++_unsubmitted;
+			return sqe;
+		}
+
+		/*
+			submits the queued entries and waits for at least one completion
+		*/
+		void submitAndWait()
+		{
+			++_stats.syscalls;
+			int result = (int)syscall(__NR_io_uring_enter, _fd, _unsubmitted, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+			if (result < 0 && errno != EINTR) {
+				throw std::runtime_error(std::string("io_uring_enter failed: ") + strerror(errno));
+			}
+			if (result > 0) {
+				_unsubmitted -= std::min<unsigned>(result, _unsubmitted);
+			}
+		}
+
+		template <class TFunction>
+		void forEachCompletion(TFunction f)
+		{
+			unsigned head = _cqHead->load(std::memory_order_relaxed);
+			unsigned tail = _cqTail->load(std::memory_order_acquire);
+			for (; head != tail; ++head) {
+				const auto& cqe = _cqes[head & _cqMask];
+				f(cqe.user_data, cqe.res);
+			}
+			_cqHead->store(head, std::memory_order_release);
+		}
+
+	private:
+		io::IoStats& _stats;
+		int _fd = -1;
+		void* _ring = nullptr;
+		size_t _ringSize = 0;
+		io_uring_sqe* _sqes = nullptr;
+		size_t _sqesSize = 0;
+		std::atomic<unsigned>* _sqHead = nullptr;
+		std::atomic<unsigned>* _sqTail = nullptr;
+		unsigned _sqMask = 0;
+		unsigned* _sqArray = nullptr;
+		std::atomic<unsigned>* _cqHead = nullptr;
+		std::atomic<unsigned>* _cqTail = nullptr;
+		unsigned _cqMask = 0;
+		io_uring_cqe* _cqes = nullptr;
+		unsigned _unsubmitted = 0;
+	};
+
+	/*
+		every slot owns a registered buffer and works on one job at a time:
+		open source -> (stat source) -> open destination -> (read -> write)* -> close source -> close destination
+	*/
+	void copyUring(std::vector<io::CopyJob>& jobs, const io::IoOptions& options, io::IoStats& stats)
+	{
+		enum Phase { Idle, OpenSrc, StatSrc, OpenDst, Read, Write, CloseSrc, CloseDst };
+		struct Slot {
+			Phase phase = Idle;
+			size_t job = 0;
+			int src = -1;
+			int dst = -1;
+			uint64_t done = 0;
+			unsigned chunk = 0;
+			JobHasher hasher;
+			struct statx info;
+		};
+		unsigned depth = std::max(1u, std::min<unsigned>(options.queueDepth, (unsigned)jobs.size()));
+		Uring ring(depth, stats);
+		std::vector<char> memory((size_t)depth * options.bufferSize);
+		std::vector<iovec> buffers(depth);
+		for (unsigned i = 0; i < depth; ++i) {
+			buffers[i].iov_base = memory.data() + (size_t)i * options.bufferSize;
+			buffers[i].iov_len = options.bufferSize;
+		}
+		ring.registerBuffers(buffers);
+		std::vector<Slot> slots(depth);
+		size_t nextJob = 0;
+		unsigned inFlight = 0;
+		std::string error;
+
+		auto submit = [&](unsigned slotIndex) {
+			auto& slot = slots[slotIndex];
+			auto& job = jobs[slot.job];
+			io_uring_sqe* sqe = nullptr;
+			switch (slot.phase) {
+			case OpenSrc:
+			case OpenDst:
+				sqe = ring.nextSqe();
+				sqe->opcode = IORING_OP_OPENAT;
+				sqe->fd = AT_FDCWD;
+				sqe->addr = (uint64_t)(uintptr_t)(slot.phase == OpenSrc ? job.srcPath.c_str() : job.dstPath.c_str());
+				sqe->open_flags = slot.phase == OpenSrc ? O_RDONLY : (O_WRONLY | O_CREAT | O_TRUNC);
+				sqe->len = slot.phase == OpenSrc ? 0 : CreateMode;
+				break;
+			case StatSrc:
+				sqe = ring.nextSqe();
+				sqe->opcode = IORING_OP_STATX;
+				sqe->fd = slot.src;
+				sqe->addr = (uint64_t)(uintptr_t)"";
+				sqe->len = STATX_SIZE;
+				sqe->off = (uint64_t)(uintptr_t)&slot.info;
+				sqe->statx_flags = AT_EMPTY_PATH;
+				break;
+			case Read:
+				slot.chunk = (unsigned)std::min<uint64_t>(options.bufferSize, job.length - slot.done);
+				sqe = ring.nextSqe();
+				sqe->opcode = IORING_OP_READ_FIXED;
+				sqe->fd = slot.src;
+				sqe->addr = (uint64_t)(uintptr_t)buffers[slotIndex].iov_base;
+				sqe->len = slot.chunk;
+				sqe->off = job.srcOffset + slot.done;
+				sqe->buf_index = slotIndex;
+				break;
+			case Write:
+				sqe = ring.nextSqe();
+				sqe->opcode = IORING_OP_WRITE_FIXED;
+				sqe->fd = slot.dst;
+				sqe->addr = (uint64_t)(uintptr_t)buffers[slotIndex].iov_base;
+				sqe->len = slot.chunk;
+				sqe->off = job.dstOffset + slot.done;
+				sqe->buf_index = slotIndex;
+				break;
+			case CloseSrc:
+			case CloseDst:
+				sqe = ring.nextSqe();
+				sqe->opcode = IORING_OP_CLOSE;
+				sqe->fd = slot.phase == CloseSrc ? slot.src : slot.dst;
+				break;
+			default:
+				return;
+			}
+			sqe->user_data = slotIndex;
+			++inFlight;
+		};
+
+		// moves a slot to the next phase which needs an operation
+		std::function<void(unsigned)> advance = [&](unsigned slotIndex) {
+			auto& slot = slots[slotIndex];
+			while (true) {
+				if (slot.phase == Idle) {
+					if (nextJob >= jobs.size() || !error.empty()) {
+						return;
+					}
+					slot = Slot();
+					slot.job = nextJob++;
+					slot.src = jobs[slot.job].srcFd;
+					slot.dst = jobs[slot.job].dstFd;
+					slot.phase = slot.src < 0 ? OpenSrc : StatSrc;
+				}
+				auto& job = jobs[slot.job];
+				bool needed = true;
+				switch (slot.phase) {
+				case OpenSrc: needed = true; break;
+				case StatSrc: needed = job.checkSize; break;
+				case OpenDst: needed = job.dstFd < 0 && slot.dst < 0 && !job.skipped && !job.sizeMismatch; break;
+				case Read: needed = slot.done < job.length && !job.skipped && !job.sizeMismatch && error.empty(); break;
+				case CloseSrc: needed = job.srcFd < 0 && slot.src >= 0; break;
+				case CloseDst: needed = job.dstFd < 0 && slot.dst >= 0; break;
+				default: break;
+				}
+				if (needed) {
+					submit(slotIndex);
+					return;
+				}
+				switch (slot.phase) {
+				case OpenSrc: slot.phase = StatSrc; break;
+				case StatSrc: slot.phase = OpenDst; break;
+				case OpenDst: slot.phase = Read; break;
+				case Read:
+					slot.hasher.finish(job);
+					slot.phase = CloseSrc;
+					break;
+				case CloseSrc: slot.phase = CloseDst; break;
+				case CloseDst: slot.phase = Idle; break;
+				default: slot.phase = Idle; break;
+				}
+			}
+		};
+
+		auto complete = [&](unsigned slotIndex, int result) {
+			--inFlight;
+			auto& slot = slots[slotIndex];
+			auto& job = jobs[slot.job];
+			switch (slot.phase) {
+			case OpenSrc:
+				if (result == -ENOENT) {
+					job.skipped = true;
+					slot.phase = CloseDst;
+					break;
+				}
+				if (result < 0) {
+					error = errorText("could not open", job.srcPath, -result);
+					slot.phase = CloseDst;
+					break;
+				}
+				++stats.files;
+				slot.src = result;
+				slot.phase = StatSrc;
+				break;
+			case StatSrc:
+				if (result < 0) {
+					error = errorText("could not stat", job.srcPath, -result);
+					slot.phase = CloseSrc;
+					break;
+				}
+				job.srcSize = slot.info.stx_size;
+				job.sizeMismatch = job.srcSize != job.srcOffset + job.length;
+				slot.phase = OpenDst;
+				break;
+			case OpenDst:
+				if (result < 0) {
+					error = errorText("could not open", job.dstPath, -result);
+					slot.phase = CloseSrc;
+					break;
+				}
+				++stats.files;
+				slot.dst = result;
+				slot.phase = Read;
+				break;
+			case Read:
+				if (result <= 0) {
+					error = result < 0 ? errorText("read error", job.srcPath, -result) : "unexpected end of file " + job.srcPath;
+					slot.phase = CloseSrc;
+					break;
+				}
+				stats.bytesRead += result;
+				slot.chunk = (unsigned)result;
+				slot.hasher.update(job, buffers[slotIndex].iov_base, result);
+				slot.phase = Write;
+				break;
+			case Write:
+				if (result != (int)slot.chunk) {
+					error = result < 0 ? errorText("write error", job.dstPath, -result) : "short write " + job.dstPath;
+					slot.phase = CloseSrc;
+					break;
+				}
+				stats.bytesWritten += result;
+				slot.done += result;
+				slot.phase = Read;
+				break;
+			case CloseSrc:
+				slot.src = -1;
+				slot.phase = CloseDst;
+				break;
+			case CloseDst:
+				slot.dst = -1;
+				slot.phase = Idle;
+				break;
+			default:
+				break;
+			}
+			advance(slotIndex);
+		};
+
+		for (unsigned i = 0; i < depth; ++i) {
+			advance(i);
+		}
+		while (inFlight > 0) {
+			ring.submitAndWait();
+			ring.forEachCompletion([&](uint64_t userData, int result) {
+				complete((unsigned)userData, result);
+			});
+		}
+		if (!error.empty()) {
+			throw std::runtime_error(error);
+		}
+	}
+#endif
+}
+
+namespace io {
+
+	std::string IoStats::json() const
+	{
+		const double MB = 1024.0 * 1024.0;
+		std::stringstream ss;
+		ss << "{\"io\": \"" << backend << "\""
+			<< ", \"files\": " << files
+			<< ", \"bytesRead\": " << bytesRead
+			<< ", \"bytesWritten\": " << bytesWritten
+			<< ", \"syscalls\": " << syscalls
+			<< ", \"seconds\": " << seconds
+			<< ", \"MBPerSecond\": " << (seconds > 0 ? bytesWritten / MB / seconds : 0.0)
+			<< "}";
+		return ss.str();
+	}
+
+	Backend parseBackend(const std::string& name)
+	{
+		if (name == "uring") {
+			return BackendUring;
+		}
+		if (name == "pread") {
+			return BackendPread;
+		}
+		if (name == "auto") {
+			return BackendAuto;
+		}
+		throw std::runtime_error("unknown io backend " + name);
+	}
+
+	IoStats copy(std::vector<CopyJob>& jobs, const IoOptions& options)
+	{
+		IoStats stats;
+		auto startTime = std::chrono::steady_clock::now();
+#ifdef WIN32
+		throw std::runtime_error("batch io is not supported on this platform");
+#else
+		bool done = false;
+#ifdef IO_URING_SUPPORTED
+		if (options.backend != BackendPread && !jobs.empty()) {
+			try {
+				stats.backend = "uring";
+				copyUring(jobs, options, stats);
+				done = true;
+			}
+			catch (const std::exception&) {
+				// nothing done yet means io_uring is not available, fall back
+				if (options.backend == BackendUring || stats.bytesRead > 0 || stats.files > 0) {
+					throw;
+				}
+				stats = IoStats();
+			}
+		}
+#else
+		if (options.backend == BackendUring) {
+			throw std::runtime_error("io_uring is not supported on this platform");
+		}
+#endif
+		if (!done) {
+			stats.backend = "pread";
+			copyPread(jobs, options, stats);
+		}
+#endif
+		std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - startTime;
+		stats.seconds = seconds.count();
+		return stats;
+	}
+}
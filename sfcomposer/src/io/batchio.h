@@ -0,0 +1,65 @@
+#ifndef BATCHIO_H
+#define BATCHIO_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <array>
+
+/*
+	copies many byte ranges between files in one batch.
+	sources and destinations are given either as an open file descriptor
+	or as a path which is opened (and closed) by the batch.
+	backends:
+	- uring: io_uring with a bounded queue depth and registered buffers,
+	  opens, reads, writes and closes are submitted asynchronously (Linux >= 5.6)
+	- pread: plain open/pread/pwrite/close, one after another
+*/
+
+namespace io {
+	enum Backend { BackendAuto, BackendUring, BackendPread };
+
+	struct CopyJob {
+		std::string srcPath;
+		int srcFd = -1;
+		uint64_t srcOffset = 0;
+		std::string dstPath;
+		int dstFd = -1;
+		uint64_t dstOffset = 0;
+		uint64_t length = 0;
+		bool skipped = false; // set if the source file does not exist
+		bool checkSize = false; // if set, a source file which is not exactly srcOffset + length bytes is not copied
+		bool sizeMismatch = false; // set if checkSize found another size, srcSize is the size found
+		uint64_t srcSize = 0;
+		bool checksum = false; // if set, crc32c is the CRC-32C of the copied bytes
+		uint32_t crc32c = 0;
+		bool hash = false; // if set, xxh64 is the xxHash64 of the copied bytes
+		uint64_t xxh64 = 0;
+		bool sha256 = false; // if set, sha256Digest is the SHA-256 of the copied bytes
+		std::array<unsigned char, 32> sha256Digest = {};
+	};
+
+	struct IoOptions {
+		Backend backend = BackendAuto;
+		unsigned queueDepth = 32;
+		unsigned bufferSize = 256 * 1024;
+	};
+
+	struct IoStats {
+		std::string backend;
+		uint64_t files = 0;
+		uint64_t bytesRead = 0;
+		uint64_t bytesWritten = 0;
+		uint64_t syscalls = 0;
+		double seconds = 0;
+		std::string json() const;
+	};
+
+	Backend parseBackend(const std::string& name);
+	/*
+		throws on errors, except for missing source files which are skipped
+	*/
+	IoStats copy(std::vector<CopyJob>& jobs, const IoOptions& options);
+}
+
+#endif
@@ -0,0 +1,101 @@
+#include "mappedfile.h"
+#include <stdexcept>
+#include <fstream>
+
+#if defined(WIN32)
+#include <windows.h>
+#elif !defined(__EMSCRIPTEN__)
+#define MMAP_SUPPORTED 1
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace io {
+
+	MappedFile::MappedFile(const std::string& path) : _path(path)
+	{
+#if defined(MMAP_SUPPORTED)
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			throw std::runtime_error("could not open " + path);
+		}
+		struct stat st;
+		if (fstat(fd, &st) != 0) {
+			close(fd);
+			throw std::runtime_error("could not stat " + path);
+		}
+		_size = (uint64_t)st.st_size;
+		if (_size > 0) {
+			void* data = mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0);
+			if (data == MAP_FAILED) {
+				close(fd);
+				throw std::runtime_error("could not map " + path);
+			}
+			madvise(data, _size, MADV_SEQUENTIAL);
+			_data = (const char*)data;
+		}
+		// the mapping stays valid without the descriptor
+		close(fd);
+#elif defined(WIN32)
+		_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (_file == INVALID_HANDLE_VALUE) {
+			_file = nullptr;
+			throw std::runtime_error("could not open " + path);
+		}
+		LARGE_INTEGER size;
+		GetFileSizeEx(_file, &size);
+		_size = (uint64_t)size.QuadPart;
+		if (_size > 0) {
+			_mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			_data = _mapping ? (const char*)MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+			if (_data == nullptr) {
+				if (_mapping) {
+					CloseHandle(_mapping);
+				}
+				CloseHandle(_file);
+				throw std::runtime_error("could not map " + path);
+			}
+		}
+#else
+		std::fstream file(path.c_str(), std::ios_base::in | std::ios_base::binary);
+		if (!file.is_open()) {
+			throw std::runtime_error("could not open " + path);
+		}
+		file.seekg(0, std::ios_base::end);
+		_size = (uint64_t)file.tellg();
+		file.seekg(0, std::ios_base::beg);
+		_buffer.resize(_size);
+		file.read(_buffer.data(), _size);
+		_data = _buffer.data();
+#endif
+	}
+
+	MappedFile::~MappedFile()
+	{
+#if defined(MMAP_SUPPORTED)
+		if (_data) {
+			munmap((void*)_data, _size);
+		}
+#elif defined(WIN32)
+		if (_data) {
+			UnmapViewOfFile(_data);
+		}
+		if (_mapping) {
+			CloseHandle(_mapping);
+		}
+		if (_file) {
+			CloseHandle(_file);
+		}
+#endif
+	}
+
+	const char* MappedFile::at(uint64_t offset, uint64_t length) const
+	{
+		if (offset > _size || length > _size - offset) {
+			throw std::runtime_error("range out of bounds in " + _path);
+		}
+		return _data + offset;
+	}
+}
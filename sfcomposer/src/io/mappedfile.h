@@ -0,0 +1,40 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/*
+	a read only view of a whole file.
+	the file is memory mapped where possible, otherwise
+	(emscripten) it is read into memory once.
+*/
+
+namespace io {
+	class MappedFile {
+	public:
+		explicit MappedFile(const std::string& path);
+		~MappedFile();
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+		const char* data() const { return _data; }
+		uint64_t size() const { return _size; }
+		/*
+			throws if the range is not within the file
+		*/
+		const char* at(uint64_t offset, uint64_t length) const;
+	private:
+		std::string _path;
+		const char* _data = nullptr;
+		uint64_t _size = 0;
+		std::vector<char> _buffer;
+#ifdef WIN32
+		void* _file = nullptr;
+		void* _mapping = nullptr;
+#endif
+	};
+}
+
+#endif
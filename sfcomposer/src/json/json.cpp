@@ -0,0 +1,137 @@
+#include "json.h"
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <cctype>
+
+namespace {
+	class Reader {
+	public:
+		explicit Reader(const std::string& text) : _text(text) {}
+		json::Value read()
+		{
+			json::Value value;
+			skip();
+			if (_pos >= _text.size()) {
+				throw std::runtime_error("unexpected end of json");
+			}
+			char c = _text[_pos];
+			if (c == '{') {
+				value.type = json::Value::Object;
+				++_pos;
+				while (!consume('}')) {
+					consume(',');
+					skip();
+					auto key = readString();
+					if (!consume(':')) {
+						throw std::runtime_error("json: missing ':' after " + key);
+					}
+					value.members.emplace_back(key, read());
+				}
+			}
+			else if (c == '[') {
+				value.type = json::Value::Array;
+				++_pos;
+				while (!consume(']')) {
+					consume(',');
+					value.items.push_back(read());
+				}
+			}
+			else if (c == '"') {
+				value.type = json::Value::String;
+				value.string = readString();
+			}
+			else if (_text.compare(_pos, 4, "true") == 0 || _text.compare(_pos, 5, "false") == 0) {
+				value.type = json::Value::Bool;
+				value.number = c == 't' ? 1 : 0;
+				_pos += c == 't' ? 4 : 5;
+			}
+			else if (_text.compare(_pos, 4, "null") == 0) {
+				_pos += 4;
+			}
+			else {
+				value.type = json::Value::Number;
+				size_t length = 0;
+				try {
+					value.number = std::stod(_text.substr(_pos, 32), &length);
+				}
+				catch (const std::logic_error&) {
+					throw std::runtime_error("json: number expected");
+				}
+				_pos += length;
+			}
+			return value;
+		}
+	private:
+		void skip()
+		{
+			while (_pos < _text.size() && isspace((unsigned char)_text[_pos])) {
+				++_pos;
+			}
+		}
+		bool consume(char c)
+		{
+			skip();
+			if (_pos < _text.size() && _text[_pos] == c) {
+				++_pos;
+				return true;
+			}
+			if (_pos >= _text.size()) {
+				throw std::runtime_error("unexpected end of json");
+			}
+			return false;
+		}
+		std::string readString()
+		{
+			if (_pos >= _text.size() || _text[_pos] != '"') {
+				throw std::runtime_error("json: string expected");
+			}
+			std::string result;
+			for (++_pos; _pos < _text.size() && _text[_pos] != '"'; ++_pos) {
+				if (_text[_pos] == '\\' && ++_pos >= _text.size()) {
+					break;
+				}
+				result.push_back(_text[_pos]);
+			}
+			++_pos;
+			return result;
+		}
+		const std::string& _text;
+		size_t _pos = 0;
+	};
+}
+
+namespace json {
+
+	const Value* Value::get(const std::string& key) const
+	{
+		for (const auto& member : members) {
+			if (member.first == key) {
+				return &member.second;
+			}
+		}
+		return nullptr;
+	}
+
+	std::string Value::text(const std::string& key) const
+	{
+		auto* value = get(key);
+		return value ? value->string : std::string();
+	}
+
+	Value read(const std::string& text)
+	{
+		return Reader(text).read();
+	}
+
+	Value readFile(const std::string& path)
+	{
+		std::ifstream file(path.c_str());
+		if (!file) {
+			throw std::runtime_error("could not read " + path);
+		}
+		std::stringstream ss;
+		ss << file.rdbuf();
+		return read(ss.str());
+	}
+}
@@ -0,0 +1,38 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <string>
+#include <vector>
+#include <utility>
+
+/*
+	a small reader for the json written by the tools themselves (results, --stats,
+	layout maps), just enough to read it back. numbers are doubles
+*/
+
+namespace json {
+	struct Value {
+		enum Type { Null, Bool, Number, String, Array, Object };
+		Type type = Null;
+		double number = 0;
+		std::string string;
+		std::vector<Value> items;
+		std::vector<std::pair<std::string, Value>> members;
+
+		// nullptr if there is no such member
+		const Value* get(const std::string& key) const;
+		// the string member, empty if there is none
+		std::string text(const std::string& key) const;
+	};
+
+	/*
+		throws on invalid json
+	*/
+	Value read(const std::string& text);
+	/*
+		throws if the file can not be read
+	*/
+	Value readFile(const std::string& path);
+}
+
+#endif
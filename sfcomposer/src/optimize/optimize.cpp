@@ -0,0 +1,442 @@
+#include "optimize.h"
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <sstream>
+
+namespace {
+	const int NoDefault = 0x10000;
+	// lo 0, hi 127
+	const int FullRange = 127 << 8;
+
+	/*
+		the value of a generator which a zone without it has,
+		NoDefault for indices and unused generators
+	*/
+	int defaultAmount(dat::For for_, int gen)
+	{
+		switch (gen) {
+		case Gen_Unused1: case Gen_Unused2: case Gen_Unused3: case Gen_Unused4:
+		case Gen_Reserved1: case Gen_Reserved2: case Gen_Reserved3:
+		case Gen_Instrument: case Gen_SampleId:
+			return NoDefault;
+		case Gen_KeyRange: case Gen_VelRange:
+			return FullRange;
+		}
+		if (gen < 0 || gen >= Gen_Dummy) {
+			return NoDefault;
+		}
+		// preset generators are added to the ones of the instrument
+		if (for_ == dat::ForPreset) {
+			return 0;
+		}
+		switch (gen) {
+		case Gen_FilterFc:
+			return 13500;
+		case Gen_ModLFODelay: case Gen_VibLFODelay:
+		case Gen_ModEnvDelay: case Gen_ModEnvAttack: case Gen_ModEnvHold: case Gen_ModEnvDecay: case Gen_ModEnvRelease:
+		case Gen_VolEnvDelay: case Gen_VolEnvAttack: case Gen_VolEnvHold: case Gen_VolEnvDecay: case Gen_VolEnvRelease:
+			return -12000;
+		case Gen_Keynum: case Gen_Velocity: case Gen_OverrideRootKey:
+			return -1;
+		case Gen_ScaleTune:
+			return 100;
+		default:
+			return 0;
+		}
+	}
+
+	bool isDefault(dat::For for_, const dat::Generator& generator)
+	{
+		int value = defaultAmount(for_, generator.gen);
+		if (value == NoDefault) {
+			return false;
+		}
+		bool range = generator.gen == Gen_KeyRange || generator.gen == Gen_VelRange;
+		return range ? generator.amount.uword == value : generator.amount.sword == value;
+	}
+
+	struct Zone {
+		// linked to an instrument or sample, a zone which is not is the global one if it comes first
+		bool linked = false;
+		std::vector<size_t> generators;
+		std::vector<size_t> modulators;
+	};
+
+	typedef std::pair<int, dat::Id> Owner;
+
+	struct Zones {
+		std::unordered_map<dat::Id, Zone> byId;
+		// of every preset and instrument in the order compose creates them
+		std::map<Owner, std::vector<dat::Id>> ofOwner;
+	};
+
+	Zones getZones(const dat::Skeleton& skeleton)
+	{
+		Zones zones;
+		auto add = [&zones](dat::For for_, dat::Id owner, dat::Id zone) -> Zone& {
+			auto it = zones.byId.find(zone);
+			if (it != zones.byId.end()) {
+				return it->second;
+			}
+			zones.ofOwner[{ for_, owner }].push_back(zone);
+			return zones.byId[zone];
+		};
+		for (size_t i = 0; i < skeleton.generators.size(); ++i) {
+			const auto& generator = skeleton.generators[i];
+			add(generator.for_, generator.relatedTo, generator.zone).generators.push_back(i);
+		}
+		for (size_t i = 0; i < skeleton.modulators.size(); ++i) {
+			const auto& modulator = skeleton.modulators[i];
+			add(modulator.for_, modulator.relatedTo, modulator.zone).modulators.push_back(i);
+		}
+		for (const auto& rel : skeleton.instrument2Preset) {
+			add(dat::ForPreset, rel.preset, rel.zone).linked = true;
+		}
+		for (const auto& rel : skeleton.sample2Instruments) {
+			add(dat::ForInstrument, rel.instrument, rel.zone).linked = true;
+		}
+		return zones;
+	}
+
+	/*
+		generator -> index of the generators a zone has once, a synthesizer
+		may take either of a repeated one, so those are left alone
+	*/
+	std::map<int, size_t> singleGenerators(const Zone& zone, const dat::Skeleton& skeleton, std::set<int>* repeated = nullptr)
+	{
+		std::map<int, size_t> result;
+		std::set<int> twice;
+		for (auto i : zone.generators) {
+			int gen = skeleton.generators[i].gen;
+			if (!result.insert({ gen, i }).second) {
+				twice.insert(gen);
+			}
+		}
+		for (auto gen : twice) {
+			result.erase(gen);
+		}
+		if (repeated) {
+			*repeated = twice;
+		}
+		return result;
+	}
+
+	struct Pass {
+		dat::Skeleton& skeleton;
+		Zones zones;
+		std::vector<bool> dropGenerator;
+		std::vector<bool> dropModulator;
+		// moved into the global zone (by zone id)
+		std::unordered_map<dat::Id, std::vector<dat::Generator>> hoisted;
+		// duplicate instrument -> the one kept
+		std::unordered_map<dat::Id, dat::Id> merged;
+		optimize::Reduction reduction;
+
+		explicit Pass(dat::Skeleton& skeleton) : skeleton(skeleton), zones(getZones(skeleton)),
+			dropGenerator(skeleton.generators.size()), dropModulator(skeleton.modulators.size())
+		{
+		}
+
+		void canonicalize(dat::For for_, const std::vector<dat::Id>& ids)
+		{
+			auto& first = zones.byId[ids.front()];
+			Zone* global = first.linked ? nullptr : &first;
+			std::vector<Zone*> locals;
+			for (auto id : ids) {
+				auto& zone = zones.byId[id];
+				if (zone.linked) {
+					locals.push_back(&zone);
+				}
+			}
+			std::set<int> globalRepeated;
+			std::map<int, size_t> globalValues;
+			if (global) {
+				globalValues = singleGenerators(*global, skeleton, &globalRepeated);
+			}
+			// a global generator with the default value is the same as none
+			for (auto it = globalValues.begin(); it != globalValues.end();) {
+				if (isDefault(for_, skeleton.generators[it->second])) {
+					dropGenerator[it->second] = true;
+					it = globalValues.erase(it);
+				}
+				else {
+					++it;
+				}
+			}
+			// the value a local zone inherits: the one of the global zone, or the default
+			for (auto* local : locals) {
+				for (const auto& single : singleGenerators(*local, skeleton)) {
+					if (globalRepeated.count(single.first)) {
+						continue;
+					}
+					const auto& generator = skeleton.generators[single.second];
+					auto inherited = globalValues.find(single.first);
+					bool redundant = inherited != globalValues.end()
+						? skeleton.generators[inherited->second].amount.uword == generator.amount.uword
+						: isDefault(for_, generator);
+					if (redundant) {
+						dropGenerator[single.second] = true;
+					}
+				}
+			}
+			if (global && !global->generators.empty() && locals.size() >= 2) {
+				hoist(for_, ids.front(), globalValues, globalRepeated, locals);
+			}
+			// the first zone keeps a generator so that it stays first (a global zone is only one if it is)
+			bool emptied = !first.generators.empty() && hoisted.find(ids.front()) == hoisted.end();
+			for (auto i : first.generators) {
+				emptied = emptied && dropGenerator[i];
+			}
+			if (emptied) {
+				dropGenerator[first.generators.front()] = false;
+			}
+			dropModulators(global, locals);
+		}
+
+		/*
+			a generator all local zones have with the same value is set once in the global zone
+		*/
+		void hoist(dat::For for_, dat::Id globalId, const std::map<int, size_t>& globalValues,
+			const std::set<int>& globalRepeated, const std::vector<Zone*>& locals)
+		{
+			std::vector<std::map<int, size_t>> singles;
+			for (auto* local : locals) {
+				singles.push_back(singleGenerators(*local, skeleton));
+			}
+			for (const auto& candidate : singles.front()) {
+				int gen = candidate.first;
+				const auto& generator = skeleton.generators[candidate.second];
+				if (defaultAmount(for_, gen) == NoDefault || gen == Gen_KeyRange || gen == Gen_VelRange
+					|| globalValues.count(gen) || globalRepeated.count(gen) || dropGenerator[candidate.second]) {
+					continue;
+				}
+				bool common = true;
+				for (const auto& other : singles) {
+					auto it = other.find(gen);
+					common = common && it != other.end() && !dropGenerator[it->second]
+						&& skeleton.generators[it->second].amount.uword == generator.amount.uword;
+				}
+				if (!common) {
+					continue;
+				}
+				for (const auto& other : singles) {
+					dropGenerator[other.at(gen)] = true;
+				}
+				auto moved = generator;
+				moved.zone = globalId;
+				hoisted[globalId].push_back(moved);
+				++reduction.hoistedGenerators;
+			}
+		}
+
+		/*
+			modulators are composed with "no controller" as source, which is a constant 1,
+			so one with amount 0 adds nothing unless it replaces a global one with the same destination
+		*/
+		void dropModulators(Zone* global, const std::vector<Zone*>& locals)
+		{
+			std::multiset<int> globalDestinations;
+			if (global) {
+				for (auto i : global->modulators) {
+					globalDestinations.insert(skeleton.modulators[i].dst);
+				}
+			}
+			auto dropZeros = [this](const Zone& zone, const std::multiset<int>& replaced) {
+				std::multiset<int> destinations;
+				for (auto i : zone.modulators) {
+					destinations.insert(skeleton.modulators[i].dst);
+				}
+				for (auto i : zone.modulators) {
+					const auto& modulator = skeleton.modulators[i];
+					if (modulator.amount == 0 && destinations.count(modulator.dst) == 1 && replaced.count(modulator.dst) == 0) {
+						dropModulator[i] = true;
+					}
+				}
+			};
+			if (global) {
+				dropZeros(*global, std::multiset<int>());
+			}
+			for (auto* local : locals) {
+				dropZeros(*local, globalDestinations);
+			}
+		}
+
+		/*
+			instruments with the same zones (after canonicalize) are merged into the first of them
+		*/
+		void mergeInstruments()
+		{
+			std::unordered_map<dat::Id, std::vector<dat::Id>> samplesOfZone;
+			for (const auto& rel : skeleton.sample2Instruments) {
+				samplesOfZone[rel.zone].push_back(rel.sample);
+			}
+			std::map<std::string, dat::Id> bySignature;
+			for (const auto& owner : zones.ofOwner) {
+				if (owner.first.first != dat::ForInstrument) {
+					continue;
+				}
+				std::stringstream signature;
+				for (auto id : owner.second) {
+					const auto& zone = zones.byId[id];
+					signature << "z";
+					for (auto i : zone.generators) {
+						if (!dropGenerator[i]) {
+							signature << " " << skeleton.generators[i].gen << ":" << skeleton.generators[i].amount.uword;
+						}
+					}
+					auto it = hoisted.find(id);
+					if (it != hoisted.end()) {
+						for (const auto& generator : it->second) {
+							signature << " " << generator.gen << ":" << generator.amount.uword;
+						}
+					}
+					signature << " m";
+					for (auto i : zone.modulators) {
+						if (!dropModulator[i]) {
+							signature << " " << skeleton.modulators[i].dst << ":" << skeleton.modulators[i].amount;
+						}
+					}
+					signature << " s";
+					for (auto sample : samplesOfZone[id]) {
+						signature << " " << sample;
+					}
+				}
+				auto inserted = bySignature.insert({ signature.str(), owner.first.second });
+				if (!inserted.second) {
+					merged[owner.first.second] = inserted.first->second;
+				}
+			}
+			reduction.instruments = merged.size();
+		}
+
+		bool isMerged(dat::For for_, dat::Id relatedTo) const
+		{
+			return for_ == dat::ForInstrument && merged.count(relatedTo) > 0;
+		}
+
+		void apply()
+		{
+			std::unordered_map<size_t, dat::Id> hoistAfter;
+			for (const auto& zone : hoisted) {
+				hoistAfter[zones.byId[zone.first].generators.back()] = zone.first;
+			}
+			dat::Container<dat::Generator> generators;
+			for (size_t i = 0; i < skeleton.generators.size(); ++i) {
+				const auto& generator = skeleton.generators[i];
+				if (isMerged(generator.for_, generator.relatedTo)) {
+					continue;
+				}
+				if (!dropGenerator[i]) {
+					generators.push_back(generator);
+				}
+				auto it = hoistAfter.find(i);
+				if (it != hoistAfter.end()) {
+					const auto& moved = hoisted[it->second];
+					generators.insert(generators.end(), moved.begin(), moved.end());
+				}
+			}
+			reduction.generators = skeleton.generators.size() - generators.size();
+			skeleton.generators.swap(generators);
+
+			dat::Container<dat::Modulator> modulators;
+			for (size_t i = 0; i < skeleton.modulators.size(); ++i) {
+				const auto& modulator = skeleton.modulators[i];
+				if (!dropModulator[i] && !isMerged(modulator.for_, modulator.relatedTo)) {
+					modulators.push_back(modulator);
+				}
+			}
+			reduction.modulators = skeleton.modulators.size() - modulators.size();
+			skeleton.modulators.swap(modulators);
+
+			auto& instruments = skeleton.instruments;
+			instruments.erase(std::remove_if(instruments.begin(), instruments.end(), [this](const dat::Instrument& instrument) {
+				return merged.count(instrument.id) > 0;
+			}), instruments.end());
+			auto& sample2Instruments = skeleton.sample2Instruments;
+			sample2Instruments.erase(std::remove_if(sample2Instruments.begin(), sample2Instruments.end(), [this](const dat::Sample2Instrument& rel) {
+				return merged.count(rel.instrument) > 0;
+			}), sample2Instruments.end());
+			for (auto& rel : skeleton.instrument2Preset) {
+				auto it = merged.find(rel.instrument);
+				if (it != merged.end()) {
+					rel.instrument = it->second;
+				}
+			}
+		}
+	};
+}
+
+namespace optimize {
+
+	std::string Reduction::jsonFields() const
+	{
+		std::stringstream ss;
+		ss << "\"removedGenerators\": " << generators << ", \"hoistedGenerators\": " << hoistedGenerators
+			<< ", \"removedModulators\": " << modulators << ", \"mergedInstruments\": " << instruments;
+		return ss.str();
+	}
+
+	Reduction skeleton(dat::Skeleton& skeleton)
+	{
+		Pass pass(skeleton);
+		for (const auto& owner : pass.zones.ofOwner) {
+			pass.canonicalize(static_cast<dat::For>(owner.first.first), owner.second);
+		}
+		pass.mergeInstruments();
+		pass.apply();
+		return pass.reduction;
+	}
+
+	uint64_t pdtaBytes(const dat::Skeleton& skeleton, const Keep& keepPreset, const Keep& keepInstrument, const Keep& keepSample)
+	{
+		auto keep = [](const Keep& keep, dat::Id id) {
+			return !keep || keep(id);
+		};
+		uint64_t presets = 0, instruments = 0, samples = 0;
+		uint64_t presetGenerators = 0, presetModulators = 0, instrumentGenerators = 0, instrumentModulators = 0;
+		std::unordered_set<dat::Id> presetZones, instrumentZones;
+		for (const auto& preset : skeleton.presets) {
+			presets += keep(keepPreset, preset.id);
+		}
+		for (const auto& instrument : skeleton.instruments) {
+			instruments += keep(keepInstrument, instrument.id);
+		}
+		for (const auto& sample : skeleton.samples) {
+			samples += keep(keepSample, sample.id);
+		}
+		for (const auto& generator : skeleton.generators) {
+			bool forPreset = generator.for_ == dat::ForPreset;
+			if (keep(forPreset ? keepPreset : keepInstrument, generator.relatedTo)) {
+				++(forPreset ? presetGenerators : instrumentGenerators);
+				(forPreset ? presetZones : instrumentZones).insert(generator.zone);
+			}
+		}
+		for (const auto& modulator : skeleton.modulators) {
+			bool forPreset = modulator.for_ == dat::ForPreset;
+			if (keep(forPreset ? keepPreset : keepInstrument, modulator.relatedTo)) {
+				++(forPreset ? presetModulators : instrumentModulators);
+				(forPreset ? presetZones : instrumentZones).insert(modulator.zone);
+			}
+		}
+		for (const auto& rel : skeleton.instrument2Preset) {
+			if (keep(keepPreset, rel.preset) && keep(keepInstrument, rel.instrument)) {
+				++presetGenerators;
+				presetZones.insert(rel.zone);
+			}
+		}
+		for (const auto& rel : skeleton.sample2Instruments) {
+			if (keep(keepInstrument, rel.instrument) && keep(keepSample, rel.sample)) {
+				++instrumentGenerators;
+				instrumentZones.insert(rel.zone);
+			}
+		}
+		// LIST header, 9 sub chunk headers, every record list ends with a terminal record
+		return 12 + 9 * 8
+			+ 38 * (presets + 1) + 4 * (presetZones.size() + 1) + 10 * (presetModulators + 1) + 4 * (presetGenerators + 1)
+			+ 22 * (instruments + 1) + 4 * (instrumentZones.size() + 1) + 10 * (instrumentModulators + 1) + 4 * (instrumentGenerators + 1)
+			+ 46 * (samples + 1);
+	}
+}
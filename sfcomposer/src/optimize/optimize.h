@@ -0,0 +1,38 @@
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+#include "dat/dat.h"
+#include <string>
+#include <cstdint>
+#include <functional>
+
+/*
+	canonicalizes the zones of a skeleton without changing what a synthesizer plays:
+	generators with the value a zone inherits anyway (the one of the global zone or
+	the spec default) are dropped, generators every local zone of an instrument or
+	preset has with the same value are moved into its global zone, modulators adding
+	nothing are dropped and instruments with the same zones are merged.
+	ids, zone ids and the order of the records stay the same.
+*/
+
+namespace optimize {
+	struct Reduction {
+		uint64_t generators = 0;
+		uint64_t hoistedGenerators = 0;
+		uint64_t modulators = 0;
+		uint64_t instruments = 0;
+		// "removedGenerators": ..., to be embedded in a json object
+		std::string jsonFields() const;
+	};
+
+	Reduction skeleton(dat::Skeleton& skeleton);
+
+	typedef std::function<bool(dat::Id)> Keep;
+	/*
+		the size of the pdta chunk composed of the kept presets, instruments and samples (all if empty)
+	*/
+	uint64_t pdtaBytes(const dat::Skeleton& skeleton, const Keep& keepPreset = nullptr,
+		const Keep& keepInstrument = nullptr, const Keep& keepSample = nullptr);
+}
+
+#endif
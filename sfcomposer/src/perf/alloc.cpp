@@ -0,0 +1,126 @@
+#include "alloc.h"
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#if defined(_WIN32)
+#include <malloc.h>
+#define USABLE_SIZE(p) _msize(p)
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#define USABLE_SIZE(p) malloc_size(p)
+#else
+#include <malloc.h>
+#define USABLE_SIZE(p) malloc_usable_size(p)
+#endif
+
+namespace {
+	std::atomic<bool> enabled(false);
+	std::atomic<uint64_t> allocations(0);
+	std::atomic<uint64_t> bytes(0);
+	std::atomic<int64_t> live(0);
+	std::atomic<int64_t> peak(0);
+	std::atomic<uint64_t> largest(0);
+
+	template <class T>
+	void raise(std::atomic<T>& value, T candidate)
+	{
+		T current = value.load(std::memory_order_relaxed);
+		while (candidate > current && !value.compare_exchange_weak(current, candidate, std::memory_order_relaxed)) {
+		}
+	}
+
+	void release(void* p)
+	{
+		if (p && enabled.load(std::memory_order_relaxed)) {
+			perf::trackFree(p);
+		}
+		std::free(p);
+	}
+}
+
+namespace perf {
+
+	void enableAllocStats(bool enable)
+	{
+		enabled = enable;
+	}
+
+	bool allocStatsEnabled()
+	{
+		return enabled.load(std::memory_order_relaxed);
+	}
+
+	void trackAllocation(void* p)
+	{
+		uint64_t size = USABLE_SIZE(p);
+		allocations.fetch_add(1, std::memory_order_relaxed);
+		bytes.fetch_add(size, std::memory_order_relaxed);
+		int64_t current = live.fetch_add((int64_t)size, std::memory_order_relaxed) + (int64_t)size;
+		raise(peak, current);
+		raise(largest, size);
+	}
+
+	void trackFree(void* p)
+	{
+		live.fetch_sub((int64_t)USABLE_SIZE(p), std::memory_order_relaxed);
+	}
+
+	AllocCounters allocCounters()
+	{
+		AllocCounters result;
+		result.allocations = allocations.load(std::memory_order_relaxed);
+		result.bytes = bytes.load(std::memory_order_relaxed);
+		result.live = live.load(std::memory_order_relaxed);
+		result.peak = peak.load(std::memory_order_relaxed);
+		result.largest = largest.load(std::memory_order_relaxed);
+		return result;
+	}
+
+	AllocMark beginAllocPhase()
+	{
+		AllocMark mark;
+		mark.start = allocCounters();
+		mark.outerPeak = peak.exchange(mark.start.live, std::memory_order_relaxed);
+		mark.outerLargest = largest.exchange(0, std::memory_order_relaxed);
+		return mark;
+	}
+
+	AllocCounters endAllocPhase(const AllocMark& mark)
+	{
+		auto current = allocCounters();
+		AllocCounters result;
+		result.allocations = current.allocations - mark.start.allocations;
+		result.bytes = current.bytes - mark.start.bytes;
+		result.live = current.live - mark.start.live;
+		result.peak = current.peak - mark.start.live;
+		result.largest = current.largest;
+		raise(peak, mark.outerPeak);
+		raise(largest, mark.outerLargest);
+		return result;
+	}
+
+	AllocCounters takeAllocCounters()
+	{
+		AllocCounters result;
+		result.allocations = allocations.exchange(0, std::memory_order_relaxed);
+		result.bytes = bytes.exchange(0, std::memory_order_relaxed);
+		result.live = live.load(std::memory_order_relaxed);
+		result.peak = peak.exchange(result.live, std::memory_order_relaxed);
+		result.largest = largest.exchange(0, std::memory_order_relaxed);
+		return result;
+	}
+
+	char* dupString(const char* s)
+	{
+		char* result = strdup(s);
+		if (result && allocStatsEnabled()) {
+			trackAllocation(result);
+		}
+		return result;
+	}
+
+	void freeString(char* s)
+	{
+		release(s);
+	}
+}
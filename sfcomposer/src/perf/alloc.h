@@ -0,0 +1,58 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <cstdint>
+
+/*
+	heap accounting: count and bytes of the allocations, live and peak live bytes
+	and the largest single allocation. the executables replace the global operator
+	new and delete (allocoperators.cpp, native and wasm), the sfcomposelib library
+	does not, so an application linking it keeps its allocator. strings allocated
+	with malloc use dupString and freeString. bytes are the usable sizes of the heap blocks.
+	disabled by default, then an allocation costs one branch. memory allocated
+	before enabling and released afterwards lowers the live bytes, so live and
+	peak bytes are relative to the start of a phase.
+	the counters are process wide and a phase resets the peak and the largest
+	allocation: phases are measured one thread at a time (like the command line
+	tools do), phases of several threads at once mix their peaks.
+*/
+
+namespace perf {
+	struct AllocCounters {
+		uint64_t allocations = 0;
+		uint64_t bytes = 0;
+		int64_t live = 0;
+		int64_t peak = 0;
+		uint64_t largest = 0;
+	};
+
+	/*
+		the state at the start of a phase, the peak and the largest
+		allocation are measured from there and restored at its end
+	*/
+	struct AllocMark {
+		AllocCounters start;
+		int64_t outerPeak = 0;
+		uint64_t outerLargest = 0;
+	};
+
+	void enableAllocStats(bool enable);
+	bool allocStatsEnabled();
+	void trackAllocation(void* p);
+	void trackFree(void* p);
+	AllocCounters allocCounters();
+	AllocMark beginAllocPhase();
+	/*
+		allocations and bytes since the mark, peak is the highest live bytes above the start
+	*/
+	AllocCounters endAllocPhase(const AllocMark& mark);
+	/*
+		the counters since the last call, the peak restarts at the live bytes
+	*/
+	AllocCounters takeAllocCounters();
+
+	char* dupString(const char* s);
+	void freeString(char* s);
+}
+
+#endif
@@ -0,0 +1,86 @@
+#include "alloc.h"
+#include <new>
+#include <cstdlib>
+
+/*
+	the global operator new and delete, counting the allocations while
+	alloc stats are enabled. only linked into the executables: an application
+	linking sfcomposelib keeps its own allocator (and counts only dupString)
+*/
+
+namespace {
+	void* allocate(std::size_t size)
+	{
+		void* p = std::malloc(size > 0 ? size : 1);
+		if (p && perf::allocStatsEnabled()) {
+			perf::trackAllocation(p);
+		}
+		return p;
+	}
+
+	void release(void* p)
+	{
+		if (p && perf::allocStatsEnabled()) {
+			perf::trackFree(p);
+		}
+		std::free(p);
+	}
+}
+
+void* operator new(std::size_t size)
+{
+	void* p = allocate(size);
+	if (!p) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void* operator new[](std::size_t size)
+{
+	void* p = allocate(size);
+	if (!p) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+	return allocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+	return allocate(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	release(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	release(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+	release(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+	release(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+	release(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+	release(p);
+}
@@ -0,0 +1,56 @@
+#include "phases.h"
+#include <atomic>
+#include <mutex>
+#include <ctime>
+#include <algorithm>
+
+namespace {
+	std::atomic<bool> enabled(false);
+	std::mutex mutex;
+	perf::PhaseTimes phases;
+}
+
+namespace perf {
+
+	void enablePhases(bool enable)
+	{
+		enabled = enable;
+	}
+
+	bool phasesEnabled()
+	{
+		return enabled.load(std::memory_order_relaxed);
+	}
+
+	void addPhase(const char* name, double seconds, double cpuSeconds)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto& phase = phases[name];
+		phase.seconds += seconds;
+		phase.cpuSeconds += cpuSeconds;
+		++phase.count;
+	}
+
+	void addPhaseAllocations(const char* name, const AllocCounters& counters)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto& phase = phases[name];
+		phase.allocations += counters.allocations;
+		phase.allocatedBytes += counters.bytes;
+		phase.peakBytes = std::max(phase.peakBytes, counters.peak);
+		phase.largestAllocation = std::max(phase.largestAllocation, counters.largest);
+	}
+
+	double cpuTime()
+	{
+		return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+	}
+
+	PhaseTimes takePhases()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		PhaseTimes result;
+		result.swap(phases);
+		return result;
+	}
+}
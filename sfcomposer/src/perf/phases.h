@@ -0,0 +1,92 @@
+#ifndef PHASES_H
+#define PHASES_H
+
+#include "trace.h"
+#include "alloc.h"
+#include <string>
+#include <map>
+#include <chrono>
+#include <cstdint>
+
+/*
+	wall and cpu time of named phases (read, createFilter, writeSmpl, ...).
+	disabled by default, a disabled ScopedPhase costs two branches.
+	phases may be nested and run on several threads, the times of
+	a phase are summed up until they are taken.
+	if tracing is enabled every phase is a span of the trace, too,
+	with the heap accounting the allocations of a phase are counted.
+*/
+
+namespace perf {
+	struct PhaseTime {
+		double seconds = 0;
+		// cpu time of the whole process, includes other threads
+		double cpuSeconds = 0;
+		uint64_t count = 0;
+		// heap accounting, summed up except peak (above the live bytes at the start) and largest
+		uint64_t allocations = 0;
+		uint64_t allocatedBytes = 0;
+		int64_t peakBytes = 0;
+		uint64_t largestAllocation = 0;
+	};
+
+	typedef std::map<std::string, PhaseTime> PhaseTimes;
+
+	void enablePhases(bool enable);
+	bool phasesEnabled();
+	void addPhase(const char* name, double seconds, double cpuSeconds);
+	void addPhaseAllocations(const char* name, const AllocCounters& counters);
+	double cpuTime();
+	/*
+		returns the times recorded since the last call and resets them
+	*/
+	PhaseTimes takePhases();
+
+	class ScopedPhase {
+	public:
+		explicit ScopedPhase(const char* name) : _name(name)
+		{
+			_timed = phasesEnabled();
+			_traced = traceEnabled();
+			if (_timed || _traced) {
+				_start = std::chrono::steady_clock::now();
+			}
+			if (_timed) {
+				_cpuStart = cpuTime();
+			}
+			_counted = _timed && allocStatsEnabled();
+			if (_counted) {
+				_allocMark = beginAllocPhase();
+			}
+		}
+		~ScopedPhase()
+		{
+			if (!_timed && !_traced) {
+				return;
+			}
+			auto end = std::chrono::steady_clock::now();
+			if (_timed) {
+				std::chrono::duration<double> seconds = end - _start;
+				addPhase(_name, seconds.count(), cpuTime() - _cpuStart);
+			}
+			if (_counted) {
+				addPhaseAllocations(_name, endAllocPhase(_allocMark));
+			}
+			if (_traced) {
+				addSpan(_name, _start, end, SpanArgs());
+			}
+		}
+		ScopedPhase(const ScopedPhase&) = delete;
+		ScopedPhase& operator=(const ScopedPhase&) = delete;
+	private:
+		const char* _name;
+		std::chrono::steady_clock::time_point _start;
+		double _cpuStart = 0;
+		bool _timed = false;
+		bool _traced = false;
+		bool _counted = false;
+		AllocMark _allocMark;
+	};
+}
+
+#endif
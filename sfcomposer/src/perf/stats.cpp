@@ -0,0 +1,59 @@
+#include "stats.h"
+#include <atomic>
+#include <sstream>
+
+namespace {
+	std::atomic<uint64_t> counters[perf::NumCounters];
+}
+
+namespace perf {
+
+	const char* counterName(Counter counter)
+	{
+		switch (counter) {
+		case SamplesRead: return "samplesRead";
+		case SampleBytesRead: return "sampleBytesRead";
+		case FileOpens: return "fileOpens";
+		case WriteCalls: return "writeCalls";
+		case BytesWritten: return "bytesWritten";
+		case OutputBytes: return "outputBytes";
+		default: return "unknown";
+		}
+	}
+
+	void addCount(Counter counter, uint64_t n)
+	{
+		counters[counter].fetch_add(n, std::memory_order_relaxed);
+	}
+
+	std::string takeStats()
+	{
+		std::stringstream ss;
+		bool memory = allocStatsEnabled();
+		ss << "{\"phases\": {";
+		bool first = true;
+		for (const auto& phase : takePhases()) {
+			ss << (first ? "" : ", ") << "\"" << phase.first << "\": {\"wallMs\": " << phase.second.seconds * 1000.0
+				<< ", \"cpuMs\": " << phase.second.cpuSeconds * 1000.0 << ", \"count\": " << phase.second.count;
+			if (memory) {
+				ss << ", \"allocations\": " << phase.second.allocations << ", \"allocatedBytes\": " << phase.second.allocatedBytes
+					<< ", \"peakBytes\": " << phase.second.peakBytes << ", \"largestAllocation\": " << phase.second.largestAllocation;
+			}
+			ss << "}";
+			first = false;
+		}
+		ss << "}, \"counters\": {";
+		for (int i = 0; i < NumCounters; ++i) {
+			auto value = counters[i].exchange(0, std::memory_order_relaxed);
+			ss << (i > 0 ? ", " : "") << "\"" << counterName(static_cast<Counter>(i)) << "\": " << value;
+		}
+		ss << "}";
+		if (memory) {
+			auto heap = takeAllocCounters();
+			ss << ", \"memory\": {\"allocations\": " << heap.allocations << ", \"allocatedBytes\": " << heap.bytes
+				<< ", \"peakBytes\": " << heap.peak << ", \"largestAllocation\": " << heap.largest << "}";
+		}
+		ss << "}";
+		return ss.str();
+	}
+}
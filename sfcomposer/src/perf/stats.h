@@ -0,0 +1,44 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "phases.h"
+#include <string>
+#include <cstdint>
+
+/*
+	counters of a run (samples read, files opened, ...) next to the phase times.
+	enabled together with the phases (--stats), a disabled count costs one branch.
+*/
+
+namespace perf {
+	enum Counter {
+		SamplesRead,
+		SampleBytesRead,
+		FileOpens,
+		WriteCalls,
+		BytesWritten,
+		OutputBytes,
+		NumCounters
+	};
+
+	const char* counterName(Counter counter);
+	void addCount(Counter counter, uint64_t n);
+
+	inline void count(Counter counter, uint64_t n = 1)
+	{
+		if (phasesEnabled()) {
+			addCount(counter, n);
+		}
+	}
+
+	/*
+		one json object with the phases and counters recorded since the last call,
+		both are reset:
+		{"phases": {"read": {"wallMs": 1.2, "cpuMs": 1.1, "count": 1}, ...}, "counters": {"samplesRead": 42, ...}}
+		with the heap accounting the phases contain allocations, allocatedBytes, peakBytes and largestAllocation,
+		and "memory" has the same for the whole run
+	*/
+	std::string takeStats();
+}
+
+#endif
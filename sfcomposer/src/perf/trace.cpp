@@ -0,0 +1,115 @@
+#include "trace.h"
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <stdexcept>
+
+namespace {
+	struct Span {
+		const char* name;
+		std::chrono::steady_clock::time_point start;
+		std::chrono::steady_clock::time_point end;
+		perf::SpanArgs args;
+	};
+
+	/*
+		written by its thread only, the mutex is contended only while the trace is taken
+	*/
+	struct ThreadBuffer {
+		int tid = 0;
+		std::mutex mutex;
+		std::vector<Span> spans;
+	};
+
+	std::atomic<bool> enabled(false);
+	std::mutex mutex;
+	std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+	std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+	ThreadBuffer& threadBuffer()
+	{
+		thread_local std::shared_ptr<ThreadBuffer> buffer;
+		if (!buffer) {
+			buffer = std::make_shared<ThreadBuffer>();
+			buffer->spans.reserve(1024);
+			std::lock_guard<std::mutex> lock(mutex);
+			buffer->tid = (int)buffers.size() + 1;
+			buffers.push_back(buffer);
+		}
+		return *buffer;
+	}
+
+	double micros(std::chrono::steady_clock::time_point time)
+	{
+		return std::chrono::duration<double, std::micro>(time - epoch).count();
+	}
+}
+
+namespace perf {
+
+	void enableTrace(bool enable)
+	{
+		enabled = enable;
+	}
+
+	bool traceEnabled()
+	{
+		return enabled.load(std::memory_order_relaxed);
+	}
+
+	void addSpan(const char* name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end, const SpanArgs& args)
+	{
+		auto& buffer = threadBuffer();
+		std::lock_guard<std::mutex> lock(buffer.mutex);
+		buffer.spans.push_back({ name, start, end, args });
+	}
+
+	std::string takeTrace()
+	{
+		std::stringstream ss;
+		ss.precision(3);
+		ss << std::fixed << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+		bool first = true;
+		std::lock_guard<std::mutex> lock(mutex);
+		for (auto& buffer : buffers) {
+			std::vector<Span> spans;
+			{
+				std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+				spans.swap(buffer->spans);
+			}
+			for (const auto& span : spans) {
+				ss << (first ? "\n" : ",\n") << "{\"name\": \"" << span.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer->tid
+					<< ", \"ts\": " << micros(span.start) << ", \"dur\": " << micros(span.end) - micros(span.start) << ", \"args\": {";
+				const char* separator = "";
+				if (span.args.id >= 0) {
+					ss << "\"id\": " << span.args.id;
+					separator = ", ";
+				}
+				if (span.args.bytes >= 0) {
+					ss << separator << "\"bytes\": " << span.args.bytes;
+					separator = ", ";
+				}
+				if (span.args.source) {
+					ss << separator << "\"source\": \"" << span.args.source << "\"";
+				}
+				ss << "}}";
+				first = false;
+			}
+		}
+		ss << "\n]}";
+		return ss.str();
+	}
+
+	void writeTrace(const std::string& path)
+	{
+		auto trace = takeTrace();
+		std::fstream file(path.c_str(), std::ios_base::out | std::ios::binary);
+		file.write(trace.data(), trace.size());
+		if (!file) {
+			throw std::runtime_error("could not write " + path);
+		}
+	}
+}
@@ -0,0 +1,60 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+#include <chrono>
+#include <cstdint>
+
+/*
+	spans in the chrome trace event format (chrome://tracing, ui.perfetto.dev).
+	every thread appends to its own buffer, the buffers are collected by takeTrace.
+	names and sources must be string literals, they are stored as pointers.
+	disabled by default, a disabled ScopedSpan costs one branch.
+*/
+
+namespace perf {
+	struct SpanArgs {
+		int64_t id = -1;
+		int64_t bytes = -1;
+		const char* source = nullptr;
+	};
+
+	void enableTrace(bool enable);
+	bool traceEnabled();
+	void addSpan(const char* name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end, const SpanArgs& args);
+	/*
+		returns the spans recorded since the last call as json and removes them
+	*/
+	std::string takeTrace();
+	void writeTrace(const std::string& path);
+
+	class ScopedSpan {
+	public:
+		explicit ScopedSpan(const char* name, int64_t id = -1, int64_t bytes = -1, const char* source = nullptr) : _name(name)
+		{
+			if (traceEnabled()) {
+				_args.id = id;
+				_args.bytes = bytes;
+				_args.source = source;
+				_start = std::chrono::steady_clock::now();
+				_running = true;
+			}
+		}
+		~ScopedSpan()
+		{
+			if (_running) {
+				addSpan(_name, _start, std::chrono::steady_clock::now(), _args);
+			}
+		}
+		void setSource(const char* source) { _args.source = source; }
+		ScopedSpan(const ScopedSpan&) = delete;
+		ScopedSpan& operator=(const ScopedSpan&) = delete;
+	private:
+		const char* _name;
+		SpanArgs _args;
+		std::chrono::steady_clock::time_point _start;
+		bool _running = false;
+	};
+}
+
+#endif
@@ -0,0 +1,449 @@
+#include "server.h"
+#include "threads/threadpool.h"
+#include <stdexcept>
+#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <cstring>
+#include <iostream>
+
+#if !defined(WIN32) && !defined(__EMSCRIPTEN__)
+#define SERVER_SUPPORTED 1
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/time.h>
+#endif
+
+namespace {
+	const size_t MaxHeaderSize = 8192;
+	const size_t ChunkSize = 1 << 16;
+	// an idle or stalled client must not keep a worker busy
+	const int SocketTimeoutSeconds = 10;
+	std::atomic<bool> stopRequested(false);
+
+	bool isPort(const std::string& address)
+	{
+		return !address.empty() && address.size() <= 5
+			&& std::all_of(address.begin(), address.end(), [](char c) { return c >= '0' && c <= '9'; });
+	}
+
+	const char* statusText(int status)
+	{
+		switch (status) {
+		case 200: return "OK";
+		case 400: return "Bad Request";
+		case 404: return "Not Found";
+		case 405: return "Method Not Allowed";
+		default: return "Internal Server Error";
+		}
+	}
+
+#ifdef SERVER_SUPPORTED
+	void onSignal(int)
+	{
+		stopRequested = true;
+	}
+
+	int openSocket(const std::string& address, bool listening)
+	{
+		int fd = -1;
+		if (isPort(address)) {
+			fd = socket(AF_INET, SOCK_STREAM, 0);
+			if (fd < 0) {
+				throw std::runtime_error("could not create socket");
+			}
+			sockaddr_in addr;
+			memset(&addr, 0, sizeof(addr));
+			addr.sin_family = AF_INET;
+			addr.sin_port = htons((uint16_t)std::stoi(address));
+			addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			int on = 1;
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+			int result = listening ? bind(fd, (sockaddr*)&addr, sizeof(addr)) : connect(fd, (sockaddr*)&addr, sizeof(addr));
+			if (result != 0) {
+				close(fd);
+				throw std::runtime_error("could not " + std::string(listening ? "bind" : "connect") + " to port " + address);
+			}
+		}
+		else {
+			sockaddr_un addr;
+			memset(&addr, 0, sizeof(addr));
+			addr.sun_family = AF_UNIX;
+			if (address.size() >= sizeof(addr.sun_path)) {
+				throw std::runtime_error("socket path too long: " + address);
+			}
+			strcpy(addr.sun_path, address.c_str());
+			fd = socket(AF_UNIX, SOCK_STREAM, 0);
+			if (fd < 0) {
+				throw std::runtime_error("could not create socket");
+			}
+			if (listening) {
+				unlink(address.c_str());
+			}
+			int result = listening ? bind(fd, (sockaddr*)&addr, sizeof(addr)) : connect(fd, (sockaddr*)&addr, sizeof(addr));
+			if (result != 0) {
+				close(fd);
+				throw std::runtime_error("could not " + std::string(listening ? "bind" : "connect") + " to " + address);
+			}
+		}
+		if (listening && listen(fd, 128) != 0) {
+			close(fd);
+			throw std::runtime_error("could not listen on " + address);
+		}
+		return fd;
+	}
+#endif
+
+	int hexValue(char c)
+	{
+		if (c >= '0' && c <= '9') return c - '0';
+		if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+		if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+		return -1;
+	}
+
+	server::Request parseTarget(const std::string& target)
+	{
+		server::Request request;
+		auto queryPos = target.find('?');
+		request.path = target.substr(0, queryPos);
+		if (queryPos == std::string::npos) {
+			return request;
+		}
+		std::stringstream ss(target.substr(queryPos + 1));
+		std::string param;
+		while (std::getline(ss, param, '&')) {
+			auto eq = param.find('=');
+			auto key = server::urlDecode(param.substr(0, eq));
+			auto value = eq == std::string::npos ? "" : server::urlDecode(param.substr(eq + 1));
+			request.params[key] = value;
+		}
+		return request;
+	}
+}
+
+namespace server {
+
+	std::string urlEncode(const std::string& value)
+	{
+		const char* digits = "0123456789ABCDEF";
+		std::string result;
+		for (unsigned char c : value) {
+			if (isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~' || c == '/' || c == ',') {
+				result.push_back(c);
+				continue;
+			}
+			result.push_back('%');
+			result.push_back(digits[c >> 4]);
+			result.push_back(digits[c & 0xF]);
+		}
+		return result;
+	}
+
+	std::string urlDecode(const std::string& value)
+	{
+		std::string result;
+		for (size_t i = 0; i < value.size(); ++i) {
+			if (value[i] == '+') {
+				result.push_back(' ');
+				continue;
+			}
+			if (value[i] == '%' && i + 2 < value.size() && hexValue(value[i + 1]) >= 0 && hexValue(value[i + 2]) >= 0) {
+				result.push_back((char)(hexValue(value[i + 1]) * 16 + hexValue(value[i + 2])));
+				i += 2;
+				continue;
+			}
+			result.push_back(value[i]);
+		}
+		return result;
+	}
+
+	void LatencyRecorder::record(double milliseconds)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		++_count;
+		if (_durations.size() < Capacity) {
+			_durations.push_back(milliseconds);
+			return;
+		}
+		_durations[_next] = milliseconds;
+		_next = (_next + 1) % Capacity;
+	}
+
+	std::string LatencyRecorder::json() const
+	{
+		std::vector<double> durations;
+		uint64_t count;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			durations = _durations;
+			count = _count;
+		}
+		std::sort(durations.begin(), durations.end());
+		auto percentile = [&durations](double p) {
+			if (durations.empty()) {
+				return 0.0;
+			}
+			auto index = (size_t)(p * (durations.size() - 1) + 0.5);
+			return durations[index];
+		};
+		std::stringstream ss;
+		ss << "{\"count\": " << count
+			<< ", \"p50\": " << percentile(0.5)
+			<< ", \"p90\": " << percentile(0.9)
+			<< ", \"p99\": " << percentile(0.99)
+			<< ", \"max\": " << (durations.empty() ? 0.0 : durations.back())
+			<< "}";
+		return ss.str();
+	}
+
+#ifdef SERVER_SUPPORTED
+
+	void Response::sendAll(const char* data, size_t length)
+	{
+		while (length > 0) {
+			auto n = ::send(_socket, data, length, MSG_NOSIGNAL);
+			if (n <= 0) {
+				throw std::runtime_error("connection closed");
+			}
+			data += n;
+			length -= n;
+		}
+	}
+
+	void Response::sendHeader(int status, const std::string& contentType, uint64_t contentLength)
+	{
+		std::stringstream ss;
+		ss << "HTTP/1.0 " << status << " " << statusText(status) << "\r\n"
+			<< "Content-Type: " << contentType << "\r\n"
+			<< "Content-Length: " << contentLength << "\r\n"
+			<< _headers
+			<< "Connection: close\r\n\r\n";
+		auto header = ss.str();
+		_sent = true;
+		sendAll(header.data(), header.size());
+	}
+
+	void Response::setHeader(const std::string& name, const std::string& value)
+	{
+		_headers += name + ": " + value + "\r\n";
+	}
+
+	void Response::send(int status, const std::string& contentType, const std::string& body)
+	{
+		sendHeader(status, contentType, body.size());
+		sendAll(body.data(), body.size());
+	}
+
+	void Response::sendFile(const std::string& contentType, const std::string& path)
+	{
+		std::fstream file(path.c_str(), std::ios_base::in | std::ios_base::binary);
+		if (!file.is_open()) {
+			throw std::runtime_error("could not open: " + path);
+		}
+		file.seekg(0, std::ios_base::end);
+		uint64_t size = file.tellg();
+		file.seekg(0, std::ios_base::beg);
+		sendHeader(200, contentType, size);
+		std::vector<char> bff(ChunkSize);
+		while (size > 0) {
+			file.read(bff.data(), std::min<uint64_t>(size, bff.size()));
+			auto n = (size_t)file.gcount();
+			if (n == 0) {
+				throw std::runtime_error("unexpected end of file: " + path);
+			}
+			sendAll(bff.data(), n);
+			size -= n;
+		}
+	}
+
+	Server::Server(const std::string& address, int numThreads, Handler handler)
+		: _address(address), _numThreads(numThreads), _handler(handler)
+	{
+		_socket = openSocket(address, true);
+	}
+
+	Server::~Server()
+	{
+		close(_socket);
+		if (!isPort(_address)) {
+			unlink(_address.c_str());
+		}
+	}
+
+	void Server::run()
+	{
+		stopRequested = false;
+		signal(SIGINT, &onSignal);
+		signal(SIGTERM, &onSignal);
+		signal(SIGPIPE, SIG_IGN);
+		threads::ThreadPool pool(_numThreads);
+		while (!stopRequested) {
+			pollfd pfd = { _socket, POLLIN, 0 };
+			if (poll(&pfd, 1, 200) <= 0) {
+				continue;
+			}
+			int client = accept(_socket, nullptr, nullptr);
+			if (client < 0) {
+				continue;
+			}
+			pool.run([this, client]() { handle(client); });
+		}
+		pool.wait();
+	}
+
+	void Server::handle(int socket)
+	{
+		auto startTime = std::chrono::steady_clock::now();
+		timeval timeout = { SocketTimeoutSeconds, 0 };
+		setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+		Response response(socket);
+		try {
+			std::string header;
+			char bff[1024];
+			while (header.find("\r\n\r\n") == std::string::npos && header.find("\n\n") == std::string::npos) {
+				auto n = recv(socket, bff, sizeof(bff), 0);
+				if (n <= 0) {
+					throw std::runtime_error("connection closed");
+				}
+				header.append(bff, n);
+				if (header.size() > MaxHeaderSize) {
+					throw std::runtime_error("request header too large");
+				}
+			}
+			std::stringstream ss(header);
+			std::string method, target;
+			ss >> method >> target;
+			if (method != "GET") {
+				response.send(405, "text/plain", "only GET is supported\n");
+			}
+			else {
+				auto request = parseTarget(target);
+				if (request.path == "/stats") {
+					auto stats = "{\"latencyMs\": " + _latencies.json();
+					if (_statsExtension) {
+						stats += ", " + _statsExtension();
+					}
+					response.send(200, "application/json", stats + "}\n");
+				}
+				else {
+					_handler(request, response);
+				}
+			}
+		}
+		catch (const std::exception& ex) {
+			if (!response.sent()) {
+				try {
+					response.send(500, "text/plain", std::string(ex.what()) + "\n");
+				}
+				catch (...) {
+				}
+			}
+		}
+		close(socket);
+		std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - startTime;
+		_latencies.record(duration.count());
+	}
+
+	ClientResponse get(const std::string& address, const std::string& target)
+	{
+		int fd = openSocket(address, false);
+		ClientResponse result;
+		try {
+			std::string header = "GET " + target + " HTTP/1.0\r\nHost: localhost\r\n\r\n";
+			size_t pos = 0;
+			while (pos < header.size()) {
+				auto n = ::send(fd, header.data() + pos, header.size() - pos, MSG_NOSIGNAL);
+				if (n <= 0) {
+					throw std::runtime_error("connection closed");
+				}
+				pos += n;
+			}
+			std::string data;
+			std::vector<char> bff(ChunkSize);
+			while (true) {
+				auto n = recv(fd, bff.data(), bff.size(), 0);
+				if (n < 0) {
+					throw std::runtime_error("receive failed");
+				}
+				if (n == 0) {
+					break;
+				}
+				data.append(bff.data(), n);
+			}
+			auto headerEnd = data.find("\r\n\r\n");
+			if (headerEnd == std::string::npos) {
+				throw std::runtime_error("invalid response");
+			}
+			std::stringstream ss(data.substr(0, headerEnd));
+			std::string version;
+			ss >> version >> result.status;
+			result.body = data.substr(headerEnd + 4);
+		}
+		catch (...) {
+			close(fd);
+			throw;
+		}
+		close(fd);
+		return result;
+	}
+
+#else
+
+	void Response::sendAll(const char*, size_t)
+	{
+		throw std::runtime_error("server not supported on this platform");
+	}
+
+	void Response::sendHeader(int, const std::string&, uint64_t)
+	{
+		throw std::runtime_error("server not supported on this platform");
+	}
+
+	void Response::setHeader(const std::string&, const std::string&)
+	{
+	}
+
+	void Response::send(int, const std::string&, const std::string&)
+	{
+		throw std::runtime_error("server not supported on this platform");
+	}
+
+	void Response::sendFile(const std::string&, const std::string&)
+	{
+		throw std::runtime_error("server not supported on this platform");
+	}
+
+	Server::Server(const std::string& address, int numThreads, Handler handler)
+		: _address(address), _numThreads(numThreads), _handler(handler)
+	{
+		throw std::runtime_error("server not supported on this platform");
+	}
+
+	Server::~Server()
+	{
+	}
+
+	void Server::run()
+	{
+	}
+
+	void Server::handle(int)
+	{
+	}
+
+	ClientResponse get(const std::string&, const std::string&)
+	{
+		throw std::runtime_error("server not supported on this platform");
+	}
+
+#endif
+}
@@ -0,0 +1,104 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <string>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <functional>
+#include <cstdint>
+
+/*
+	a minimal local HTTP/1.0 server (GET only) listening on a unix socket
+	or on a localhost tcp port. The requests are dispatched to a fixed
+	number of worker threads.
+	address: a port number for 127.0.0.1:{port}, otherwise the path of a unix socket
+*/
+
+namespace server {
+	typedef std::map<std::string, std::string> Params;
+
+	struct Request {
+		std::string path;
+		Params params;
+	};
+
+	class Response {
+	public:
+		explicit Response(int socket) : _socket(socket) {}
+		void send(int status, const std::string& contentType, const std::string& body);
+		/*
+			streams the file content in chunks
+		*/
+		void sendFile(const std::string& contentType, const std::string& path);
+		/*
+			an additional header line of the next send
+		*/
+		void setHeader(const std::string& name, const std::string& value);
+		bool sent() const { return _sent; }
+	private:
+		void sendHeader(int status, const std::string& contentType, uint64_t contentLength);
+		void sendAll(const char* data, size_t length);
+		int _socket;
+		bool _sent = false;
+		std::string _headers;
+	};
+
+	typedef std::function<void(const Request&, Response&)> Handler;
+
+	/*
+		keeps the durations of the last requests
+	*/
+	class LatencyRecorder {
+	public:
+		enum { Capacity = 100000 };
+		void record(double milliseconds);
+		/*
+			{"count": n, "p50": ms, "p90": ms, "p99": ms, "max": ms}
+		*/
+		std::string json() const;
+	private:
+		mutable std::mutex _mutex;
+		std::vector<double> _durations;
+		size_t _next = 0;
+		uint64_t _count = 0;
+	};
+
+	class Server {
+	public:
+		Server(const std::string& address, int numThreads, Handler handler);
+		~Server();
+		/*
+			serves until SIGINT or SIGTERM.
+			GET /stats is answered by the server itself with the latency percentiles
+		*/
+		void run();
+		const LatencyRecorder& latencies() const { return _latencies; }
+		/*
+			returns additional "key": value pairs for GET /stats
+		*/
+		void setStatsExtension(std::function<std::string()> extension) { _statsExtension = extension; }
+	private:
+		void handle(int socket);
+		std::string _address;
+		int _numThreads;
+		Handler _handler;
+		int _socket = -1;
+		LatencyRecorder _latencies;
+		std::function<std::string()> _statsExtension;
+	};
+
+	struct ClientResponse {
+		int status = 0;
+		std::string body;
+	};
+
+	/*
+		performs GET {target} on a server
+	*/
+	ClientResponse get(const std::string& address, const std::string& target);
+	std::string urlEncode(const std::string& value);
+	std::string urlDecode(const std::string& value);
+}
+
+#endif
@@ -1,6 +1,13 @@
 #include "myfile.h"
+#include "perf/stats.h"
 #include <stdexcept>
 #include <iostream>
+#ifdef WIN32
+#include <mutex>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 MyFile::MyFile(const std::string & path) : path(path)
 {
@@ -16,8 +23,10 @@ bool MyFile::open(Mode mode)
     {
     case ReadOnly: strmode = "rb"; break;
     case WriteOnly: strmode = "wb"; break;
+    case ReadWrite: strmode = "r+b"; break;
     }
     pFile = fopen(path.c_str(), strmode.c_str());
+    perf::count(perf::FileOpens);
     return pFile != nullptr;
 }
 
@@ -51,10 +60,73 @@ int MyFile::write(const char *bff, int numBytes)
     if (pFile == nullptr) {
         throw std::runtime_error("file '" + path + "' is not open");
     }
+    perf::count(perf::WriteCalls);
+    perf::count(perf::BytesWritten, numBytes);
     return fwrite(bff, 1, numBytes, pFile);
 
 }
 
+int MyFile::writeAt(const char *bff, int numBytes, qint64 offset)
+{
+    if (pFile == nullptr) {
+        throw std::runtime_error("file '" + path + "' is not open");
+    }
+    perf::count(perf::WriteCalls);
+    perf::count(perf::BytesWritten, numBytes);
+#ifdef WIN32
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto pos = _ftelli64(pFile);
+    _fseeki64(pFile, offset, SEEK_SET);
+    auto result = fwrite(bff, 1, numBytes, pFile);
+    _fseeki64(pFile, pos, SEEK_SET);
+    return (int)result;
+#else
+    int fd = fileno(pFile);
+    int written = 0;
+    while (written < numBytes) {
+        auto result = pwrite(fd, bff + written, numBytes - written, offset + written);
+        if (result <= 0) {
+            break;
+        }
+        written += result;
+    }
+    return written;
+#endif
+}
+
+bool MyFile::allocate(qint64 size)
+{
+    if (pFile == nullptr) {
+        throw std::runtime_error("file '" + path + "' is not open");
+    }
+#if defined(WIN32) || defined(__EMSCRIPTEN__) || defined(__APPLE__)
+    return false;
+#else
+    return posix_fallocate(fileno(pFile), 0, size) == 0;
+#endif
+}
+
+bool MyFile::flush()
+{
+    if (pFile == nullptr) {
+        throw std::runtime_error("file '" + path + "' is not open");
+    }
+    return fflush(pFile) == 0;
+}
+
+int MyFile::handle() const
+{
+    if (pFile == nullptr) {
+        return -1;
+    }
+#ifdef WIN32
+    return _fileno(pFile);
+#else
+    return fileno(pFile);
+#endif
+}
+
 std::string MyFile::fileName() const
 {
     return path;
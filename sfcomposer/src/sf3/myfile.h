@@ -10,13 +10,20 @@ private:
     FILE* pFile = nullptr;
     std::string path;
 public:
-    enum Mode {ReadOnly, WriteOnly};
+    enum Mode {ReadOnly, WriteOnly, ReadWrite};
     MyFile(const std::string &);
     bool open(Mode);
     qint64 pos() const;
     bool seek(qint64);
     int read(char*, int);
     int write(const char *, int);
+    // positional write, doesn't change the position of the file
+    int writeAt(const char *, int, qint64 offset);
+    // reserves disk space for the file, returns false if not supported
+    bool allocate(qint64 size);
+    bool flush();
+    // the underlying file descriptor, -1 if not open
+    int handle() const;
     std::string fileName() const;
     void close();
 };
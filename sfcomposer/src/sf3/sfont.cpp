@@ -27,6 +27,11 @@
 
 #include "sfont.h"
 #include "time.h"
+#include "threads/threadpool.h"
+#include "perf/phases.h"
+#include "perf/trace.h"
+#include "hash/hash.h"
+#include <algorithm>
 
 
 using namespace SfTools;
@@ -71,11 +76,12 @@ Sample::Sample()
 	pitchadj = 0;
 	sampleLink = 0;
 	sampletype = 0;
+	id = -1;
 }
 
 Sample::~Sample()
 {
-	free(name);
+	perf::freeString(name);
 }
 
 //---------------------------------------------------------
@@ -85,11 +91,12 @@ Sample::~Sample()
 Instrument::Instrument()
 {
 	name = nullptr;
+	index = 0;
 }
 
 Instrument::~Instrument()
 {
-	free(name);
+	perf::freeString(name);
 	for (auto x : this->zones) {
 		delete x;
 	}
@@ -116,21 +123,26 @@ SoundFont::SoundFont(const QString& s)
 	iver.major = 0;
 	iver.minor = 0;
 	_smallSf = false;
+	writeThreads = 1;
+	decimation = 1;
+	hashContent = false;
+	hashContentSha256 = false;
+	sampleEnd = -1;
 	using namespace std::placeholders;
 	readSampleFunction = std::bind(&SoundFont::readSample, this, _1, _2, _3);
 }
 
 SoundFont::~SoundFont()
 {
-	free(engine);
-	free(name);
-	free(date);
-	free(comment);
-	free(tools);
-	free(creator);
-	free(product);
-	free(copyright);
-	free(irom);
+	perf::freeString(engine);
+	perf::freeString(name);
+	perf::freeString(date);
+	perf::freeString(comment);
+	perf::freeString(tools);
+	perf::freeString(creator);
+	perf::freeString(product);
+	perf::freeString(copyright);
+	perf::freeString(irom);
 
 	for (auto x : presets) {
 		delete x;
@@ -375,7 +387,7 @@ char* SoundFont::readString(int n)
 		throw std::runtime_error("unexpected end of file");
 	if (data[n - 1] != 0)
 		data[n] = 0;
-	return strdup(data);
+	return perf::dupString(data);
 }
 
 //---------------------------------------------------------
@@ -655,16 +667,17 @@ bool SoundFont::write()
 {
 	qint64 riffLenPos;
 	qint64 listLenPos;
+	beginContentHash();
 	try {
-		file->write("RIFF", 4);
+		write("RIFF", 4);
 		riffLenPos = file->pos();
 		writeDword(0);
-		file->write("sfbk", 4);
+		write("sfbk", 4);
 
-		file->write("LIST", 4);
+		write("LIST", 4);
 		listLenPos = file->pos();
 		writeDword(0);
-		file->write("INFO", 4);
+		write("INFO", 4);
 
 		writeIfil();
 		if (name)
@@ -692,35 +705,19 @@ bool SoundFont::write()
 		writeDword(pos - listLenPos - 4);
 		file->seek(pos);
 
-		file->write("LIST", 4);
+		write("LIST", 4);
 		listLenPos = file->pos();
 		writeDword(0);
-		file->write("sdta", 4);
+		write("sdta", 4);
 		writeSmpl();
 		pos = file->pos();
 		file->seek(listLenPos);
 		writeDword(pos - listLenPos - 4);
 		file->seek(pos);
 
-		file->write("LIST", 4);
-		listLenPos = file->pos();
-		writeDword(0);
-		file->write("pdta", 4);
-
-		writePhdr();
-		writeBag("pbag", &pZones);
-		writeMod("pmod", &pZones);
-		writeGen("pgen", &pZones);
-		writeInst();
-		writeBag("ibag", &iZones);
-		writeMod("imod", &iZones);
-		writeGen("igen", &iZones);
-		writeShdr();
-
-		pos = file->pos();
-		file->seek(listLenPos);
-		writeDword(pos - listLenPos - 4);
-		file->seek(pos);
+		if (decimation > 1)
+			scaleAddressOffsets();
+		writePdta();
 
 		qint64 endPos = file->pos();
 		file->seek(riffLenPos);
@@ -733,6 +730,225 @@ bool SoundFont::write()
 }
 
 
+//---------------------------------------------------------
+//   extend
+//    appends the samples after the first keptSamples ones
+//    to the smpl chunk of an already written file and
+//    rewrites the pdta list. The kept samples have to be
+//    the exact payload of the existing smpl chunk.
+//---------------------------------------------------------
+
+bool SoundFont::extend(int keptSamples)
+{
+	try {
+		file->seek(0);
+		int riffLen = readFourcc("RIFF");
+		readSignature("sfbk");
+		qint64 riffEnd = 8 + (qint64)riffLen;
+		qint64 sdtaLenPos = -1;
+		qint64 smplLenPos = -1;
+		qint64 smplEnd = -1;
+		while (file->pos() < riffEnd) {
+			qint64 listLenPos = file->pos() + 4;
+			int listLen = readFourcc("LIST");
+			char fourcc[4];
+			readSignature(fourcc);
+			if (memcmp(fourcc, "sdta", 4) == 0) {
+				sdtaLenPos = listLenPos;
+				smplLenPos = file->pos() + 4;
+				int smplLen = readFourcc("smpl");
+				if (smplLen + 12 != listLen)
+					throw std::runtime_error("sdta list contains more than the smpl chunk");
+				smplEnd = file->pos() + smplLen;
+				break;
+			}
+			skip(listLen - 4);
+		}
+		if (sdtaLenPos < 0)
+			throw std::runtime_error("missing sdta list");
+
+		qint64 keptBytes = 0;
+		for (int i = 0; i < keptSamples; ++i) {
+			const Sample* s = samples[i];
+			keptBytes += s->end > s->start ? (s->end - s->start) * sizeof(short) : 0;
+		}
+		if (keptBytes != smplEnd - smplLenPos - 4)
+			throw std::runtime_error("smpl chunk does not match the kept samples");
+
+		file->seek(smplEnd);
+		int currentSamplePos = 0;
+		for (int i = 0; i < (int)samples.size(); ++i) {
+			Sample* s = samples[i];
+			int len = 0;
+			if (i >= keptSamples)
+				len = copySample(s);
+			else if (s->end > s->start)
+				len = s->end - s->start;
+			s->start = currentSamplePos;
+			currentSamplePos += len;
+			s->end = currentSamplePos;
+			s->loopstart = s->start + s->loopstart;
+			s->loopend = s->start + s->loopend;
+		}
+
+		qint64 pos = file->pos();
+		file->seek(smplLenPos);
+		writeDword(pos - smplLenPos - 4);
+		file->seek(sdtaLenPos);
+		writeDword(pos - sdtaLenPos - 4);
+		file->seek(pos);
+
+		writePdta();
+
+		qint64 endPos = file->pos();
+		if (endPos < riffEnd)
+			throw std::runtime_error("extended file is smaller than the original");
+		file->seek(4);
+		writeDword(endPos - 8);
+		file->seek(endPos);
+	}
+	catch (QString s) {
+		throw std::runtime_error("extend sf file failed: " + s);
+	}
+	return true;
+}
+
+//---------------------------------------------------------
+//   upgrade
+//    writes the samples to a new file, taking the INFO list
+//    and the pdta tables of an already written (preview)
+//    soundfont with the same samples. Only the sample
+//    headers are written again.
+//---------------------------------------------------------
+
+static unsigned readLe32(const char* p)
+{
+	const unsigned char* u = (const unsigned char*)p;
+	return u[0] | (u[1] << 8) | (u[2] << 16) | ((unsigned)u[3] << 24);
+}
+
+bool SoundFont::upgrade(QFile* preview, const std::vector<ScaledGenerator>& scaledGenerators)
+{
+	std::vector<char> info;
+	std::vector<char> pdta;
+	char header[12];
+	preview->seek(0);
+	if (preview->read(header, 12) != 12 || memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "sfbk", 4) != 0)
+		throw std::runtime_error("not a soundfont: " + preview->fileName());
+	qint64 riffEnd = 8 + (qint64)readLe32(header + 4);
+	while (preview->pos() + 12 <= riffEnd) {
+		char list[12];
+		if (preview->read(list, 12) != 12 || memcmp(list, "LIST", 4) != 0)
+			throw std::runtime_error("invalid list in " + preview->fileName());
+		qint64 len = readLe32(list + 4) - 4;
+		std::vector<char>* target = nullptr;
+		if (memcmp(list + 8, "INFO", 4) == 0)
+			target = &info;
+		else if (memcmp(list + 8, "pdta", 4) == 0)
+			target = &pdta;
+		if (target == nullptr) {
+			preview->seek(preview->pos() + len);
+			continue;
+		}
+		target->resize(len);
+		if (preview->read(target->data(), len) != len)
+			throw std::runtime_error("unexpected end of " + preview->fileName());
+	}
+	if (info.empty() || pdta.empty())
+		throw std::runtime_error("missing INFO or pdta list in " + preview->fileName());
+
+	beginContentHash();
+	write("RIFF", 4);
+	qint64 riffLenPos = file->pos();
+	writeDword(0);
+	write("sfbk", 4);
+
+	write("LIST", 4);
+	writeDword(info.size() + 4);
+	write("INFO", 4);
+	write(info.data(), info.size());
+
+	write("LIST", 4);
+	qint64 listLenPos = file->pos();
+	writeDword(0);
+	write("sdta", 4);
+	writeSmpl();
+	qint64 pos = file->pos();
+	file->seek(listLenPos);
+	writeDword(pos - listLenPos - 4);
+	file->seek(pos);
+
+	write("LIST", 4);
+	listLenPos = file->pos();
+	writeDword(0);
+	write("pdta", 4);
+	size_t offset = 0;
+	while (offset + 8 <= pdta.size()) {
+		const char* chunk = pdta.data() + offset;
+		unsigned len = readLe32(chunk + 4);
+		if (offset + 8 + len > pdta.size())
+			throw std::runtime_error("invalid pdta chunk in " + preview->fileName());
+		if (memcmp(chunk, "shdr", 4) == 0) {
+			if (len / 46 != (unsigned)samples.size() + 1)
+				throw std::runtime_error("the samples do not match " + preview->fileName());
+			writeShdr();
+		}
+		else if (memcmp(chunk, "igen", 4) == 0 && !scaledGenerators.empty()) {
+			// the address offsets of the preview were divided along with the sample rates
+			std::vector<char> igen(chunk, chunk + 8 + len);
+			for (const auto& scaled : scaledGenerators) {
+				if (scaled.index < 0 || (unsigned)scaled.index >= len / 4)
+					throw std::runtime_error("the scaled generators do not match " + preview->fileName());
+				unsigned char* record = (unsigned char*)igen.data() + 8 + (size_t)scaled.index * 4;
+				int gen = record[0] | (record[1] << 8);
+				if (gen > Gen_StartAddrCoarseOfs && gen != Gen_EndAddrCoarseOfs
+					&& gen != Gen_StartLoopAddrCoarseOfs && gen != Gen_EndLoopAddrCoarseOfs)
+					throw std::runtime_error("the scaled generators do not match " + preview->fileName());
+				record[2] = (unsigned char)(scaled.amount & 0xff);
+				record[3] = (unsigned char)((scaled.amount >> 8) & 0xff);
+			}
+			write(igen.data(), igen.size());
+		}
+		else
+			write(chunk, 8 + len);
+		offset += 8 + len;
+	}
+	pos = file->pos();
+	file->seek(listLenPos);
+	writeDword(pos - listLenPos - 4);
+	file->seek(riffLenPos);
+	writeDword(pos - riffLenPos - 4);
+	file->seek(pos);
+	return true;
+}
+
+//---------------------------------------------------------
+//   writePdta
+//---------------------------------------------------------
+
+void SoundFont::writePdta()
+{
+	write("LIST", 4);
+	qint64 listLenPos = file->pos();
+	writeDword(0);
+	write("pdta", 4);
+
+	writePhdr();
+	writeBag("pbag", &pZones);
+	writeMod("pmod", &pZones);
+	writeGen("pgen", &pZones);
+	writeInst();
+	writeBag("ibag", &iZones);
+	writeMod("imod", &iZones);
+	writeGen("igen", &iZones);
+	writeShdr();
+
+	qint64 pos = file->pos();
+	file->seek(listLenPos);
+	writeDword(pos - listLenPos - 4);
+	file->seek(pos);
+}
+
 //---------------------------------------------------------
 //   write
 //---------------------------------------------------------
@@ -741,6 +957,100 @@ void SoundFont::write(const char* p, int n)
 {
 	if (file->write(p, n) != n)
 		throw std::runtime_error("write error");
+	if (hashContent)
+		keepHashed(file->pos() - n, p, n);
+}
+
+//---------------------------------------------------------
+//   beginContentHash
+//---------------------------------------------------------
+
+void SoundFont::beginContentHash()
+{
+	hashedHead.clear();
+	hashedTail.clear();
+	sampleHashes.clear();
+	sampleSha256s.clear();
+	sampleEnd = -1;
+}
+
+//---------------------------------------------------------
+//   keepHashed
+//    keeps a copy of the bytes outside the sample data,
+//    they are hashed when the file is complete as the
+//    chunk sizes are written last
+//---------------------------------------------------------
+
+void SoundFont::keepHashed(qint64 pos, const char* p, int n)
+{
+	std::vector<char>* target = &hashedHead;
+	if (sampleEnd >= 0 && pos >= samplePos) {
+		target = &hashedTail;
+		pos -= sampleEnd;
+	}
+	if ((qint64)target->size() < pos + n)
+		target->resize(pos + n);
+	memcpy(target->data() + pos, p, n);
+}
+
+//---------------------------------------------------------
+//   hashSample
+//---------------------------------------------------------
+
+void SoundFont::hashSample(const char* p, int n, uint64_t* hash, std::array<unsigned char, 32>* sha256) const
+{
+	*hash = hash::xxh64(p, n);
+	if (hashContentSha256) {
+		hash::Sha256 hasher;
+		hasher.update(p, n);
+		hasher.digest(sha256->data());
+	}
+}
+
+//---------------------------------------------------------
+//   writeSampleData
+//---------------------------------------------------------
+
+void SoundFont::writeSampleData(const short* data, int length)
+{
+	int n = length * sizeof(short);
+	if (file->write((const char*)data, n) != n)
+		throw std::runtime_error("write error");
+	if (hashContent) {
+		sampleHashes.emplace_back();
+		sampleSha256s.emplace_back();
+		hashSample((const char*)data, n, &sampleHashes.back(), &sampleSha256s.back());
+	}
+}
+
+//---------------------------------------------------------
+//   contentHash
+//---------------------------------------------------------
+
+std::string SoundFont::contentHash() const
+{
+	hash::XXHash64 hasher;
+	hasher.update(hashedHead.data(), hashedHead.size());
+	for (uint64_t sampleHash : sampleHashes) {
+		unsigned char bytes[8];
+		for (int i = 0; i < 8; ++i)
+			bytes[i] = (unsigned char)(sampleHash >> (i * 8));
+		hasher.update(bytes, 8);
+	}
+	hasher.update(hashedTail.data(), hashedTail.size());
+	return hash::toHex(hasher.digest());
+}
+
+std::string SoundFont::contentSha256() const
+{
+	hash::Sha256 hasher;
+	hasher.update(hashedHead.data(), hashedHead.size());
+	for (const auto& sampleSha256 : sampleSha256s)
+		hasher.update(sampleSha256.data(), sampleSha256.size());
+	hasher.update(hashedTail.data(), hashedTail.size());
+	unsigned char digest[32];
+	hasher.digest(digest);
+	return hash::toHex(digest, sizeof(digest));
 }
 
 //---------------------------------------------------------
@@ -800,10 +1110,16 @@ void SoundFont::writeIver()
 
 void SoundFont::writeSmpl()
 {
+	perf::ScopedPhase phase("writeSmpl");
+	if ((writeThreads > 1 || gatherSamplesFunction) && decimation <= 1) {
+		writeSmplParallel();
+		return;
+	}
 	write("smpl", 4);
 
 	qint64 pos = file->pos();
 	writeDword(0);
+	samplePos = pos + 4;
 	int currentSamplePos = 0;
 
 	for (Sample* s : samples) {
@@ -816,11 +1132,87 @@ void SoundFont::writeSmpl()
 	}
 
 	qint64 npos = file->pos();
+	sampleEnd = npos;
 	file->seek(pos);
 	writeDword(npos - pos - 4);
 	file->seek(npos);
 }
 
+//---------------------------------------------------------
+//   writeSmplParallel
+//    the offset of every sample follows from the sample
+//    lengths, so the samples can be gathered and written
+//    by several threads at once, or all at once by
+//    gatherSamplesFunction
+//---------------------------------------------------------
+
+void SoundFont::writeSmplParallel()
+{
+	write("smpl", 4);
+	std::vector<qint64> offsets(samples.size());
+	qint64 currentSamplePos = 0;
+	for (int i = 0; i < (int)samples.size(); ++i) {
+		Sample* s = samples[i];
+		// fails before anything is written, as copySample() does
+		if (s->end <= s->start)
+			throw std::runtime_error("invalid sample start and end values");
+		int len = s->end - s->start;
+		offsets[i] = currentSamplePos * sizeof(short);
+		currentSamplePos += len;
+	}
+	qint64 byteSize = currentSamplePos * sizeof(short);
+	writeDword(byteSize);
+	qint64 dataPos = file->pos();
+	samplePos = dataPos;
+	file->flush();
+	file->allocate(dataPos + byteSize);
+	std::vector<uint64_t> hashes(hashContent ? samples.size() : 0);
+	std::vector<std::array<unsigned char, 32>> sha256s(hashContent ? samples.size() : 0);
+
+	if (gatherSamplesFunction) {
+		gatherSamplesFunction(file, dataPos, offsets, hashes, sha256s);
+	}
+	else {
+		threads::parallelFor(samples.size(), writeThreads, [this, &offsets, dataPos, &hashes, &sha256s](size_t i) {
+			Sample* s = samples[i];
+			int length = s->end - s->start;
+			perf::ScopedSpan span("copySample", s->id, length * sizeof(short), "buffer");
+			SampleBuffer buffer;
+			if (sampleBufferFunction)
+				buffer = sampleBufferFunction(s, length);
+			if (!buffer) {
+				span.setSource("file");
+				auto data = std::make_shared<std::vector<short>>(length);
+				readSampleFunction(s, data->data(), length);
+				buffer = data;
+			}
+			if ((int)buffer->size() != length)
+				throw std::runtime_error("sample buffer size mismatch");
+			int n = length * sizeof(short);
+			if (file->writeAt((const char*)buffer->data(), n, dataPos + offsets[i]) != n)
+				throw std::runtime_error("write error");
+			if (hashContent)
+				hashSample((const char*)buffer->data(), n, &hashes[i], &sha256s[i]);
+		});
+	}
+	// in sample order, as the sequential writeSmpl() hashes them
+	for (int i = 0; hashContent && i < (int)samples.size(); ++i) {
+		sampleHashes.push_back(hashes[i]);
+		sampleSha256s.push_back(sha256s[i]);
+	}
+
+	for (int i = 0; i < (int)samples.size(); ++i) {
+		Sample* s = samples[i];
+		int len = s->end - s->start;
+		s->start = offsets[i] / sizeof(short);
+		s->end = s->start + len;
+		s->loopstart = s->start + s->loopstart;
+		s->loopend = s->start + s->loopend;
+	}
+	sampleEnd = dataPos + byteSize;
+	file->seek(sampleEnd);
+}
+
 //---------------------------------------------------------
 //   writePhdr
 //---------------------------------------------------------
@@ -1128,14 +1520,151 @@ void SoundFont::readSample(Sample* s, short* outBuffer, int length)
 int SoundFont::copySample(Sample* s)
 {
 	// Prepare input data
-	if (s->end <= s->start) {
-		return 0; // TODO: skip it for now
+	if (s->end <= s->start)
 		throw std::runtime_error("invalid sample start and end values");
-	}
 	int length = s->end - s->start;
+	perf::ScopedSpan span("copySample", s->id, length * sizeof(short), "file");
+	if (sampleBufferFunction) {
+		auto buffer = sampleBufferFunction(s, length);
+		if (buffer) {
+			span.setSource("buffer");
+			if ((int)buffer->size() != length)
+				throw std::runtime_error("sample buffer size mismatch");
+			if (decimation > 1)
+				return copyDecimatedSample(s, buffer->data(), length);
+			writeSampleData(buffer->data(), length);
+			return length;
+		}
+	}
 	short* ibuffer = new short[length];
 	readSampleFunction(s, ibuffer, length);
-	file->write((const char*)ibuffer, length * sizeof(short));
+	if (decimation > 1) {
+		int n = copyDecimatedSample(s, ibuffer, length);
+		delete[] ibuffer;
+		return n;
+	}
+	writeSampleData(ibuffer, length);
 	delete[] ibuffer;
 	return length;
-}
\ No newline at end of file
+}
+
+//---------------------------------------------------------
+//   decimationFactor
+//    low rate samples are reduced less, to no less than 4kHz
+//---------------------------------------------------------
+
+int SfTools::decimationFactor(int decimation, int samplerate)
+{
+	return std::min<int>(decimation, std::max<int>(samplerate / 4000, 1));
+}
+
+//---------------------------------------------------------
+//   decimate
+//    every factor'th value, each one the average of the
+//    values it replaces (box filter against aliasing)
+//---------------------------------------------------------
+
+std::vector<short> SfTools::decimate(const short* data, int length, int factor)
+{
+	int outLength = (length + factor - 1) / factor;
+	std::vector<short> out(outLength);
+	for (int i = 0; i < outLength; ++i) {
+		int begin = i * factor;
+		int end = std::min(begin + factor, length);
+		int sum = 0;
+		for (int j = begin; j < end; ++j)
+			sum += data[j];
+		out[i] = (short)(sum / (end - begin));
+	}
+	return out;
+}
+
+//---------------------------------------------------------
+//   copyDecimatedSample
+//    writes the decimated data of the sample, sample rate
+//    and loop points are scaled accordingly
+//---------------------------------------------------------
+
+int SoundFont::copyDecimatedSample(Sample* s, const short* data, int length)
+{
+	int factor = decimationFactor(decimation, s->samplerate);
+	std::vector<short> out = decimate(data, length, factor);
+	int outLength = (int)out.size();
+	writeSampleData(out.data(), outLength);
+	decimationFactors[s] = factor;
+	s->samplerate /= factor;
+	s->loopstart /= factor;
+	s->loopend /= factor;
+	return outLength;
+}
+
+//---------------------------------------------------------
+//   scaleAddressOffsets
+//    divides the address offsets of every instrument zone
+//    by the factor of its decimated sample. a global zone
+//    takes the smallest factor of the instrument. fine and
+//    coarse offsets are divided together, a remainder is
+//    lost if the zone has no fine offset to take it
+//---------------------------------------------------------
+
+void SoundFont::scaleAddressOffsets()
+{
+	static const Generator Offsets[4][2] = {
+		{ Gen_StartAddrOfs, Gen_StartAddrCoarseOfs },
+		{ Gen_EndAddrOfs, Gen_EndAddrCoarseOfs },
+		{ Gen_StartLoopAddrOfs, Gen_StartLoopAddrCoarseOfs },
+		{ Gen_EndLoopAddrOfs, Gen_EndLoopAddrCoarseOfs },
+	};
+	scaledGenerators.clear();
+	int index = 0;
+	for (const Instrument* instrument : instruments) {
+		std::vector<int> factors;
+		int smallest = 0;
+		for (const Zone* zone : instrument->zones) {
+			int factor = 0;
+			for (const GeneratorList* g : zone->generators) {
+				if (g->gen == Gen_SampleId && g->amount.uword < samples.size()) {
+					auto it = decimationFactors.find(samples[g->amount.uword]);
+					factor = it != decimationFactors.end() ? it->second : 1;
+					smallest = smallest == 0 ? factor : std::min(smallest, factor);
+				}
+			}
+			factors.push_back(factor);
+		}
+		for (int i = 0; i < (int)instrument->zones.size(); ++i) {
+			const Zone* zone = instrument->zones[i];
+			int factor = factors[i] > 0 ? factors[i] : smallest;
+			for (const auto& offset : Offsets) {
+				if (factor <= 1)
+					break;
+				GeneratorList* fine = nullptr;
+				GeneratorList* coarse = nullptr;
+				int fineIndex = 0;
+				int coarseIndex = 0;
+				for (int j = 0; j < (int)zone->generators.size(); ++j) {
+					if (zone->generators[j]->gen == offset[0]) {
+						fine = zone->generators[j];
+						fineIndex = index + j;
+					}
+					else if (zone->generators[j]->gen == offset[1]) {
+						coarse = zone->generators[j];
+						coarseIndex = index + j;
+					}
+				}
+				int total = (fine ? fine->amount.sword : 0) + (coarse ? coarse->amount.sword * 32768 : 0);
+				int scaled = total / factor;
+				short fineAmount = (short)(coarse ? scaled % 32768 : scaled);
+				short coarseAmount = (short)(scaled / 32768);
+				if (fine && fine->amount.sword != fineAmount) {
+					scaledGenerators.push_back({ fineIndex, fine->amount.sword });
+					fine->amount.sword = fineAmount;
+				}
+				if (coarse && coarse->amount.sword != coarseAmount) {
+					scaledGenerators.push_back({ coarseIndex, coarse->amount.sword });
+					coarse->amount.sword = coarseAmount;
+				}
+			}
+			index += zone->generators.size();
+		}
+	}
+}
@@ -24,7 +24,13 @@
 #include "mydef.h"
 #include "myclasses.h"
 #include <com.h>
+#include "perf/alloc.h"
+#include <array>
 #include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace SfTools {
 
@@ -108,7 +114,7 @@ namespace SfTools {
 
 		Preset() :name(nullptr), preset(0), bank(0), presetBagNdx(0), library(0), genre(0), morphology(0) {}
 		~Preset() {
-			free(name);
+			perf::freeString(name);
 			for (auto x : this->zones) {
 				delete x;
 			}
@@ -118,7 +124,7 @@ namespace SfTools {
 			*res = *this;
 			res->zones = QList<Zone*>();
 			if (name) {
-				res->name = strdup(name);
+				res->name = perf::dupString(name);
 			}
 			for (auto* zone : zones) {
 				auto* copy = zone->clone();
@@ -145,7 +151,7 @@ namespace SfTools {
 			*res = *this;
 			res->zones = QList<Zone*>();
 			if (name) {
-				res->name = strdup(name);
+				res->name = perf::dupString(name);
 			}
 			for (auto* zone : zones) {
 				auto* copy = zone->clone();
@@ -171,6 +177,7 @@ namespace SfTools {
 		int pitchadj;
 		int sampleLink;
 		int sampletype;
+		int id;           // of the sample in the skeleton, -1 if unknown (traces)
 
 		Sample();
 		~Sample();
@@ -179,13 +186,41 @@ namespace SfTools {
 			auto* res = new Sample();
 			*res = *this;
 			if (name) {
-				res->name = strdup(name);
+				res->name = perf::dupString(name);
 			}
 			return res;
 		}
 
 	};
 
+	//---------------------------------------------------------
+	//   SampleBuffer
+	//    read only sample data, shared between soundfonts
+	//---------------------------------------------------------
+
+	typedef std::shared_ptr<const std::vector<short>> SampleBuffer;
+
+	//---------------------------------------------------------
+	//   ScaledGenerator
+	//    an address offset generator of a preview, divided by
+	//    the decimation factor of its sample: the index of its
+	//    igen record and its original amount
+	//---------------------------------------------------------
+
+	struct ScaledGenerator {
+		int index;
+		short amount;
+	};
+
+	//---------------------------------------------------------
+	//   decimationFactor, decimate
+	//    the factor a sample of this rate is reduced by in a
+	//    preview of the given decimation, and its data reduced
+	//---------------------------------------------------------
+
+	int decimationFactor(int decimation, int samplerate);
+	std::vector<short> decimate(const short* data, int length, int factor);
+
 	//---------------------------------------------------------
 	//   SoundFont
 	//---------------------------------------------------------
@@ -254,6 +289,8 @@ namespace SfTools {
 		void writeIfil();
 		void writeIver();
 		void writeSmpl();
+		void writeSmplParallel();
+		void writePdta();
 		void writePhdr();
 		void writeBag(const char* fourcc, QList<Zone*>*);
 		void writeMod(const char* fourcc, const QList<Zone*>*);
@@ -261,10 +298,47 @@ namespace SfTools {
 		void writeInst();
 		void writeShdr();
 
+		std::vector<char> hashedHead;
+		std::vector<char> hashedTail;
+		std::vector<uint64_t> sampleHashes;
+		std::vector<std::array<unsigned char, 32>> sampleSha256s;
+		qint64 sampleEnd;
+		void beginContentHash();
+		void keepHashed(qint64 pos, const char* p, int n);
+		void hashSample(const char* p, int n, uint64_t* hash, std::array<unsigned char, 32>* sha256) const;
+		void writeSampleData(const short* data, int length);
+
 		int copySample(Sample* s);
+		int copyDecimatedSample(Sample* s, const short* data, int length);
+		void scaleAddressOffsets();
 		void readSample(Sample* s, short* outBuffer, int length);
 		std::function <void(Sample*, short*, int)> readSampleFunction;
+		// if set and returning a buffer, the data is written without copying
+		std::function <SampleBuffer(Sample*, int)> sampleBufferFunction;
+		// more than one: the samples are read and written concurrently at precomputed offsets
+		int writeThreads;
+		// if set, writes all sample data at once: file, position of the sample data, byte offset per sample,
+		// and with hashContent the hash (and SHA-256) of every written sample, see hashSample()
+		std::function <void(QFile*, qint64, const std::vector<qint64>&, std::vector<uint64_t>&, std::vector<std::array<unsigned char, 32>>&)> gatherSamplesFunction;
+		// more than one: every sample is written with a sample rate reduced by this factor (preview)
+		int decimation;
+		// the factor every decimated sample was reduced by
+		std::unordered_map<const Sample*, int> decimationFactors;
+		// the address offset generators divided by write() with decimation, to be restored by upgrade()
+		std::vector<ScaledGenerator> scaledGenerators;
+		// hash the file while write() or upgrade() writes it, see contentHash()
+		bool hashContent;
+		bool hashContentSha256;
+		// the hash of the last written file (hex): the bytes before the sample data,
+		// the hash of every sample in sample order and the bytes after the sample data.
+		// the samples are hashed one by one as they can be written in any order.
+		// neither is the digest of the file bytes
+		std::string contentHash() const;
+		std::string contentSha256() const;
 		bool write();
+		bool extend(int keptSamples);
+		// the address offset generators of the preview are restored to the given amounts
+		bool upgrade(QFile* preview, const std::vector<ScaledGenerator>& scaledGenerators);
 
 		SoundFont(const QString& = "");
 		~SoundFont();
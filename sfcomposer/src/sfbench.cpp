@@ -0,0 +1,350 @@
+
+const char* const Help = "measures the phases of sfcompose and sfsplit with the bundled soundfonts.\n\
+usage: sfbench [--soundfonts <soundfontsFolder>] [--warmup <n>] [--repeats <n>] [--out <results.json>]\n\
+	   [--sfsplit <pathToSfsplit>] [--baseline <baseline.json> [--tolerance <fraction>] [--tolerance-ms <ms>] [--phase-tolerance <phase>=<fraction> ...]]\n\
+	   every soundfont (FluidR3_GM, choriumreva) is composed with every preset set (piano, drums, gm),\n\
+	   and the gm soundfont is split again. After <n> warmup runs the phases of <n> runs are timed.\n\
+	   The results are printed as json, with the heap allocations and peak live bytes of a compose.\n\
+	   --baseline: compares the phase medians with the results of an earlier run, every phase slower by more than\n\
+	     <fraction> (default 0.25) and <ms> (default 0.5) is reported as a regression and the exit code is 1";
+
+#include "sfcompose.h"
+#include "perf/phases.h"
+#include "json/json.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <filesystem>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+
+#ifndef SFBENCH_SOUNDFONTS
+#define SFBENCH_SOUNDFONTS "soundfonts"
+#endif
+#ifndef SFBENCH_SFSPLIT
+#define SFBENCH_SFSPLIT "sfsplit"
+#endif
+
+// sfcomposelib has its own Options
+namespace bench {
+
+struct Options {
+	std::string soundfonts = SFBENCH_SOUNDFONTS;
+	std::string sfsplit = SFBENCH_SFSPLIT;
+	int warmup = 1;
+	int repeats = 5;
+	std::string outfile;
+	std::string baseline;
+	double tolerance = 0.25;
+	double toleranceMs = 0.5;
+	std::map<std::string, double> phaseTolerances;
+};
+
+struct PresetSet {
+	std::string name;
+	std::vector<int> presets; // bank, preset pairs
+};
+
+struct Case {
+	std::string soundfont;
+	std::string scenario = "compose";
+	PresetSet presetSet;
+	std::map<std::string, std::vector<double>> phases;
+	uint64_t outputBytes = 0;
+	uint64_t allocations = 0;
+	int64_t peakBytes = 0;
+	uint64_t largestAllocation = 0;
+};
+
+std::vector<PresetSet> presetSets()
+{
+	PresetSet gm = { "gm", {} };
+	for (int bank : { 0, 128 }) {
+		for (int preset = 0; preset < 128; ++preset) {
+			gm.presets.push_back(bank);
+			gm.presets.push_back(preset);
+		}
+	}
+	return {
+		{ "piano", { 0, 0 } },
+		{ "drums", { 128, 0 } },
+		gm
+	};
+}
+
+/*
+	one compose, returns the phase times in seconds
+*/
+perf::PhaseTimes run(const Case& benchCase, const Options& options, const std::string& outfile)
+{
+	auto folder = options.soundfonts + "/" + benchCase.soundfont;
+	auto samplePathTemplate = benchCase.soundfont + ".sf2.";
+	std::vector<std::string> args = { "sfcompose", folder + "/" + samplePathTemplate + "skeleton", folder, samplePathTemplate, outfile };
+	for (int id : benchCase.presetSet.presets) {
+		args.push_back(std::to_string(id));
+	}
+	std::vector<const char*> argv;
+	for (const auto& arg : args) {
+		argv.push_back(arg.c_str());
+	}
+	perf::takePhases();
+	if (sfc_run((int)argv.size(), argv.data()) != 0) {
+		throw std::runtime_error("compose failed: " + benchCase.soundfont + " " + benchCase.presetSet.name);
+	}
+	return perf::takePhases();
+}
+
+/*
+	one split with the sfsplit executable, returns the phase times of its --stats output
+*/
+perf::PhaseTimes runSplit(const Options& options, const std::string& sfPath)
+{
+	auto statsPath = sfPath + ".stats.json";
+	auto command = "\"" + options.sfsplit + "\" \"" + sfPath + "\" --stats > \"" + sfPath + ".log\" 2> \"" + statsPath + "\"";
+	if (std::system(command.c_str()) != 0) {
+		throw std::runtime_error("split failed: " + command);
+	}
+	auto stats = json::readFile(statsPath);
+	perf::PhaseTimes result;
+	if (auto* phases = stats.get("phases")) {
+		for (const auto& phase : phases->members) {
+			auto* wallMs = phase.second.get("wallMs");
+			result[phase.first].seconds = wallMs ? wallMs->number / 1000.0 : 0;
+			result[phase.first].count = 1;
+		}
+	}
+	return result;
+}
+
+double median(std::vector<double> values)
+{
+	std::sort(values.begin(), values.end());
+	return values[values.size() / 2];
+}
+
+void writeStats(std::vector<double> values, std::ostream& os)
+{
+	std::sort(values.begin(), values.end());
+	double sum = 0;
+	for (auto value : values) {
+		sum += value;
+	}
+	const double ms = 1000.0;
+	os << "{\"minMs\": " << values.front() * ms
+		<< ", \"medianMs\": " << values[values.size() / 2] * ms
+		<< ", \"meanMs\": " << sum / values.size() * ms
+		<< ", \"maxMs\": " << values.back() * ms << "}";
+}
+
+std::string results(const std::vector<Case>& cases, const Options& options)
+{
+	std::stringstream os;
+	os << "{\"warmup\": " << options.warmup << ", \"repeats\": " << options.repeats << ", \"cases\": [";
+	for (size_t i = 0; i < cases.size(); ++i) {
+		const auto& benchCase = cases[i];
+		os << (i > 0 ? ",\n" : "\n") << "{\"soundfont\": \"" << benchCase.soundfont
+			<< "\", \"scenario\": \"" << benchCase.scenario
+			<< "\", \"presets\": \"" << benchCase.presetSet.name
+			<< "\", \"outputBytes\": " << benchCase.outputBytes
+			<< ", \"allocations\": " << benchCase.allocations
+			<< ", \"peakBytes\": " << benchCase.peakBytes
+			<< ", \"largestAllocation\": " << benchCase.largestAllocation
+			<< ", \"phases\": {";
+		bool first = true;
+		for (const auto& phase : benchCase.phases) {
+			os << (first ? "" : ", ") << "\"" << phase.first << "\": ";
+			writeStats(phase.second, os);
+			first = false;
+		}
+		os << "}}";
+	}
+	os << "\n]}";
+	return os.str();
+}
+
+/*
+	compares the phase medians with the baseline, prints every phase which moved
+	by more than the tolerance and returns the number of regressions
+*/
+int compare(const std::vector<Case>& cases, const json::Value& baseline, const Options& options)
+{
+	int regressions = 0;
+	const json::Value* baselineCases = baseline.get("cases");
+	if (!baselineCases) {
+		throw std::runtime_error("baseline without cases");
+	}
+	for (const auto& benchCase : cases) {
+		auto name = benchCase.soundfont + " " + benchCase.scenario + " " + benchCase.presetSet.name;
+		const json::Value* baselinePhases = nullptr;
+		for (const auto& item : baselineCases->items) {
+			auto scenario = item.text("scenario");
+			if (item.text("soundfont") == benchCase.soundfont && item.text("presets") == benchCase.presetSet.name
+				&& (scenario == benchCase.scenario || (scenario.empty() && benchCase.scenario == "compose"))) {
+				baselinePhases = item.get("phases");
+			}
+		}
+		if (!baselinePhases) {
+			std::cerr << "not in baseline: " << name << std::endl;
+			continue;
+		}
+		for (const auto& phase : benchCase.phases) {
+			auto* baselinePhase = baselinePhases->get(phase.first);
+			auto* baselineMedian = baselinePhase ? baselinePhase->get("medianMs") : nullptr;
+			if (!baselineMedian) {
+				continue;
+			}
+			double before = baselineMedian->number;
+			double after = median(phase.second) * 1000.0;
+			auto toleranceIt = options.phaseTolerances.find(phase.first);
+			double tolerance = toleranceIt != options.phaseTolerances.end() ? toleranceIt->second : options.tolerance;
+			double delta = after - before;
+			if (std::abs(delta) <= options.toleranceMs || std::abs(delta) <= before * tolerance) {
+				continue;
+			}
+			bool regression = delta > 0;
+			regressions += regression ? 1 : 0;
+			std::cerr << (regression ? "regression: " : "improvement: ") << name << " " << phase.first << " median "
+				<< before << " ms -> " << after << " ms (" << (delta > 0 ? "+" : "") << (before > 0 ? delta / before * 100.0 : 0) << "%)" << std::endl;
+		}
+	}
+	return regressions;
+}
+
+Options getOptions(int argc, const char** argv)
+{
+	Options options;
+	for (int i = 1; i < argc; ++i) {
+		auto arg = std::string(argv[i]);
+		if (i + 1 == argc) {
+			throw std::runtime_error("missing value for " + arg);
+		}
+		auto value = std::string(argv[++i]);
+		if (arg == "--soundfonts") {
+			options.soundfonts = value;
+		}
+		else if (arg == "--warmup") {
+			options.warmup = std::max(atoi(value.c_str()), 0);
+		}
+		else if (arg == "--repeats") {
+			options.repeats = std::max(atoi(value.c_str()), 1);
+		}
+		else if (arg == "--out") {
+			options.outfile = value;
+		}
+		else if (arg == "--sfsplit") {
+			options.sfsplit = value;
+		}
+		else if (arg == "--baseline") {
+			options.baseline = value;
+		}
+		else if (arg == "--tolerance") {
+			options.tolerance = std::stod(value);
+		}
+		else if (arg == "--tolerance-ms") {
+			options.toleranceMs = std::stod(value);
+		}
+		else if (arg == "--phase-tolerance") {
+			auto separator = value.find('=');
+			if (separator == std::string::npos) {
+				throw std::runtime_error("expected <phase>=<fraction>: " + value);
+			}
+			options.phaseTolerances[value.substr(0, separator)] = std::stod(value.substr(separator + 1));
+		}
+		else {
+			throw std::runtime_error("unknown option " + arg);
+		}
+	}
+	return options;
+}
+
+}
+
+int main(int argc, const char** argv)
+{
+	using namespace bench;
+	try {
+		if (argc >= 2 && std::string(argv[1]) == "--help") {
+			std::cout << Help << std::endl;
+			return 0;
+		}
+		auto options = getOptions(argc, argv);
+		auto outfile = (std::filesystem::temp_directory_path() / "sfbench.sf2").string();
+		auto splitFolder = std::filesystem::temp_directory_path() / "sfbench-split";
+		std::filesystem::remove_all(splitFolder);
+		std::filesystem::create_directories(splitFolder);
+		json::Value baseline;
+		if (!options.baseline.empty()) {
+			baseline = json::readFile(options.baseline);
+		}
+		perf::enablePhases(true);
+		perf::enableAllocStats(true);
+		std::vector<Case> cases;
+		for (const char* soundfont : { "FluidR3_GM", "choriumreva" }) {
+			for (const auto& presetSet : presetSets()) {
+				Case benchCase;
+				benchCase.soundfont = soundfont;
+				benchCase.presetSet = presetSet;
+				for (int i = 0; i < options.warmup; ++i) {
+					run(benchCase, options, outfile);
+				}
+				for (int i = 0; i < options.repeats; ++i) {
+					auto phases = run(benchCase, options, outfile);
+					for (const auto& phase : phases) {
+						benchCase.phases[phase.first].push_back(phase.second.seconds);
+					}
+					const auto& process = phases["process"];
+					benchCase.allocations = process.allocations;
+					benchCase.peakBytes = std::max(benchCase.peakBytes, process.peakBytes);
+					benchCase.largestAllocation = process.largestAllocation;
+				}
+				benchCase.outputBytes = std::filesystem::file_size(outfile);
+				std::cerr << soundfont << " " << presetSet.name << " done" << std::endl;
+				cases.push_back(benchCase);
+			}
+			// the last composed soundfont (gm) is split again
+			auto sfPath = (splitFolder / (std::string(soundfont) + ".sf2")).string();
+			std::filesystem::copy_file(outfile, sfPath);
+			Case splitCase;
+			splitCase.soundfont = soundfont;
+			splitCase.scenario = "split";
+			splitCase.presetSet = presetSets().back();
+			for (int i = 0; i < options.warmup; ++i) {
+				runSplit(options, sfPath);
+			}
+			for (int i = 0; i < options.repeats; ++i) {
+				for (const auto& phase : runSplit(options, sfPath)) {
+					splitCase.phases[phase.first].push_back(phase.second.seconds);
+				}
+			}
+			splitCase.outputBytes = std::filesystem::file_size(sfPath + ".skeleton");
+			std::cerr << soundfont << " split done" << std::endl;
+			cases.push_back(splitCase);
+		}
+		std::remove(outfile.c_str());
+		std::filesystem::remove_all(splitFolder);
+		auto json = results(cases, options);
+		std::cout << json << std::endl;
+		if (!options.outfile.empty()) {
+			std::ofstream file(options.outfile.c_str());
+			file << json << std::endl;
+		}
+		if (!options.baseline.empty()) {
+			int regressions = compare(cases, baseline, options);
+			std::cerr << regressions << " regressions against " << options.baseline << std::endl;
+			if (regressions > 0) {
+				return 1;
+			}
+		}
+	}
+	catch (const std::exception& ex) {
+		std::cout << ex.what() << std::endl;
+		return -1;
+	}
+	return 0;
+}
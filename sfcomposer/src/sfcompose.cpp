@@ -2,10 +2,50 @@
 const char* Help = "composes .smpl files and .skeleton to a soundfont file.\n\
 usage: sfcompose <pathToSkeleton> <pathToSmplFolder> <samplePathTemplate> <outfile> [{bankNumber} {presetNumber} ...]\n\
 	   to get a list of all needed samples (ids): \n\
-	   sfcompose --getsampleids [{bankNumber} {presetNumber} ...]\n\
+	   sfcompose <pathToSkeleton> --getsampleids [{bankNumber} {presetNumber} ...]\n\
+	   to get a download plan (sizes, presets and priority of the needed samples) as json or binary: \n\
+	   sfcompose <pathToSkeleton> --getsampleids --plan <json|binary> [{bankNumber} {presetNumber} ...]\n\
+	   to add presets to an already composed soundfont (prints the new sample ids): \n\
+	   sfcompose <pathToSkeleton> <pathToSmplFolder> <samplePathTemplate> --extend <existingSoundfont> [{bankNumber} {presetNumber} ...]\n\
+	   options:\n\
+	   --cache <cacheDir>: reuse soundfonts composed before with the same skeleton, samples and presets\n\
+	   --cache-size <bytes>: the size budget of the cache directory (default 512MB)\n\
+	   --jobs <numThreads>: read and write the samples with several threads at precomputed offsets\n\
+	   --sample-cache <bytes>: keep up to <bytes> of sample data in memory for all composes of the process\n\
+	   --layout: write <outfile>.layout.json with the byte offset and length of every sample, missing samples are zeroed\n\
+	   --io <uring|pread>: copy the sample files in one batch (io_uring on Linux) and print the io statistics\n\
+	   --stats: print the wall and cpu time of every phase and the io counters as one json line to stderr\n\
+	   --alloc-stats: --stats with the heap allocations, peak live bytes and largest allocation of every phase\n\
+	   --trace <traceFile>: write the phases and every sample read as chrome trace events (chrome://tracing, ui.perfetto.dev)\n\
+	   --etag: hash the soundfont while it is written and print {\"etag\": \"<xxh64>\"}, a strong ETag for HTTP caches\n\
+	   --sha256: --etag with a SHA-256 content digest as \"contentSha256\", not the SHA-256 of the file (use sha256sum)\n\
+	   --bad-samples <fail|zero>: a sample file not matching its checksum in the skeleton fails the compose (default)\n\
+	                              or is zeroed like a missing one. zeroed and missing samples are listed as json\n\
+	   --optimize: drop redundant generators and modulators and merge identical instruments before composing,\n\
+	               prints the pdta bytes of the request without and with as json\n\
+	   --shards: <pathToSkeleton> is a preset directory written by sfsplit --shards, only the shards of the requested presets are read\n\
+	   to compose a preview quickly, with samples reduced in sample rate by <factor> (writes <outfile>.layout.json): \n\
+	   sfcompose <pathToSkeleton> <pathToSmplFolder> <samplePathTemplate> <outfile> --preview <factor> [{bankNumber} {presetNumber} ...]\n\
+	   to write the full quality soundfont of a preview, reusing its preset and instrument tables: \n\
+	   sfcompose <pathToSkeleton> <pathToSmplFolder> <samplePathTemplate> <outfile> --upgrade <previewSoundfont>\n\
+	   to write arriving samples into the zeroed slots of a soundfont composed with --layout (or --preview): \n\
+	   sfcompose <pathToSkeleton> <pathToSmplFolder> <samplePathTemplate> --patch <soundfont> {sampleId} ...\n\
+	   to compose several soundfonts at once (one \"<outfile> [{bankNumber} {presetNumber} ...]\" per line): \n\
+	   sfcompose <pathToSkeleton> <pathToSmplFolder> <samplePathTemplate> --batch <jobFile> [--jobs <numThreads>]\n\
+	   to run as a server on a unix socket path or a localhost port (GET /compose, /getsampleids, /stats): \n\
+	   sfcompose --serve <socketPathOrPort> [--root <dir>] [--jobs <numThreads>] [--sample-cache <bytes>]\n\
+	   (skeletons and samples of the requests have to be inside <dir>, default the working directory)\n\
+	   to merge presets of several skeletons into one soundfont (see README for the merge file): \n\
+	   sfcompose --merge <mergeFile> <outfile> [--jobs <numThreads>]\n\
+	   to check the structure of a soundfont (chunk bounds, indices, sample headers), prints json: \n\
+	   sfcompose --verify <soundfont>\n\
+	   to send random requests to a running server: \n\
+	   sfcompose <pathToSkeleton> <pathToSmplFolder> <samplePathTemplate> --loadtest <socketPathOrPort> [--requests <n>] [--jobs <concurrency>]\n\
 ";
 
 #define EMPTY_FILTER_MEANS_ALL 0
+// increase if a change alters the composed output
+#define CACHE_FORMAT_VERSION 2
 
 #if WIN32
 #define _CRTDBG_MAP_ALLOC
@@ -13,9 +53,22 @@ usage: sfcompose <pathToSkeleton> <pathToSmplFolder> <samplePathTemplate> <outfi
 #include <crtdbg.h>
 #endif
 
+#include "sfcompose.h"
 #include "dat/dat.h"
 #include "sf3/mydef.h"
 #include "sf3/sfont.h"
+#include "hash/hash.h"
+#include "hash/crc32c.h"
+#include "cache/cache.h"
+#include "cache/samplecache.h"
+#include "threads/threadpool.h"
+#include "server/server.h"
+#include "io/batchio.h"
+#include "verify/verify.h"
+#include "optimize/optimize.h"
+#include "json/json.h"
+#include "perf/stats.h"
+#include "perf/trace.h"
 #include <iostream>
 #include <stdexcept>
 #include <string>
@@ -23,12 +76,22 @@ usage: sfcompose <pathToSkeleton> <pathToSmplFolder> <samplePathTemplate> <outfi
 #include <memory>
 #include <vector>
 #include <algorithm>
+#include <iterator>
 #include <list>
+#include <deque>
+#include <set>
+#include <map>
 #include <unordered_set>
 #include <unordered_map>
 #include <fstream>
 #include <sstream>
 #include <cstdint>
+#include <cmath>
+#include <filesystem>
+#include <chrono>
+#include <random>
+#include <mutex>
+#include <atomic>
 
 #ifdef WIN32
 #define PATH_SEP '\\'
@@ -40,13 +103,32 @@ usage: sfcompose <pathToSkeleton> <pathToSmplFolder> <samplePathTemplate> <outfi
 std::string tty;
 #endif
 
+// process wide, enabled with --sample-cache
+std::unique_ptr<cache::SampleCache> sharedSampleCache;
+
 namespace filter {
 	struct Preset {
 		int bank = 0;
 		int preset = 0;
+		bool operator<(const Preset& other) const
+		{
+			return bank < other.bank || (bank == other.bank && preset < other.preset);
+		}
+		bool operator==(const Preset& other) const
+		{
+			return bank == other.bank && preset == other.preset;
+		}
 	};
 
 	typedef std::vector<Preset> Presets;
+	/*
+		sorts and removes duplicates
+	*/
+	inline void canonicalize(Presets& presets)
+	{
+		std::sort(presets.begin(), presets.end());
+		presets.erase(std::unique(presets.begin(), presets.end()), presets.end());
+	}
 	struct Filter {
 		Presets keep;
 		std::unordered_set<dat::Id> _presetsToKeep;
@@ -67,6 +149,8 @@ namespace filter {
 	};
 }
 
+struct SampleReport;
+
 struct Options {
 	std::string skeletonPath;
 	std::string samplePathTemplate;
@@ -74,10 +158,58 @@ struct Options {
 	std::string outfile;
 	filter::Presets filter;
 	bool printIds = false;
+	std::string planFormat;
+	bool extend = false;
+	bool layout = false;
+	bool patch = false;
+	std::vector<dat::Id> patchIds;
+	std::string batchFile;
+	std::string mergeFile;
+	std::string verifyFile;
+	int preview = 0;
+	std::string upgradeFrom;
+	int jobs = 0;
+	std::string ioBackend;
+	std::string cacheDir;
+	uint64_t cacheBudget = 512 * 1024 * 1024;
+	uint64_t sampleCacheBudget = 0;
+	std::string serveAddress;
+	// skeletons and samples of server requests have to be inside, the working directory if empty
+	std::string serveRoot;
+	std::string loadtestAddress;
+	int requests = 200;
+	bool stats = false;
+	bool allocStats = false;
+	std::string traceFile;
+	bool etag = false;
+	bool sha256 = false;
+	bool zeroBadSamples = false;
+	bool shards = false;
+	bool optimize = false;
+	std::ostream* output = &std::cout;
+	// receives the missing and zeroed samples of a compose, as well as they are printed
+	SampleReport* sampleReport = nullptr;
 	bool valid = true;
 	std::string error;
 };
 
+typedef std::unordered_map<dat::Id, SfTools::SampleBuffer> SamplePool;
+
+/*
+	the samples of a compose which were zeroed: the file does not match
+	its checksum (--bad-samples zero) or does not exist (yet)
+*/
+struct SampleReport {
+	std::mutex mutex;
+	std::vector<dat::Id> bad;
+	std::vector<dat::Id> missing;
+	void addBad(dat::Id id);
+	void addMissing(dat::Id id);
+	bool empty();
+	// "badSamples": [...], "missingSamples": [...] to be embedded in a json object
+	std::string jsonFields();
+};
+
 struct SfDb {
 	std::string sampleFolder;
 	std::string samplePathTemplate;
@@ -89,20 +221,112 @@ struct SfDb {
 	std::unordered_map<dat::Id, uint64_t> sampleIndices;
 	std::unordered_map<dat::Id, SfTools::Zone*> zones;
 	std::unordered_map<SfTools::Sample*, const dat::SampleHeader*> sampleHeaders;
+	const SamplePool* samplePool = nullptr;
+	cache::SampleCache* sampleCache = nullptr;
+	// identifies the skeleton in the keys of the sample cache
+	std::string skeletonPath;
+	// of the skeleton, every sample file read is checked against them
+	const dat::Container<dat::SampleChecksum>* sampleChecksums = nullptr;
+	bool zeroBadSamples = false;
+	SampleReport* sampleReport = nullptr;
+};
+
+/*
+	the content hash of a written soundfont (see SoundFont::contentHash), empty if not hashed.
+	as the output is deterministic, the same request always has the same tag
+*/
+struct ContentTag {
+	std::string etag;
+	// SHA-256 over the same content as etag, with the SHA-256 of every sample, not the digest of the file
+	std::string contentSha256;
+	// "etag": "...", "contentSha256": "..." to be embedded in a json object
+	std::string jsonFields() const;
+	// one line per hash for the compose cache
+	std::string serialize() const;
+	static ContentTag deserialize(const std::string& text);
+};
+
+struct BatchJob {
+	std::string outfile;
+	filter::Presets presets;
+};
+
+struct LayoutEntry {
+	dat::Id id = dat::Unknown;
+	uint64_t offset = 0;
+	uint64_t bytes = 0;
+};
+
+struct Layout {
+	int decimation = 1;
+	std::vector<LayoutEntry> samples;
+	std::vector<SfTools::ScaledGenerator> scaledGenerators;
+};
+
+struct MergeSource {
+	std::string name;
+	std::string skeletonPath;
+	std::string sampleFolder;
+	std::string samplePathTemplate;
+};
+
+struct PresetMapping {
+	std::string source;
+	filter::Preset from;
+	filter::Preset to;
+};
+
+struct MergeJob {
+	std::vector<MergeSource> sources;
+	std::vector<PresetMapping> mappings;
 };
 
 void read(const std::string& skeletonPath, dat::Skeleton& skeleton);
+void readShards(const Options& options, dat::Skeleton& skeleton);
+std::vector<std::string> shardPaths(const Options& options, const dat::Skeleton& directory);
 filter::Filter createFilter(const filter::Presets& keep, const dat::Skeleton& skeleton);
 void writeHeader(const dat::Skeleton& skeleton, SfTools::SoundFont* sf);
 void writePresets(const dat::Skeleton& skeleton, SfTools::SoundFont* sf, SfDb& db);
 void writeInstruments(const dat::Skeleton& skeleton, SfTools::SoundFont* sf, SfDb& db);
 void writeSamples(const dat::Skeleton& skeleton, SfTools::SoundFont* sf, SfDb& db);
-void writeZones(const dat::Skeleton& skeleton, SfTools::SoundFont* sf, SfDb& db);
+void linkStereoSamples(SfTools::SoundFont* sf, const SfDb& db);
+void writeZones(const dat::Skeleton& skeleton, SfDb& db);
 void writeZonesSum(SfTools::SoundFont* sf);
-void linkInstrumentsToPresets(const dat::Skeleton& skeleton, SfTools::SoundFont* sf, SfDb& db);
-void linkSamplesToInstruments(const dat::Skeleton& skeleton, SfTools::SoundFont* sf, SfDb& db);
+void linkInstrumentsToPresets(const dat::Skeleton& skeleton, SfDb& db);
+void linkSamplesToInstruments(const dat::Skeleton& skeleton, SfDb& db);
 void readSample(SfTools::Sample* sample, const SfDb& db, short *outBff, int length);
-void printSampleIds(const filter::Filter& filter);
+bool readSampleData(const dat::SampleHeader* header, const SfDb& db, short* outBff, int length);
+void rejectSample(const dat::SampleHeader* header, const SfDb& db, const std::string& error);
+const dat::SampleChecksum* findChecksum(const SfDb& db, dat::Id id);
+void bindSampleChecks(SfDb& db, const dat::Skeleton& skeleton, const Options& options, SampleReport* report);
+SfTools::SampleBuffer getSampleBuffer(SfTools::Sample* sample, const SfDb& db, int length);
+void bindSampleReaders(SfTools::SoundFont& sf, SfDb& db);
+void gatherSamples(QFile* file, qint64 dataPos, const std::vector<qint64>& offsets, std::vector<uint64_t>& hashes, std::vector<std::array<unsigned char, 32>>& sha256s, const SfTools::SoundFont& sf, const SfDb& db, const Options& options);
+void printSampleIds(const filter::Filter& filter, std::ostream& output);
+void printDownloadPlan(const filter::Filter& filter, const dat::Skeleton& skeleton, const std::string& format, std::ostream& output);
+template <class TContainer>
+void printIds(const TContainer& ids, std::ostream& output);
+void extend(const Options& options, const dat::Skeleton& skeleton, SfDb& db);
+ContentTag compose(const Options& options, const dat::Skeleton& skeleton, SfDb& db);
+ContentTag contentTag(const SfTools::SoundFont& sf);
+std::string cacheKey(const Options& options, const dat::Skeleton& skeleton);
+void batch(const Options& options, const dat::Skeleton& skeleton, SfDb& db);
+void serve(const Options& options);
+void loadtest(const Options& options);
+ContentTag process(const Options& options, const dat::Skeleton* residentSkeleton = nullptr);
+ContentTag composeCached(const Options& options, const dat::Skeleton& skeleton, SfDb& db, cache::ComposeCache& composeCache, const std::string& key);
+void optimizeSkeleton(const Options& options, const dat::Skeleton& skeleton, dat::Skeleton& optimized);
+uint64_t pdtaBytes(const filter::Presets& presets, const dat::Skeleton& skeleton);
+std::vector<BatchJob> readBatchJobs(const std::string& path);
+void merge(const Options& options);
+MergeJob readMergeJob(const std::string& path);
+ContentTag upgrade(const Options& options, const dat::Skeleton& skeleton, SfDb& db);
+void writeLayout(const SfTools::SoundFont& sf, const SfDb& db, const std::string& path);
+Layout readLayout(const std::string& path);
+SfTools::Sample* createSample(const dat::SampleHeader& sample);
+void patch(const Options& options, const dat::Skeleton& skeleton, SfDb& db);
+void patchSample(QFile& file, const LayoutEntry& entry, const short* data, uint64_t length);
+std::string samplePath(const dat::SampleHeader* header, const SfDb& db);
 template <class TIterator>
 Options getOptions(TIterator begin, TIterator end);
 
@@ -115,6 +339,7 @@ std::unique_ptr<SfTools::SoundFont> load(const std::string& sfPath)
 
 void saveAs(SfTools::SoundFont* sf, const std::string& newPath)
 {
+	perf::ScopedPhase phase("saveAs");
 	QFile file(newPath);
 	file.open(QFile::WriteOnly);
 	sf->file = &file;
@@ -128,54 +353,1180 @@ void saveAs(SfTools::SoundFont* sf, const std::string& newPath)
 	}
 	file.close();
 	sf->file = nullptr;
+	if (perf::phasesEnabled()) {
+		std::error_code ec;
+		perf::count(perf::OutputBytes, std::filesystem::file_size(newPath, ec));
+	}
 }
 
-void static _printInstument(SfTools::Instrument* i)
+/*
+	extends a copy of the file and replaces the file with it,
+	so a reader never sees a half extended soundfont
+*/
+void extendFile(SfTools::SoundFont* sf, const std::string& path, int keptSamples)
 {
-	std::cout << i->name << std::endl;
-	std::cout << i->zones.size() << std::endl;
-	for (auto z : i->zones) {
-		for (auto g : z->generators)
-		{
-			std::cout << g->gen << ":" << g->amount.uword << std::endl;
-		}
-		for (auto g : z->modulators)
-		{
-			std::cout << g->dst << ":" << g->amount << std::endl;
-		}
+	auto tmpPath = path + ".tmp";
+	std::error_code error;
+	std::filesystem::copy_file(path, tmpPath, std::filesystem::copy_options::overwrite_existing, error);
+	if (error) {
+		throw std::runtime_error("could not copy: " + path + " " + error.message());
+	}
+	QFile file(tmpPath);
+	if (!file.open(QFile::ReadWrite)) {
+		std::remove(tmpPath.c_str());
+		throw std::runtime_error("could not open: " + tmpPath);
+	}
+	sf->file = &file;
+	try {
+		sf->extend(keptSamples);
 	}
+	catch (...) {
+		file.close();
+		sf->file = nullptr;
+		std::remove(tmpPath.c_str());
+		throw;
+	}
+	file.close();
+	sf->file = nullptr;
+	std::filesystem::rename(tmpPath, path);
 }
 
 
-void process(const Options &options)
+/*
+	composes, extends, ... as the options say.
+	returns the content tag of a composed or upgraded soundfont (with --etag or --sha256)
+*/
+ContentTag process(const Options &options, const dat::Skeleton* residentSkeleton)
 {
-	dat::Skeleton skeleton;
-	dat::Container<dat::Preset> tmp;
+	perf::ScopedPhase phase("process");
+	std::unique_ptr<cache::ComposeCache> composeCache;
+	std::string key;
+	bool useCache = !options.cacheDir.empty() && !options.printIds && !options.extend && options.batchFile.empty()
+		&& options.preview <= 1 && options.upgradeFrom.empty() && !options.layout && !options.patch;
+	dat::Skeleton loadedSkeleton;
+	if (residentSkeleton == nullptr && options.shards) {
+		readShards(options, loadedSkeleton);
+		residentSkeleton = &loadedSkeleton;
+	}
+	else if (residentSkeleton == nullptr) {
+		read(options.skeletonPath, loadedSkeleton);
+		residentSkeleton = &loadedSkeleton;
+	}
+	if (useCache) {
+		composeCache = std::make_unique<cache::ComposeCache>(options.cacheDir, options.cacheBudget);
+		key = cacheKey(options, *residentSkeleton);
+		std::string storedTag;
+		if (composeCache->fetch(key, options.outfile, &storedTag)) {
+			auto tag = ContentTag::deserialize(storedTag);
+			bool hashed = options.etag || options.sha256;
+			// entries without the asked for hashes (older ones, or composed without --sha256) are composed again
+			if (!hashed || (!tag.etag.empty() && (!options.sha256 || !tag.contentSha256.empty()))) {
+				if (hashed) {
+					*options.output << "{" << tag.jsonFields() << "}" << std::endl;
+				}
+				return tag;
+			}
+		}
+	}
+	dat::Skeleton optimizedSkeleton;
+	if (options.optimize && !options.printIds) {
+		optimizeSkeleton(options, *residentSkeleton, optimizedSkeleton);
+		residentSkeleton = &optimizedSkeleton;
+	}
+	const dat::Skeleton& skeleton = *residentSkeleton;
 	SfDb db;
-	read(options.skeletonPath, skeleton);
 	db.filter = createFilter(options.filter, skeleton);
+	if (options.printIds && !options.planFormat.empty()) {
+		printDownloadPlan(db.filter, skeleton, options.planFormat, *options.output);
+		return ContentTag();
+	}
 	if (options.printIds) {
-		printSampleIds(db.filter);
-		return;
+		printSampleIds(db.filter, *options.output);
+		return ContentTag();
 	}
 	db.sampleFolder = options.sampleFolder;
 	db.samplePathTemplate = options.samplePathTemplate;
 	if (db.sampleFolder.back() != PATH_SEP) {
 		db.sampleFolder.push_back(PATH_SEP);
 	}
+	db.sampleCache = sharedSampleCache.get();
+	db.skeletonPath = options.skeletonPath;
+	SampleReport ownReport;
+	SampleReport& report = options.sampleReport != nullptr ? *options.sampleReport : ownReport;
+	bindSampleChecks(db, skeleton, options, &report);
+	if (options.extend) {
+		extend(options, skeleton, db);
+		return ContentTag();
+	}
+	ContentTag tag;
+	if (!options.upgradeFrom.empty()) {
+		tag = upgrade(options, skeleton, db);
+	}
+	else if (options.patch) {
+		patch(options, skeleton, db);
+		return ContentTag();
+	}
+	else if (!options.batchFile.empty()) {
+		batch(options, skeleton, db);
+		return ContentTag();
+	}
+	else if (!useCache) {
+		tag = compose(options, skeleton, db);
+	}
+	else {
+		tag = composeCached(options, skeleton, db, *composeCache, key);
+	}
+	if (options.etag || options.sha256) {
+		*options.output << "{" << tag.jsonFields() << "}" << std::endl;
+	}
+	if (!report.empty()) {
+		*options.output << "{" << report.jsonFields() << "}" << std::endl;
+	}
+	return tag;
+}
+
+/*
+	composes into the cache, a cached soundfont is always hashed
+	so that a later hit can tell its tag. a soundfont with missing
+	or zeroed bad samples is written to the outfile only
+*/
+ContentTag composeCached(const Options& options, const dat::Skeleton& skeleton, SfDb& db, cache::ComposeCache& composeCache, const std::string& key)
+{
+	Options cacheOptions = options;
+	cacheOptions.outfile = composeCache.tempPath(key);
+	cacheOptions.etag = true;
+	ContentTag tag;
+	try {
+		tag = compose(cacheOptions, skeleton, db);
+	}
+	catch (...) {
+		std::remove(cacheOptions.outfile.c_str());
+		throw;
+	}
+	if (db.sampleReport && !db.sampleReport->empty()) {
+		// zeroed samples may arrive (or be fixed) later, such a soundfont is not cached
+		std::error_code ec;
+		std::filesystem::rename(cacheOptions.outfile, options.outfile, ec);
+		if (ec) {
+			std::filesystem::copy_file(cacheOptions.outfile, options.outfile, std::filesystem::copy_options::overwrite_existing);
+			std::remove(cacheOptions.outfile.c_str());
+		}
+		return tag;
+	}
+	auto verified = verify::soundfontFile(cacheOptions.outfile);
+	if (!verified.valid) {
+		std::remove(cacheOptions.outfile.c_str());
+		throw std::runtime_error(std::string("composed soundfont is invalid, not cached: ") + verified.error);
+	}
+	composeCache.insert(key, cacheOptions.outfile, options.outfile, tag.serialize());
+	return tag;
+}
+
+/*
+	only the records of the request are optimized (all for --batch and --extend),
+	the pdta bytes of the request are printed with and without
+*/
+void optimizeSkeleton(const Options& options, const dat::Skeleton& skeleton, dat::Skeleton& optimized)
+{
+	perf::ScopedPhase phase("optimize");
+	if (options.filter.empty() || options.extend) {
+		optimized = skeleton;
+	}
+	else {
+		auto filter = createFilter(options.filter, skeleton);
+		optimized.header = skeleton.header;
+		optimized.presets = skeleton.presets;
+		auto keep = [&filter](dat::For for_, dat::Id relatedTo) {
+			return for_ == dat::ForPreset ? filter.keepPreset(relatedTo) : filter.keepInstrument(relatedTo);
+		};
+		std::copy_if(skeleton.generators.begin(), skeleton.generators.end(), std::back_inserter(optimized.generators), [&](const dat::Generator& generator) {
+			return keep(generator.for_, generator.relatedTo);
+		});
+		std::copy_if(skeleton.modulators.begin(), skeleton.modulators.end(), std::back_inserter(optimized.modulators), [&](const dat::Modulator& modulator) {
+			return keep(modulator.for_, modulator.relatedTo);
+		});
+		std::copy_if(skeleton.instruments.begin(), skeleton.instruments.end(), std::back_inserter(optimized.instruments), [&](const dat::Instrument& instrument) {
+			return filter.keepInstrument(instrument.id);
+		});
+		std::copy_if(skeleton.instrument2Preset.begin(), skeleton.instrument2Preset.end(), std::back_inserter(optimized.instrument2Preset), [&](const dat::Instrument2Preset& rel) {
+			return filter.keepPreset(rel.preset);
+		});
+		std::copy_if(skeleton.samples.begin(), skeleton.samples.end(), std::back_inserter(optimized.samples), [&](const dat::SampleHeader& sample) {
+			return filter.keepSample(sample.id);
+		});
+		std::copy_if(skeleton.sample2Instruments.begin(), skeleton.sample2Instruments.end(), std::back_inserter(optimized.sample2Instruments), [&](const dat::Sample2Instrument& rel) {
+			return filter.keepInstrument(rel.instrument);
+		});
+		std::copy_if(skeleton.sampleChecksums.begin(), skeleton.sampleChecksums.end(), std::back_inserter(optimized.sampleChecksums), [&](const dat::SampleChecksum& checksum) {
+			return filter.keepSample(checksum.sample);
+		});
+	}
+	auto reduction = optimize::skeleton(optimized);
+	*options.output << "{\"pdtaBytes\": " << pdtaBytes(options.filter, skeleton)
+		<< ", \"optimizedPdtaBytes\": " << pdtaBytes(options.filter, optimized)
+		<< ", " << reduction.jsonFields() << "}" << std::endl;
+}
+
+uint64_t pdtaBytes(const filter::Presets& presets, const dat::Skeleton& skeleton)
+{
+	if (presets.empty()) {
+		return optimize::pdtaBytes(skeleton);
+	}
+	auto filter = createFilter(presets, skeleton);
+	return optimize::pdtaBytes(skeleton,
+		[&filter](dat::Id id) { return filter.keepPreset(id); },
+		[&filter](dat::Id id) { return filter.keepInstrument(id); },
+		[&filter](dat::Id id) { return filter.keepSample(id); });
+}
+
+void bindSampleReaders(SfTools::SoundFont& sf, SfDb& db)
+{
 	using namespace std::placeholders;
-	SfTools::SoundFont sf;
-	
 	sf.readSampleFunction = std::bind(&readSample, _1, std::ref(db), _2, _3);
+	if (db.samplePool || db.sampleCache) {
+		sf.sampleBufferFunction = std::bind(&getSampleBuffer, _1, std::ref(db), _2);
+	}
+}
+
+ContentTag compose(const Options& options, const dat::Skeleton& skeleton, SfDb& db)
+{
+	perf::ScopedPhase phase("compose");
+	SfTools::SoundFont sf;
+	bindSampleReaders(sf, db);
+	sf.writeThreads = std::max(options.jobs, 1);
+	sf.decimation = std::max(options.preview, 1);
+	sf.hashContent = options.etag || options.sha256;
+	sf.hashContentSha256 = options.sha256;
+	if (!options.ioBackend.empty()) {
+		using namespace std::placeholders;
+		sf.gatherSamplesFunction = std::bind(&gatherSamples, _1, _2, _3, _4, _5, std::cref(sf), std::cref(db), std::cref(options));
+	}
+	writeHeader(skeleton, &sf);
+	writePresets(skeleton, &sf, db);
+	writeInstruments(skeleton, &sf, db);
+	writeSamples(skeleton, &sf, db);
+	linkStereoSamples(&sf, db);
+	writeZones(skeleton, db);
+	linkInstrumentsToPresets(skeleton, db);
+	linkSamplesToInstruments(skeleton, db);
+	writeZonesSum(&sf);
+	saveAs(&sf, options.outfile);
+	if (options.preview > 1 || options.layout) {
+		writeLayout(sf, db, options.outfile + ".layout.json");
+	}
+	return contentTag(sf);
+}
+
+ContentTag contentTag(const SfTools::SoundFont& sf)
+{
+	ContentTag tag;
+	if (sf.hashContent) {
+		tag.etag = sf.contentHash();
+	}
+	if (sf.hashContentSha256) {
+		tag.contentSha256 = sf.contentSha256();
+	}
+	return tag;
+}
+
+std::string ContentTag::jsonFields() const
+{
+	std::string fields = "\"etag\": \"" + etag + "\"";
+	if (!contentSha256.empty()) {
+		fields += ", \"contentSha256\": \"" + contentSha256 + "\"";
+	}
+	return fields;
+}
+
+std::string ContentTag::serialize() const
+{
+	return etag + "\n" + contentSha256 + "\n";
+}
+
+ContentTag ContentTag::deserialize(const std::string& text)
+{
+	ContentTag tag;
+	std::stringstream ss(text);
+	std::getline(ss, tag.etag);
+	std::getline(ss, tag.contentSha256);
+	return tag;
+}
+
+/*
+	writes the given samples into their slots of an already composed soundfont,
+	the slots are taken from its layout map. the samples of a preview are
+	decimated by the factor of the layout
+*/
+void patch(const Options& options, const dat::Skeleton& skeleton, SfDb& db)
+{
+	auto layout = readLayout(options.outfile + ".layout.json");
+	std::unordered_map<dat::Id, const LayoutEntry*> entries;
+	for (const auto& entry : layout.samples) {
+		entries.insert(std::make_pair(entry.id, &entry));
+	}
+	std::unordered_map<dat::Id, const dat::SampleHeader*> headers;
+	for (const auto& sample : skeleton.samples) {
+		headers.insert(std::make_pair(sample.id, &sample));
+	}
+	QFile file(options.outfile);
+	if (!file.open(QFile::ReadWrite)) {
+		throw std::runtime_error("could not open: " + options.outfile);
+	}
+	try {
+		for (auto id : options.patchIds) {
+			auto entryIt = entries.find(id);
+			auto headerIt = headers.find(id);
+			if (entryIt == entries.end() || headerIt == headers.end()) {
+				throw std::runtime_error("sample " + std::to_string(id) + " is not part of " + options.outfile);
+			}
+			const auto* header = headerIt->second;
+			int length = header->end > header->start ? header->end - header->start : 0;
+			std::vector<short> data(length);
+			if (!readSampleData(header, db, data.data(), length)) {
+				throw std::runtime_error(samplePath(header, db) + " not found");
+			}
+			if (layout.decimation > 1) {
+				// the slot of a preview holds the sample as --preview reduced it
+				data = SfTools::decimate(data.data(), length, SfTools::decimationFactor(layout.decimation, header->samplerate));
+			}
+			patchSample(file, *entryIt->second, data.data(), data.size());
+		}
+	}
+	catch (...) {
+		file.close();
+		throw;
+	}
+	file.close();
+	printIds(options.patchIds, *options.output);
+}
+
+/*
+	writes the sample data into its slot, throws if the length does not match the slot
+*/
+void patchSample(QFile& file, const LayoutEntry& entry, const short* data, uint64_t length)
+{
+	if (length * sizeof(short) != entry.bytes) {
+		throw std::runtime_error("sample " + std::to_string(entry.id) + " does not fit into its slot");
+	}
+	if (file.writeAt((const char*)data, (int)entry.bytes, entry.offset) != (int)entry.bytes) {
+		throw std::runtime_error("write error " + file.fileName());
+	}
+}
+
+/*
+	the full quality version of a preview: the samples are read in the order
+	of the layout map of the preview, the INFO list and the pdta tables are
+	copied from the preview, only the sample headers are written again
+*/
+ContentTag upgrade(const Options& options, const dat::Skeleton& skeleton, SfDb& db)
+{
+	auto layout = readLayout(options.upgradeFrom + ".layout.json");
+	std::unordered_map<dat::Id, const dat::SampleHeader*> headers;
+	for (const auto& sample : skeleton.samples) {
+		headers.insert(std::make_pair(sample.id, &sample));
+	}
+	SfTools::SoundFont sf;
+	bindSampleReaders(sf, db);
+	sf.writeThreads = std::max(options.jobs, 1);
+	sf.hashContent = options.etag || options.sha256;
+	sf.hashContentSha256 = options.sha256;
+	for (const auto& entry : layout.samples) {
+		auto it = headers.find(entry.id);
+		if (it == headers.end()) {
+			throw std::runtime_error("sample " + std::to_string(entry.id) + " not found in " + options.skeletonPath);
+		}
+		auto sfSample = createSample(*it->second);
+		sf.samples.push_back(sfSample);
+		db.sampleHeaders.insert(std::make_pair(sfSample, it->second));
+	}
+	linkStereoSamples(&sf, db);
+	QFile previewFile(options.upgradeFrom);
+	if (!previewFile.open(QFile::ReadOnly)) {
+		throw std::runtime_error("could not open: " + options.upgradeFrom);
+	}
+	// the preview may be replaced by its upgrade
+	auto outPath = options.outfile + ".tmp";
+	QFile file(outPath);
+	file.open(QFile::WriteOnly);
+	sf.file = &file;
+	try {
+		sf.upgrade(&previewFile, layout.scaledGenerators);
+	}
+	catch (...) {
+		file.close();
+		previewFile.close();
+		sf.file = nullptr;
+		std::remove(outPath.c_str());
+		throw;
+	}
+	file.close();
+	previewFile.close();
+	sf.file = nullptr;
+	std::filesystem::rename(outPath, options.outfile);
+	writeLayout(sf, db, options.outfile + ".layout.json");
+	return contentTag(sf);
+}
+
+/*
+	where the sample data of every sample is in the written file, in sample order,
+	and the address offsets a preview divided (igen record index and original amount):
+	{"decimation": 1, "smplOffset": 1234, "samples": [{"id": 5, "offset": 1234, "bytes": 5678}, ...],
+	"missing": [7, ...], "scaledGenerators": [{"index": 42, "amount": -100}, ...]}
+*/
+void writeLayout(const SfTools::SoundFont& sf, const SfDb& db, const std::string& path)
+{
+	std::fstream file(path.c_str(), std::ios_base::out);
+	if (!file.is_open()) {
+		throw std::runtime_error("could not open: " + path);
+	}
+	file << "{\"decimation\": " << sf.decimation << ", \"smplOffset\": " << sf.samplePos << ", \"samples\": [";
+	for (int i = 0; i < (int)sf.samples.size(); ++i) {
+		const auto* sample = sf.samples[i];
+		auto headerIt = db.sampleHeaders.find(const_cast<SfTools::Sample*>(sample));
+		if (headerIt == db.sampleHeaders.end()) {
+			throw std::runtime_error("sample header not found");
+		}
+		uint64_t bytes = sample->end > sample->start ? (sample->end - sample->start) * sizeof(short) : 0;
+		file << (i > 0 ? ", " : "") << "{\"id\": " << headerIt->second->id
+			<< ", \"offset\": " << sf.samplePos + (uint64_t)sample->start * sizeof(short)
+			<< ", \"bytes\": " << bytes << "}";
+	}
+	file << "], \"missing\": [";
+	bool first = true;
+	for (const auto* sample : sf.samples) {
+		const auto* header = db.sampleHeaders.find(const_cast<SfTools::Sample*>(sample))->second;
+		if (!std::filesystem::exists(samplePath(header, db))) {
+			file << (first ? "" : ", ") << header->id;
+			first = false;
+		}
+	}
+	file << "], \"scaledGenerators\": [";
+	for (size_t i = 0; i < sf.scaledGenerators.size(); ++i) {
+		const auto& scaled = sf.scaledGenerators[i];
+		file << (i > 0 ? ", " : "") << "{\"index\": " << scaled.index << ", \"amount\": " << scaled.amount << "}";
+	}
+	file << "]}" << std::endl;
+}
+
+Layout readLayout(const std::string& path)
+{
+	std::fstream file(path.c_str(), std::ios_base::in);
+	if (!file.is_open()) {
+		throw std::runtime_error("could not open: " + path);
+	}
+	std::stringstream ss;
+	ss << file.rdbuf();
+	json::Value value;
+	try {
+		value = json::read(ss.str());
+	}
+	catch (const std::exception& ex) {
+		throw std::runtime_error("invalid layout map " + path + ": " + ex.what());
+	}
+	auto number = [&path](const json::Value& object, const char* key) {
+		auto* member = object.get(key);
+		if (!member || member->type != json::Value::Number) {
+			throw std::runtime_error("invalid layout map " + path + ": " + key + " missing");
+		}
+		return member->number;
+	};
+	Layout layout;
+	layout.decimation = (int)number(value, "decimation");
+	auto* samples = value.get("samples");
+	if (!samples || samples->type != json::Value::Array) {
+		throw std::runtime_error("invalid layout map " + path + ": samples missing");
+	}
+	for (const auto& item : samples->items) {
+		LayoutEntry entry;
+		entry.id = (dat::Id)number(item, "id");
+		entry.offset = (uint64_t)number(item, "offset");
+		entry.bytes = (uint64_t)number(item, "bytes");
+		layout.samples.push_back(entry);
+	}
+	// older layout maps have none
+	if (auto* scaledGenerators = value.get("scaledGenerators")) {
+		for (const auto& item : scaledGenerators->items) {
+			layout.scaledGenerators.push_back({ (int)number(item, "index"), (short)number(item, "amount") });
+		}
+	}
+	return layout;
+}
+
+/*
+	copies all sample files into the smpl chunk with one batch of io operations,
+	missing sample files are skipped and files of the wrong size rejected like in readSampleData.
+	the samples are hashed by the batch as they are copied, without reading them again
+*/
+void gatherSamples(QFile* file, qint64 dataPos, const std::vector<qint64>& offsets, std::vector<uint64_t>& hashes, std::vector<std::array<unsigned char, 32>>& sha256s, const SfTools::SoundFont& sf, const SfDb& db, const Options& options)
+{
+	perf::ScopedPhase phase("gatherSamples");
+	std::vector<io::CopyJob> jobs;
+	std::vector<const dat::SampleHeader*> headers;
+	std::vector<int> sampleIndexes;
+	jobs.reserve(sf.samples.size());
+	for (int i = 0; i < (int)sf.samples.size(); ++i) {
+		auto* sample = sf.samples[i];
+		if (sample->end <= sample->start) {
+			continue;
+		}
+		auto headerIt = db.sampleHeaders.find(sample);
+		if (headerIt == db.sampleHeaders.end()) {
+			throw std::runtime_error("sample header not found");
+		}
+		io::CopyJob job;
+		job.srcPath = db.sampleFolder + db.samplePathTemplate + std::to_string(headerIt->second->id) + ".smpl";
+		job.dstFd = file->handle();
+		job.dstOffset = dataPos + offsets[i];
+		job.length = (uint64_t)(sample->end - sample->start) * sizeof(short);
+		job.checksum = findChecksum(db, headerIt->second->id) != nullptr;
+		job.checkSize = true;
+		job.hash = !hashes.empty();
+		job.sha256 = job.hash && sf.hashContentSha256;
+		jobs.push_back(job);
+		headers.push_back(headerIt->second);
+		sampleIndexes.push_back(i);
+	}
+	io::IoOptions ioOptions;
+	ioOptions.backend = io::parseBackend(options.ioBackend);
+	auto stats = io::copy(jobs, ioOptions);
+	for (size_t i = 0; i < jobs.size(); ++i) {
+		auto& job = jobs[i];
+		bool zeroed = job.skipped || job.sizeMismatch;
+		if (job.skipped || (job.sizeMismatch && job.srcSize == 0)) {
+			if (db.sampleReport) {
+				db.sampleReport->addMissing(headers[i]->id);
+			}
+		}
+		else if (job.sizeMismatch) {
+			// not copied, the slot is still zeroed
+			rejectSample(headers[i], db, job.srcPath + " file size mismatch expected " + std::to_string(job.length) + " but was " + std::to_string(job.srcSize));
+		}
+		else if (job.checksum && job.crc32c != findChecksum(db, headers[i]->id)->crc32c) {
+			rejectSample(headers[i], db, job.srcPath + " does not match its checksum");
+			// copied already, the slot is zeroed again
+			std::vector<char> zeros(job.length);
+			if (file->writeAt(zeros.data(), (int)job.length, job.dstOffset) != (int)job.length) {
+				throw std::runtime_error("write error");
+			}
+			zeroed = true;
+		}
+		if (job.hash) {
+			// the slot of a missing or rejected sample holds zeros
+			if (zeroed) {
+				std::vector<char> zeros(job.length);
+				hash::Sha256 sha256;
+				job.xxh64 = hash::xxh64(zeros.data(), zeros.size());
+				sha256.update(zeros.data(), zeros.size());
+				sha256.digest(job.sha256Digest.data());
+			}
+			hashes[sampleIndexes[i]] = job.xxh64;
+			sha256s[sampleIndexes[i]] = job.sha256Digest;
+		}
+	}
+	perf::count(perf::FileOpens, stats.files);
+	perf::count(perf::SampleBytesRead, stats.bytesRead);
+	perf::count(perf::BytesWritten, stats.bytesWritten);
+	for (const auto& job : jobs) {
+		perf::count(perf::SamplesRead, job.skipped || job.sizeMismatch ? 0 : 1);
+	}
+	*options.output << stats.json() << std::endl;
+}
+
+/*
+	the key of a composed soundfont: the skeleton content, the sample location,
+	the canonical (sorted, without duplicates) preset list and the options changing
+	the output. soundfonts with missing or bad samples are not cached. a changed sample
+	changes its checksum in the skeleton, without checksums the size and modification
+	time of every sample file of the request are part of the key
+*/
+std::string cacheKey(const Options& options, const dat::Skeleton& skeleton)
+{
+	std::stringstream ss;
+	ss << "sfcompose-" << CACHE_FORMAT_VERSION << "\n";
+	ss << hash::toHex(hash::xxh64File(options.skeletonPath)) << "\n";
+	if (options.shards) {
+		dat::Skeleton directory;
+		read(options.skeletonPath, directory);
+		for (const auto& path : shardPaths(options, directory)) {
+			ss << hash::toHex(hash::xxh64File(path)) << "\n";
+		}
+	}
+	ss << options.sampleFolder << PATH_SEP << options.samplePathTemplate << "\n";
+	for (const auto& preset : options.filter) {
+		ss << preset.bank << " " << preset.preset << "\n";
+	}
+	if (skeleton.sampleChecksums.empty()) {
+		SfDb db;
+		db.sampleFolder = options.sampleFolder;
+		db.samplePathTemplate = options.samplePathTemplate;
+		if (db.sampleFolder.empty() || db.sampleFolder.back() != PATH_SEP) {
+			db.sampleFolder.push_back(PATH_SEP);
+		}
+		auto filter = createFilter(options.filter, skeleton);
+		std::vector<dat::Id> ids(filter._samplesToKeep.begin(), filter._samplesToKeep.end());
+		std::sort(ids.begin(), ids.end());
+		for (auto id : ids) {
+			dat::SampleHeader header;
+			header.id = id;
+			std::error_code error;
+			auto path = samplePath(&header, db);
+			auto bytes = std::filesystem::file_size(path, error);
+			auto modified = error ? std::filesystem::file_time_type() : std::filesystem::last_write_time(path, error);
+			if (error) {
+				// missing, the soundfont is not cached anyway
+				ss << id << " missing\n";
+				continue;
+			}
+			ss << id << " " << bytes << " " << (int64_t)modified.time_since_epoch().count() << "\n";
+		}
+	}
+	if (options.optimize) {
+		ss << "optimize\n";
+	}
+	if (options.zeroBadSamples) {
+		ss << "bad-samples zero\n";
+	}
+	auto request = ss.str();
+	return hash::toHex(hash::xxh64(request.data(), request.size()));
+}
+
+void extend(const Options& options, const dat::Skeleton& skeleton, SfDb& db)
+{
+	auto existing = load(options.outfile);
+	filter::Presets delivered;
+	for (const auto* preset : existing->presets) {
+		delivered.push_back({ preset->bank, preset->preset });
+	}
+	auto deliveredFilter = createFilter(delivered, skeleton);
+	if (deliveredFilter._presetsToKeep.size() != existing->presets.size()
+		|| deliveredFilter._samplesToKeep.size() != existing->samples.size()) {
+		throw std::runtime_error(options.outfile + " was not composed from " + options.skeletonPath);
+	}
+	filter::Presets keep = delivered;
+	keep.insert(keep.end(), options.filter.begin(), options.filter.end());
+	db.filter = createFilter(keep, skeleton);
+
+	SfTools::SoundFont sf;
+	bindSampleReaders(sf, db);
 	writeHeader(skeleton, &sf);
 	writePresets(skeleton, &sf, db);
 	writeInstruments(skeleton, &sf, db);
 	writeSamples(skeleton, &sf, db);
-	writeZones(skeleton, &sf, db);
-	linkInstrumentsToPresets(skeleton, &sf, db);
-	linkSamplesToInstruments(skeleton, &sf, db);
+	// the existing file may have been extended before, so its samples are matched
+	// by their header data (name, length and rate) and not by their position in the skeleton.
+	// samples with the same header data are taken in skeleton order
+	auto sampleKey = [](const char* name, uint length, uint samplerate) {
+		std::string key(name ? name : "", name ? strnlen(name, dat::StringLength) : 0);
+		return key + '\0' + std::to_string(length) + '\0' + std::to_string(samplerate);
+	};
+	std::unordered_map<std::string, std::deque<SfTools::Sample*>> candidates;
+	for (auto* sample : sf.samples) {
+		const auto* header = db.sampleHeaders[sample];
+		if (deliveredFilter.keepSample(header->id)) {
+			candidates[sampleKey(header->name, header->end - header->start, header->samplerate)].push_back(sample);
+		}
+	}
+	std::unordered_map<SfTools::Sample*, size_t> positions;
+	for (size_t i = 0; i < existing->samples.size(); ++i) {
+		const auto* existingSample = existing->samples[i];
+		auto it = candidates.find(sampleKey(existingSample->name, existingSample->end - existingSample->start, existingSample->samplerate));
+		if (it == candidates.end() || it->second.empty()) {
+			throw std::runtime_error("sample " + std::to_string(i) + " of " + options.outfile + " not found in skeleton");
+		}
+		positions[it->second.front()] = i;
+		it->second.pop_front();
+	}
+	// the delivered samples stay in front, in the order of the existing smpl chunk
+	std::stable_sort(sf.samples.begin(), sf.samples.end(), [&](SfTools::Sample* a, SfTools::Sample* b) {
+		auto aIt = positions.find(a);
+		auto bIt = positions.find(b);
+		auto aPos = aIt != positions.end() ? aIt->second : positions.size();
+		auto bPos = bIt != positions.end() ? bIt->second : positions.size();
+		return aPos < bPos;
+	});
+	std::vector<dat::Id> newSampleIds;
+	for (size_t i = 0; i < sf.samples.size(); ++i) {
+		auto id = db.sampleHeaders[sf.samples[i]]->id;
+		db.sampleIndices[id] = i;
+		if (i >= existing->samples.size()) {
+			newSampleIds.push_back(id);
+		}
+	}
+	linkStereoSamples(&sf, db);
+	writeZones(skeleton, db);
+	linkInstrumentsToPresets(skeleton, db);
+	linkSamplesToInstruments(skeleton, db);
+	writeZonesSum(&sf);
+	extendFile(&sf, options.outfile, (int)existing->samples.size());
+	std::sort(newSampleIds.begin(), newSampleIds.end());
+	printIds(newSampleIds, *options.output);
+}
+
+/*
+	composes several soundfonts with one skeleton,
+	every needed sample is read only once
+*/
+void batch(const Options& options, const dat::Skeleton& skeleton, SfDb& db)
+{
+	auto startTime = std::chrono::steady_clock::now();
+	auto jobs = readBatchJobs(options.batchFile);
+	int numThreads = options.jobs > 0 ? options.jobs : threads::defaultNumThreads();
+	std::vector<filter::Filter> filters;
+	std::unordered_set<dat::Id> sampleIds;
+	for (const auto& job : jobs) {
+		filters.push_back(createFilter(job.presets, skeleton));
+		const auto& samples = filters.back()._samplesToKeep;
+		sampleIds.insert(samples.begin(), samples.end());
+	}
+	std::vector<const dat::SampleHeader*> headers;
+	for (const auto& sample : skeleton.samples) {
+		if (sampleIds.find(sample.id) != sampleIds.end()) {
+			headers.push_back(&sample);
+		}
+	}
+	std::vector<SfTools::SampleBuffer> buffers(headers.size());
+	threads::parallelFor(headers.size(), numThreads, [&](size_t i) {
+		const auto* header = headers[i];
+		int length = header->end > header->start ? header->end - header->start : 0;
+		auto buffer = std::make_shared<std::vector<short>>(length);
+		readSampleData(header, db, buffer->data(), length);
+		buffers[i] = buffer;
+	});
+	SamplePool pool;
+	uint64_t bytesRead = 0;
+	for (size_t i = 0; i < headers.size(); ++i) {
+		pool.insert(std::make_pair(headers[i]->id, buffers[i]));
+		bytesRead += buffers[i]->size() * sizeof(short);
+	}
+
+	std::vector<uint64_t> outSizes(jobs.size());
+	threads::parallelFor(jobs.size(), numThreads, [&](size_t i) {
+		SfDb jobDb;
+		jobDb.sampleFolder = db.sampleFolder;
+		jobDb.samplePathTemplate = db.samplePathTemplate;
+		jobDb.filter = filters[i];
+		jobDb.samplePool = &pool;
+		jobDb.sampleChecksums = db.sampleChecksums;
+		jobDb.zeroBadSamples = db.zeroBadSamples;
+		jobDb.sampleReport = db.sampleReport;
+		Options jobOptions = options;
+		jobOptions.outfile = jobs[i].outfile;
+		// the jobs are already running in parallel
+		jobOptions.jobs = 1;
+		compose(jobOptions, skeleton, jobDb);
+		outSizes[i] = std::filesystem::file_size(jobs[i].outfile);
+	});
+
+	std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - startTime;
+	uint64_t bytesWritten = 0;
+	for (auto size : outSizes) {
+		bytesWritten += size;
+	}
+	const double MB = 1024.0 * 1024.0;
+	*options.output << "batch: " << jobs.size() << " soundfonts, "
+		<< bytesWritten / MB << " MB written in " << seconds.count() << " s ("
+		<< bytesWritten / MB / seconds.count() << " MB/s), "
+		<< headers.size() << " samples (" << bytesRead / MB << " MB) read once, "
+		<< numThreads << " threads" << std::endl;
+}
+
+/*
+	one job per line: <outfile> [{bankNumber} {presetNumber} ...]
+	empty lines and lines starting with # are ignored
+*/
+std::vector<BatchJob> readBatchJobs(const std::string& path)
+{
+	std::fstream file(path.c_str(), std::ios_base::in);
+	if (!file.is_open()) {
+		throw std::runtime_error("could not open: " + path);
+	}
+	std::vector<BatchJob> jobs;
+	std::string line;
+	int lineNr = 0;
+	while (std::getline(file, line)) {
+		++lineNr;
+		std::stringstream ss(line);
+		BatchJob job;
+		if (!(ss >> job.outfile) || job.outfile[0] == '#') {
+			continue;
+		}
+		std::vector<int> ids;
+		int id;
+		while (ss >> id) {
+			ids.push_back(id);
+		}
+		if (!ss.eof() || ids.empty() || ids.size() % 2 != 0) {
+			throw std::runtime_error(path + ":" + std::to_string(lineNr) + ": invalid preset list");
+		}
+		for (size_t i = 0; i < ids.size(); i += 2) {
+			job.presets.push_back({ ids[i], ids[i + 1] });
+		}
+		filter::canonicalize(job.presets);
+		jobs.push_back(job);
+	}
+	return jobs;
+}
+
+/*
+	composes the mapped presets of several skeletons into one soundfont.
+	every source runs through the same filter and write functions as a single
+	compose, instrument and sample indices continue where the previous source ended.
+	the soundfont header is taken from the first source.
+*/
+void merge(const Options& options)
+{
+	auto job = readMergeJob(options.mergeFile);
+	SampleReport report;
+	std::vector<dat::Skeleton> skeletons(job.sources.size());
+	std::vector<std::unique_ptr<SfDb>> dbs;
+	SfTools::SoundFont sf;
+	sf.writeThreads = std::max(options.jobs, 1);
+	for (size_t i = 0; i < job.sources.size(); ++i) {
+		const auto& source = job.sources[i];
+		auto& skeleton = skeletons[i];
+		read(source.skeletonPath, skeleton);
+		if (i == 0) {
+			writeHeader(skeleton, &sf);
+		}
+		filter::Presets keep;
+		for (const auto& mapping : job.mappings) {
+			if (mapping.source == source.name) {
+				keep.push_back(mapping.from);
+			}
+		}
+		filter::canonicalize(keep);
+		dbs.push_back(std::make_unique<SfDb>());
+		auto& db = *dbs.back();
+		db.filter = createFilter(keep, skeleton);
+		db.sampleFolder = source.sampleFolder;
+		db.samplePathTemplate = source.samplePathTemplate;
+		db.skeletonPath = source.skeletonPath;
+		if (db.sampleFolder.back() != PATH_SEP) {
+			db.sampleFolder.push_back(PATH_SEP);
+		}
+		bindSampleChecks(db, skeleton, options, &report);
+		writePresets(skeleton, &sf, db);
+		for (auto& presetIt : db.presets) {
+			auto* preset = presetIt.second;
+			for (const auto& mapping : job.mappings) {
+				if (mapping.source == source.name && mapping.from.bank == preset->bank && mapping.from.preset == preset->preset) {
+					preset->bank = mapping.to.bank;
+					preset->preset = mapping.to.preset;
+					break;
+				}
+			}
+		}
+		writeInstruments(skeleton, &sf, db);
+		writeSamples(skeleton, &sf, db);
+		linkStereoSamples(&sf, db);
+		writeZones(skeleton, db);
+		linkInstrumentsToPresets(skeleton, db);
+		linkSamplesToInstruments(skeleton, db);
+	}
+	sf.readSampleFunction = [&dbs](SfTools::Sample* sample, short* outBff, int length) {
+		for (const auto& db : dbs) {
+			auto headerIt = db->sampleHeaders.find(sample);
+			if (headerIt != db->sampleHeaders.end()) {
+				readSampleData(headerIt->second, *db, outBff, length);
+				return;
+			}
+		}
+		throw std::runtime_error("sample header not found");
+	};
 	writeZonesSum(&sf);
 	saveAs(&sf, options.outfile);
+	if (!report.empty()) {
+		*options.output << "{" << report.jsonFields() << "}" << std::endl;
+	}
+}
+
+/*
+	one entry per line, empty lines and lines starting with # are ignored:
+	source <name> <pathToSkeleton> <pathToSmplFolder> <samplePathTemplate>
+	map <name> <bankNumber> <presetNumber> <targetBankNumber> <targetPresetNumber>
+*/
+MergeJob readMergeJob(const std::string& path)
+{
+	std::fstream file(path.c_str(), std::ios_base::in);
+	if (!file.is_open()) {
+		throw std::runtime_error("could not open: " + path);
+	}
+	MergeJob job;
+	std::set<filter::Preset> targets;
+	std::set<std::pair<std::string, filter::Preset>> mapped;
+	std::string line;
+	int lineNr = 0;
+	while (std::getline(file, line)) {
+		++lineNr;
+		auto where = path + ":" + std::to_string(lineNr) + ": ";
+		std::stringstream ss(line);
+		std::string type;
+		if (!(ss >> type) || type[0] == '#') {
+			continue;
+		}
+		if (type == "source") {
+			MergeSource source;
+			if (!(ss >> source.name >> source.skeletonPath >> source.sampleFolder >> source.samplePathTemplate)) {
+				throw std::runtime_error(where + "invalid source");
+			}
+			for (const auto& other : job.sources) {
+				if (other.name == source.name) {
+					throw std::runtime_error(where + "duplicate source " + source.name);
+				}
+			}
+			job.sources.push_back(source);
+		}
+		else if (type == "map") {
+			PresetMapping mapping;
+			if (!(ss >> mapping.source >> mapping.from.bank >> mapping.from.preset >> mapping.to.bank >> mapping.to.preset)) {
+				throw std::runtime_error(where + "invalid mapping");
+			}
+			bool known = std::find_if(job.sources.begin(), job.sources.end(), [&mapping](const auto& x) {
+				return x.name == mapping.source;
+			}) != job.sources.end();
+			if (!known) {
+				throw std::runtime_error(where + "unknown source " + mapping.source);
+			}
+			if (!mapped.insert(std::make_pair(mapping.source, mapping.from)).second) {
+				// a preset is composed once, it can not be written to two targets
+				throw std::runtime_error(where + mapping.source + " bank " + std::to_string(mapping.from.bank)
+					+ " preset " + std::to_string(mapping.from.preset) + " is already mapped");
+			}
+			if (!targets.insert(mapping.to).second) {
+				throw std::runtime_error(where + "target bank " + std::to_string(mapping.to.bank)
+					+ " preset " + std::to_string(mapping.to.preset) + " is already mapped");
+			}
+			job.mappings.push_back(mapping);
+		}
+		else {
+			throw std::runtime_error(where + "unknown entry " + type);
+		}
+	}
+	if (job.sources.empty() || job.mappings.empty()) {
+		throw std::runtime_error(path + ": no sources or mappings");
+	}
+	return job;
+}
+
+/*
+	keeps the skeletons resident (until their file changes) and answers:
+	GET /compose?skeleton=..&samples=..&template=..&presets=bank,preset,...
+	GET /getsampleids?skeleton=..&presets=bank,preset,...[&plan=json|binary]
+	the composed soundfont is streamed back, the paths have to be inside the root
+*/
+void serve(const Options& options)
+{
+	namespace fs = std::filesystem;
+	auto root = fs::weakly_canonical(options.serveRoot.empty() ? fs::current_path() : fs::path(options.serveRoot));
+	struct ResidentSkeleton {
+		std::shared_ptr<const dat::Skeleton> skeleton;
+		fs::file_time_type modified;
+	};
+	std::mutex skeletonsMutex;
+	std::unordered_map<std::string, ResidentSkeleton> skeletons;
+	// read again when the file changed (e.g. by sfsplit --incremental)
+	auto getSkeleton = [&](const std::string& path) {
+		std::error_code ec;
+		auto modified = fs::last_write_time(path, ec);
+		if (ec) {
+			throw std::runtime_error("could not open: " + path);
+		}
+		std::lock_guard<std::mutex> lock(skeletonsMutex);
+		auto it = skeletons.find(path);
+		if (it != skeletons.end() && it->second.modified == modified) {
+			return it->second.skeleton;
+		}
+		auto skeleton = std::make_shared<dat::Skeleton>();
+		read(path, *skeleton);
+		if (skeleton->presets.empty()) {
+			throw std::runtime_error("no presets found in " + path);
+		}
+		skeletons[path] = { skeleton, modified };
+		return std::shared_ptr<const dat::Skeleton>(skeleton);
+	};
+	auto param = [](const server::Request& request, const char* name) {
+		auto it = request.params.find(name);
+		return it != request.params.end() ? it->second : std::string();
+	};
+	// a path of a request resolved against the root, empty if it is outside
+	auto resolve = [&root](const std::string& path) {
+		if (path.empty()) {
+			return std::string();
+		}
+		auto resolved = fs::weakly_canonical(root / path);
+		auto relative = resolved.lexically_relative(root);
+		if (relative.empty() || *relative.begin() == "..") {
+			return std::string();
+		}
+		return resolved.string();
+	};
+	// bank,preset,... with numbers only, nothing of a request becomes an option
+	auto parsePresets = [](const std::string& value, filter::Presets& presets) {
+		std::vector<int> ids;
+		std::stringstream ss(value);
+		std::string id;
+		while (std::getline(ss, id, ',')) {
+			if (id.empty() || id.size() > 5 || !std::all_of(id.begin(), id.end(), [](char c) { return c >= '0' && c <= '9'; })) {
+				return false;
+			}
+			ids.push_back(std::stoi(id));
+		}
+		if (ids.empty() || ids.size() % 2 != 0) {
+			return false;
+		}
+		for (size_t i = 0; i < ids.size(); i += 2) {
+			presets.push_back({ ids[i], ids[i + 1] });
+		}
+		filter::canonicalize(presets);
+		return true;
+	};
+	auto handler = [&](const server::Request& request, server::Response& response) {
+		bool streamed = request.path == "/compose";
+		if (!streamed && request.path != "/getsampleids") {
+			response.send(404, "text/plain", "unknown command " + request.path + "\n");
+			return;
+		}
+		Options requestOptions;
+		std::string error;
+		requestOptions.skeletonPath = resolve(param(request, "skeleton"));
+		if (requestOptions.skeletonPath.empty()) {
+			error = "skeleton missing or outside of the served directory";
+		}
+		if (!parsePresets(param(request, "presets"), requestOptions.filter)) {
+			error = "presets have to be bank,preset,... numbers";
+		}
+		if (streamed) {
+			requestOptions.sampleFolder = resolve(param(request, "samples"));
+			requestOptions.samplePathTemplate = param(request, "template");
+			if (requestOptions.sampleFolder.empty()) {
+				error = "samples missing or outside of the served directory";
+			}
+			if (requestOptions.samplePathTemplate.empty()
+				|| requestOptions.samplePathTemplate.find_first_of("/\\") != std::string::npos) {
+				error = "template has to be a file name prefix";
+			}
+			if (!param(request, "out").empty()) {
+				error = "out is not supported, the soundfont is streamed back";
+			}
+		}
+		else {
+			requestOptions.printIds = true;
+			requestOptions.planFormat = param(request, "plan");
+			if (!requestOptions.planFormat.empty() && requestOptions.planFormat != "json" && requestOptions.planFormat != "binary") {
+				error = "unknown plan format " + requestOptions.planFormat;
+			}
+		}
+		if (!error.empty()) {
+			response.send(400, "text/plain", "options invalid: " + error + "\n");
+			return;
+		}
+		std::stringstream output;
+		requestOptions.output = &output;
+		auto skeleton = getSkeleton(requestOptions.skeletonPath);
+		if (!streamed) {
+			process(requestOptions, skeleton.get());
+			response.send(200, requestOptions.planFormat == "binary" ? "application/octet-stream" : "text/plain", output.str());
+			return;
+		}
+		// buffered in a temporary file, the status depends on the samples found and on the verification
+		requestOptions.outfile = (fs::temp_directory_path()
+			/ ("sfcompose." + std::to_string(std::random_device()()) + ".sf2")).string();
+		try {
+			requestOptions.etag = true;
+			SampleReport report;
+			requestOptions.sampleReport = &report;
+			auto tag = process(requestOptions, skeleton.get());
+			auto verified = verify::soundfontFile(requestOptions.outfile);
+			if (!report.empty()) {
+				// a wrong template or an incomplete sample folder, not a soundfont of silent samples
+				response.send(404, "application/json", "{" + report.jsonFields() + "}\n");
+			}
+			else if (!verified.valid) {
+				response.send(500, "text/plain", std::string("composed soundfont is invalid: ") + verified.error + "\n");
+			}
+			else {
+				response.setHeader("ETag", "\"" + tag.etag + "\"");
+				response.sendFile("application/octet-stream", requestOptions.outfile);
+			}
+		}
+		catch (...) {
+			std::remove(requestOptions.outfile.c_str());
+			throw;
+		}
+		std::remove(requestOptions.outfile.c_str());
+	};
+	int numThreads = options.jobs > 0 ? options.jobs : threads::defaultNumThreads();
+	server::Server sfServer(options.serveAddress, numThreads, handler);
+	if (sharedSampleCache) {
+		sfServer.setStatsExtension([]() {
+			return "\"sampleCache\": " + sharedSampleCache->statsJson();
+		});
+	}
+	std::cerr << "serving " << root.string() << " on " << options.serveAddress << " with " << numThreads << " threads" << std::endl;
+	sfServer.run();
+	*options.output << "{\"latencyMs\": " << sfServer.latencies().json();
+	if (sharedSampleCache) {
+		*options.output << ", \"sampleCache\": " << sharedSampleCache->statsJson();
+	}
+	*options.output << "}" << std::endl;
+}
+
+/*
+	sends random compose and getsampleids requests for the presets
+	of a skeleton to a running server
+*/
+void loadtest(const Options& options)
+{
+	dat::Skeleton skeleton;
+	read(options.skeletonPath, skeleton);
+	if (skeleton.presets.empty()) {
+		throw std::runtime_error("no presets in " + options.skeletonPath);
+	}
+	int numThreads = options.jobs > 0 ? options.jobs : threads::defaultNumThreads();
+	server::LatencyRecorder latencies;
+	std::atomic<int> errors(0);
+	std::atomic<uint64_t> bytesReceived(0);
+	auto startTime = std::chrono::steady_clock::now();
+	threads::parallelFor(options.requests, numThreads, [&](size_t i) {
+		std::mt19937 random((unsigned)i);
+		std::stringstream target;
+		target << ((random() % 10) < 3 ? "/getsampleids" : "/compose")
+			<< "?skeleton=" << server::urlEncode(options.skeletonPath)
+			<< "&samples=" << server::urlEncode(options.sampleFolder)
+			<< "&template=" << server::urlEncode(options.samplePathTemplate)
+			<< "&presets=";
+		int numPresets = 1 + random() % 3;
+		for (int p = 0; p < numPresets; ++p) {
+			const auto& preset = skeleton.presets[random() % skeleton.presets.size()];
+			target << (p > 0 ? "," : "") << preset.bank << "," << preset.preset;
+		}
+		auto requestStart = std::chrono::steady_clock::now();
+		try {
+			auto response = server::get(options.loadtestAddress, target.str());
+			if (response.status != 200) {
+				++errors;
+			}
+			bytesReceived += response.body.size();
+		}
+		catch (const std::exception&) {
+			++errors;
+		}
+		std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - requestStart;
+		latencies.record(duration.count());
+	});
+	std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - startTime;
+	auto serverStats = server::get(options.loadtestAddress, "/stats").body;
+	serverStats.erase(serverStats.find_last_not_of("\n") + 1);
+	const double MB = 1024.0 * 1024.0;
+	*options.output << "{\"requests\": " << options.requests
+		<< ", \"concurrency\": " << numThreads
+		<< ", \"errors\": " << errors
+		<< ", \"seconds\": " << seconds.count()
+		<< ", \"requestsPerSecond\": " << options.requests / seconds.count()
+		<< ", \"MBPerSecond\": " << bytesReceived / MB / seconds.count()
+		<< ", \"latencyMs\": " << latencies.json()
+		<< ", \"server\": " << serverStats
+		<< "}" << std::endl;
 }
 
 void printHelp()
@@ -210,6 +1561,9 @@ extern "C" const char * debug_args(const char* _args)
 	return create_c_str(ss.str());
 }
 
+/*
+	the result has to be released with sfc_free
+*/
 extern "C" const char * composejs(const char* _args)
 {
 	tty = "{\"result\": \"ok\"}";
@@ -227,7 +1581,24 @@ extern "C" const char * composejs(const char* _args)
 		return create_c_str("{\"error\": \"options invalid: " + options.error + " \"}");
 	}
 	try {
-		process(options);
+		if (options.stats) {
+			perf::enablePhases(true);
+			perf::enableAllocStats(options.allocStats);
+		}
+		if (!options.traceFile.empty()) {
+			perf::enableTrace(true);
+		}
+		auto tag = process(options);
+		// hashed only with --etag (or --sha256) in the arguments, as on the command line
+		if (options.etag && !tag.etag.empty()) {
+			tty = "{\"result\": \"ok\", " + tag.jsonFields() + "}";
+		}
+		if (options.stats) {
+			std::cerr << perf::takeStats() << std::endl;
+		}
+		if (!options.traceFile.empty()) {
+			perf::writeTrace(options.traceFile);
+		}
 	} catch(const std::exception &ex) {
 		return create_c_str(ex.what());
 	} catch(...) {
@@ -235,23 +1606,260 @@ extern "C" const char * composejs(const char* _args)
 	}
 	return create_c_str(tty);
 }
-#endif
+#endif
+
+std::string jsonString(const std::string& value)
+{
+	std::string result = "\"";
+	for (char c : value) {
+		if (c == '"' || c == '\\') {
+			result.push_back('\\');
+		}
+		if ((unsigned char)c < 0x20) {
+			result.push_back(' ');
+			continue;
+		}
+		result.push_back(c);
+	}
+	return result + "\"";
+}
+
+struct SfcSession {
+	std::string skeletonPath;
+	dat::Skeleton skeleton;
+	// filters of recently requested preset sets
+	std::map<filter::Presets, filter::Filter> filters;
+	std::mutex mutex;
+
+	filter::Filter getFilter(const int* presets, int presetCount)
+	{
+		if (presetCount < 0) {
+			throw std::runtime_error("preset count is negative");
+		}
+		if (presetCount % 2 != 0) {
+			throw std::runtime_error("preset count is odd");
+		}
+		if (presetCount > 0 && presets == nullptr) {
+			throw std::runtime_error("presets is null");
+		}
+		filter::Presets keep;
+		for (int i = 0; i < presetCount; i += 2) {
+			keep.push_back({ presets[i], presets[i + 1] });
+		}
+		filter::canonicalize(keep);
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = filters.find(keep);
+		if (it != filters.end()) {
+			return it->second;
+		}
+		const size_t MaxFilters = 32;
+		if (filters.size() >= MaxFilters) {
+			filters.clear();
+		}
+		return filters.insert(std::make_pair(keep, createFilter(keep, skeleton))).first->second;
+	}
+};
+
+thread_local std::string sfcLastError;
+
+extern "C" SfcSession* sfc_open(const char* skeletonPath)
+{
+	try {
+		auto session = std::make_unique<SfcSession>();
+		session->skeletonPath = skeletonPath;
+		read(session->skeletonPath, session->skeleton);
+		if (session->skeleton.presets.empty()) {
+			throw std::runtime_error("no presets found in " + session->skeletonPath);
+		}
+		return session.release();
+	}
+	catch (const std::exception& ex) {
+		sfcLastError = ex.what();
+	}
+	return nullptr;
+}
+
+extern "C" void sfc_close(SfcSession* session)
+{
+	delete session;
+}
+
+const char* errorResult(const std::string& error)
+{
+	return create_c_str("{\"error\": " + jsonString(error) + "}");
+}
+
+extern "C" const char* sfc_getpresets(SfcSession* session)
+{
+	if (session == nullptr) {
+		return errorResult("no session");
+	}
+	filter::Presets presets;
+	for (const auto& preset : session->skeleton.presets) {
+		presets.push_back({ preset.bank, preset.preset });
+	}
+	filter::canonicalize(presets);
+	std::stringstream ss;
+	ss << "{\"presets\": [";
+	for (size_t i = 0; i < presets.size(); ++i) {
+		ss << (i > 0 ? ", " : "") << "[" << presets[i].bank << ", " << presets[i].preset << "]";
+	}
+	ss << "]}";
+	return create_c_str(ss.str());
+}
+
+extern "C" const char* sfc_getsampleids(SfcSession* session, const int* presets, int presetCount)
+{
+	if (session == nullptr) {
+		return errorResult("no session");
+	}
+	try {
+		auto filter = session->getFilter(presets, presetCount);
+		std::vector<dat::Id> ids(filter._samplesToKeep.begin(), filter._samplesToKeep.end());
+		std::sort(ids.begin(), ids.end());
+		std::stringstream ss;
+		ss << "{\"sampleIds\": [";
+		for (size_t i = 0; i < ids.size(); ++i) {
+			ss << (i > 0 ? "," : "") << ids[i];
+		}
+		ss << "]}";
+		return create_c_str(ss.str());
+	}
+	catch (const std::exception& ex) {
+		return errorResult(ex.what());
+	}
+}
+
+extern "C" const char* sfc_compose(SfcSession* session, const char* sampleFolder, const char* samplePathTemplate,
+	const char* outfile, const int* presets, int presetCount)
+{
+	if (session == nullptr) {
+		return errorResult("no session");
+	}
+	try {
+		Options options;
+		options.skeletonPath = session->skeletonPath;
+		options.sampleFolder = sampleFolder;
+		options.samplePathTemplate = samplePathTemplate;
+		options.outfile = outfile;
+		SfDb db;
+		db.filter = session->getFilter(presets, presetCount);
+		options.filter = db.filter.keep;
+		db.sampleFolder = options.sampleFolder;
+		db.samplePathTemplate = options.samplePathTemplate;
+		if (db.sampleFolder.empty() || db.sampleFolder.back() != PATH_SEP) {
+			db.sampleFolder.push_back(PATH_SEP);
+		}
+		db.sampleCache = sharedSampleCache.get();
+		db.skeletonPath = session->skeletonPath;
+		SampleReport report;
+		bindSampleChecks(db, session->skeleton, options, &report);
+		options.etag = true;
+		auto tag = compose(options, session->skeleton, db);
+		std::string result = "{\"result\": \"ok\", " + tag.jsonFields();
+		if (!report.empty()) {
+			result += ", " + report.jsonFields();
+		}
+		return create_c_str(result + "}");
+	}
+	catch (const std::exception& ex) {
+		return errorResult(ex.what());
+	}
+}
+
+extern "C" const char* sfc_verify(const char* soundfontPath)
+{
+	try {
+		return create_c_str(verify::soundfontFile(soundfontPath).json());
+	}
+	catch (const std::exception& ex) {
+		return errorResult(ex.what());
+	}
+}
+
+extern "C" void sfc_free(const char* result)
+{
+	delete[] result;
+}
+
+extern "C" const char* sfc_last_error(void)
+{
+	return sfcLastError.c_str();
+}
+
+extern "C" void sfc_enable_stats(int enable)
+{
+	perf::enablePhases(enable != 0);
+}
+
+extern "C" const char* sfc_take_stats(void)
+{
+	return create_c_str(perf::takeStats());
+}
+
+extern "C" void sfc_enable_alloc_stats(int enable)
+{
+	perf::enableAllocStats(enable != 0);
+}
 
-int main(int argc, const char** argv)
+extern "C" void sfc_enable_trace(int enable)
+{
+	perf::enableTrace(enable != 0);
+}
+
+extern "C" const char* sfc_take_trace(void)
+{
+	return create_c_str(perf::takeTrace());
+}
+
+extern "C" int sfc_run(int argc, const char** argv)
 {
-#ifdef __EMSCRIPTEN__
-	return 0;
-#endif
-#if WIN32
-	_CrtSetDbgFlag(_CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF);
-#endif
 	try {
 		Options options = getOptions(argv, argv + argc);
 		if (!options.valid) {
 			printHelp();
 			return -1;
 		}
+		if (options.sampleCacheBudget > 0) {
+			sharedSampleCache = std::make_unique<cache::SampleCache>(options.sampleCacheBudget);
+		}
+		else {
+			// from an earlier run of the same process
+			sharedSampleCache.reset();
+		}
+		if (options.stats) {
+			perf::enablePhases(true);
+			perf::enableAllocStats(options.allocStats);
+			perf::takeStats();
+		}
+		if (!options.traceFile.empty()) {
+			perf::enableTrace(true);
+			perf::takeTrace();
+		}
+		if (!options.serveAddress.empty()) {
+			serve(options);
+			return 0;
+		}
+		if (!options.loadtestAddress.empty()) {
+			loadtest(options);
+			return 0;
+		}
+		if (!options.mergeFile.empty()) {
+			merge(options);
+			return 0;
+		}
+		if (!options.verifyFile.empty()) {
+			auto result = verify::soundfontFile(options.verifyFile);
+			*options.output << result.json() << std::endl;
+			return result.valid ? 0 : 1;
+		}
 		process(options);
+		if (options.stats) {
+			std::cerr << perf::takeStats() << std::endl;
+		}
+		if (!options.traceFile.empty()) {
+			perf::writeTrace(options.traceFile);
+		}
 	}
 	catch (const std::exception& ex) {
 		std::cout << ex.what() << std::endl;
@@ -260,6 +1868,19 @@ int main(int argc, const char** argv)
 	return 0;
 }
 
+#ifndef SFCOMPOSE_LIBRARY
+int main(int argc, const char** argv)
+{
+#ifdef __EMSCRIPTEN__
+	return 0;
+#endif
+#if WIN32
+	_CrtSetDbgFlag(_CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF);
+#endif
+	return sfc_run(argc, argv);
+}
+#endif
+
 template<typename T>
 void readContainer(dat::Container<T>& container, std::fstream& file)
 {
@@ -275,8 +1896,16 @@ void readContainer(dat::Container<T>& container, std::fstream& file)
 
 void read(const std::string& skeletonPath, dat::Skeleton &skeleton)
 {
+	perf::ScopedPhase phase("read");
 	std::fstream file(skeletonPath.c_str(), std::ios_base::in | std::ios_base::binary);
+	perf::count(perf::FileOpens);
+	if (!file.is_open()) {
+		throw std::runtime_error("could not open: " + skeletonPath);
+	}
 	file.read((char*)&skeleton.header, sizeof(dat::SoundFontHeader));
+	if (!file) {
+		throw std::runtime_error("invalid skeleton: " + skeletonPath);
+	}
 	readContainer(skeleton.generators, file);
 	readContainer(skeleton.modulators, file);
 	readContainer(skeleton.presets, file);
@@ -284,19 +1913,112 @@ void read(const std::string& skeletonPath, dat::Skeleton &skeleton)
 	readContainer(skeleton.instrument2Preset, file);
 	readContainer(skeleton.samples, file);
 	readContainer(skeleton.sample2Instruments, file);
+	// missing in older skeletons
+	readContainer(skeleton.sampleChecksums, file);
+}
+
+/*
+	the shards of a preset directory (sfsplit --shards) are next to it: <directoryPath>.<presetId>.
+	a request without presets (--upgrade, --patch) or adding to a soundfont (--extend) needs all of them
+*/
+std::vector<std::string> shardPaths(const Options& options, const dat::Skeleton& directory)
+{
+	filter::Presets presets = options.filter;
+	bool all = options.extend || options.patch || !options.upgradeFrom.empty();
+	if (!options.batchFile.empty()) {
+		for (const auto& job : readBatchJobs(options.batchFile)) {
+			presets.insert(presets.end(), job.presets.begin(), job.presets.end());
+		}
+	}
+	filter::canonicalize(presets);
+	std::vector<std::string> paths;
+	for (const auto& preset : directory.presets) {
+		if (all || std::binary_search(presets.begin(), presets.end(), filter::Preset{ preset.bank, preset.preset })) {
+			paths.push_back(options.skeletonPath + "." + std::to_string(preset.id));
+		}
+	}
+	return paths;
 }
 
+/*
+	the preset directory with the shards of the request merged in. the records of an instrument
+	used by several presets are taken from the first shard, everything is put back into the order
+	of the skeleton (ids and zone ids are the ones of the skeleton), so the compose is the same
+*/
+void readShards(const Options& options, dat::Skeleton& skeleton)
+{
+	perf::ScopedPhase phase("readShards");
+	read(options.skeletonPath, skeleton);
+	std::unordered_set<dat::Id> instruments, samples;
+	for (const auto& path : shardPaths(options, skeleton)) {
+		if (!std::filesystem::exists(path)) {
+			throw std::runtime_error("shard " + path + " not found");
+		}
+		dat::Skeleton shard;
+		read(path, shard);
+		std::unordered_set<dat::Id> newInstruments, newSamples;
+		for (const auto& instrument : shard.instruments) {
+			if (instruments.insert(instrument.id).second) {
+				newInstruments.insert(instrument.id);
+				skeleton.instruments.push_back(instrument);
+			}
+		}
+		for (const auto& sample : shard.samples) {
+			if (samples.insert(sample.id).second) {
+				newSamples.insert(sample.id);
+				skeleton.samples.push_back(sample);
+			}
+		}
+		auto isNew = [&](dat::For for_, dat::Id relatedTo) {
+			return for_ == dat::ForPreset || newInstruments.count(relatedTo) > 0;
+		};
+		for (const auto& generator : shard.generators) {
+			if (isNew(generator.for_, generator.relatedTo)) {
+				skeleton.generators.push_back(generator);
+			}
+		}
+		for (const auto& modulator : shard.modulators) {
+			if (isNew(modulator.for_, modulator.relatedTo)) {
+				skeleton.modulators.push_back(modulator);
+			}
+		}
+		skeleton.instrument2Preset.insert(skeleton.instrument2Preset.end(), shard.instrument2Preset.begin(), shard.instrument2Preset.end());
+		for (const auto& rel : shard.sample2Instruments) {
+			if (newInstruments.count(rel.instrument)) {
+				skeleton.sample2Instruments.push_back(rel);
+			}
+		}
+		for (const auto& checksum : shard.sampleChecksums) {
+			if (newSamples.count(checksum.sample)) {
+				skeleton.sampleChecksums.push_back(checksum);
+			}
+		}
+	}
+	// zone ids grow in skeleton order, a stable sort keeps the order within a zone
+	auto byZone = [](const auto& a, const auto& b) { return a.zone < b.zone; };
+	auto byId = [](const auto& a, const auto& b) { return a.id < b.id; };
+	std::stable_sort(skeleton.generators.begin(), skeleton.generators.end(), byZone);
+	std::stable_sort(skeleton.modulators.begin(), skeleton.modulators.end(), byZone);
+	std::stable_sort(skeleton.instrument2Preset.begin(), skeleton.instrument2Preset.end(), byZone);
+	std::stable_sort(skeleton.sample2Instruments.begin(), skeleton.sample2Instruments.end(), byZone);
+	std::sort(skeleton.instruments.begin(), skeleton.instruments.end(), byId);
+	std::sort(skeleton.samples.begin(), skeleton.samples.end(), byId);
+	std::sort(skeleton.sampleChecksums.begin(), skeleton.sampleChecksums.end(), [](const auto& a, const auto& b) {
+		return a.sample < b.sample;
+	});
+}
 
 void getString(char** dst, const dat::StringType& source) {
 	if (strlen(source) == 0) {
 		*dst = nullptr;
 		return;
 	}
-	*dst = strdup(&source[0]);
+	*dst = perf::dupString(&source[0]);
 }
 
 void writeHeader(const dat::Skeleton& skeleton, SfTools::SoundFont* sf)
 {
+	perf::ScopedPhase phase("writeHeader");
 	const auto header = skeleton.header;
 	sf->version = skeleton.header.version;
 	sf->iver = header.iver;
@@ -313,6 +2035,7 @@ void writeHeader(const dat::Skeleton& skeleton, SfTools::SoundFont* sf)
 
 void writePresets(const dat::Skeleton& skeleton, SfTools::SoundFont* sf, SfDb& db)
 {
+	perf::ScopedPhase phase("writePresets");
 	for (const auto& preset : skeleton.presets)
 	{
 		if (!db.filter.keepPreset(preset.id)) {
@@ -333,6 +2056,7 @@ void writePresets(const dat::Skeleton& skeleton, SfTools::SoundFont* sf, SfDb& d
 
 void writeInstruments(const dat::Skeleton& skeleton, SfTools::SoundFont* sf, SfDb& db)
 {
+	perf::ScopedPhase phase("writeInstruments");
 	for (const auto& instrument : skeleton.instruments)
 	{
 		if (!db.filter.keepInstrument(instrument.id)) {
@@ -349,22 +2073,13 @@ void writeInstruments(const dat::Skeleton& skeleton, SfTools::SoundFont* sf, SfD
 
 void writeSamples(const dat::Skeleton& skeleton, SfTools::SoundFont* sf, SfDb& db)
 {
+	perf::ScopedPhase phase("writeSamples");
 
 	for (const auto& sample : skeleton.samples) {
 		if (!db.filter.keepSample(sample.id)) {
 			continue;
 		}
-		auto sfSample = new SfTools::Sample();
-		getString(&sfSample->name, sample.name);
-		sfSample->start = sample.start;
-		sfSample->end = sample.end;
-		sfSample->loopstart = sample.loopstart;
-		sfSample->loopend = sample.loopend;
-		sfSample->samplerate = sample.samplerate;
-		sfSample->origpitch = sample.origpitch;
-		sfSample->pitchadj = sample.pitchadj;
-		sfSample->sampleLink = sample.sampleLink;
-		sfSample->sampletype = sample.sampletype;
+		auto sfSample = createSample(sample);
 		sf->samples.push_back(sfSample);
 		db.samples.insert(std::make_pair(sample.id, sfSample));
 		db.sampleIndices.insert(std::make_pair(sample.id, sf->samples.size() - 1));
@@ -372,7 +2087,54 @@ void writeSamples(const dat::Skeleton& skeleton, SfTools::SoundFont* sf, SfDb& d
 	}
 }
 
-SfTools::Zone* getPresetZone(dat::Id presetId, dat::Id zoneId, SfTools::SoundFont* sf, SfDb& db)
+SfTools::Sample* createSample(const dat::SampleHeader& sample)
+{
+	auto sfSample = new SfTools::Sample();
+	getString(&sfSample->name, sample.name);
+	sfSample->start = sample.start;
+	sfSample->end = sample.end;
+	sfSample->loopstart = sample.loopstart;
+	sfSample->loopend = sample.loopend;
+	sfSample->samplerate = sample.samplerate;
+	sfSample->origpitch = sample.origpitch;
+	sfSample->pitchadj = sample.pitchadj;
+	sfSample->sampleLink = sample.sampleLink;
+	sfSample->sampletype = sample.sampletype;
+	sfSample->id = sample.id;
+	return sfSample;
+}
+
+/*
+	the sample link of a stereo sample is the id of its partner in the skeleton,
+	it is set to the index of the partner in the soundfont. a sample whose partner
+	is not part of the soundfont is written as a mono sample.
+	called once the samples of the db are in their final order
+*/
+void linkStereoSamples(SfTools::SoundFont* sf, const SfDb& db)
+{
+	std::unordered_map<dat::Id, int> indices;
+	for (int i = 0; i < (int)sf->samples.size(); ++i) {
+		auto headerIt = db.sampleHeaders.find(sf->samples[i]);
+		if (headerIt != db.sampleHeaders.end()) {
+			indices.insert(std::make_pair(headerIt->second->id, i));
+		}
+	}
+	for (auto* sample : sf->samples) {
+		auto headerIt = db.sampleHeaders.find(sample);
+		if (headerIt == db.sampleHeaders.end() || (sample->sampletype & (RightSample | LeftSample | LinkedSample)) == 0) {
+			continue;
+		}
+		auto it = indices.find(headerIt->second->sampleLink);
+		if (it != indices.end()) {
+			sample->sampleLink = it->second;
+			continue;
+		}
+		sample->sampleLink = 0;
+		sample->sampletype = MonoSample | (sample->sampletype & RomSample);
+	}
+}
+
+SfTools::Zone* getPresetZone(dat::Id presetId, dat::Id zoneId, SfDb& db)
 {
 	auto it = db.zones.find(zoneId);
 	if (it != db.zones.end()) {
@@ -384,7 +2146,7 @@ SfTools::Zone* getPresetZone(dat::Id presetId, dat::Id zoneId, SfTools::SoundFon
 	return zone;
 }
 
-SfTools::Zone* getInstrumentZone(dat::Id instrumentId, dat::Id zoneId, SfTools::SoundFont* sf, SfDb& db)
+SfTools::Zone* getInstrumentZone(dat::Id instrumentId, dat::Id zoneId, SfDb& db)
 {
 	auto it = db.zones.find(zoneId);
 	if (it != db.zones.end()) {
@@ -397,8 +2159,9 @@ SfTools::Zone* getInstrumentZone(dat::Id instrumentId, dat::Id zoneId, SfTools::
 }
 
 
-void writeZones(const dat::Skeleton& skeleton, SfTools::SoundFont* sf, SfDb& db)
+void writeZones(const dat::Skeleton& skeleton, SfDb& db)
 {
+	perf::ScopedPhase phase("writeZones");
 	for (const auto& generator : skeleton.generators) {
 		bool keep = generator.for_ == dat::ForInstrument 
 			? db.filter.keepInstrument(generator.relatedTo) : db.filter.keepPreset(generator.relatedTo);
@@ -406,8 +2169,8 @@ void writeZones(const dat::Skeleton& skeleton, SfTools::SoundFont* sf, SfDb& db)
 			continue;
 		}
 		auto zone = generator.for_ == dat::ForInstrument 
-			? getInstrumentZone(generator.relatedTo, generator.zone, sf, db)
-			: getPresetZone(generator.relatedTo, generator.zone, sf, db);
+			? getInstrumentZone(generator.relatedTo, generator.zone, db)
+			: getPresetZone(generator.relatedTo, generator.zone, db);
 		auto sfGen = new SfTools::GeneratorList();
 		sfGen->amount.uword = generator.amount.uword;
 		sfGen->gen = generator.gen;
@@ -420,8 +2183,8 @@ void writeZones(const dat::Skeleton& skeleton, SfTools::SoundFont* sf, SfDb& db)
 		if (!keep) {
 			continue;
 		}
-		auto zone = modulator.for_ == dat::ForInstrument ? getInstrumentZone(modulator.relatedTo, modulator.zone, sf, db)
-			: getPresetZone(modulator.relatedTo, modulator.zone, sf, db);
+		auto zone = modulator.for_ == dat::ForInstrument ? getInstrumentZone(modulator.relatedTo, modulator.zone, db)
+			: getPresetZone(modulator.relatedTo, modulator.zone, db);
 		auto sfMod = new SfTools::ModulatorList();
 		sfMod->amount = modulator.amount;
 		sfMod->dst = modulator.dst;
@@ -430,8 +2193,9 @@ void writeZones(const dat::Skeleton& skeleton, SfTools::SoundFont* sf, SfDb& db)
 	}
 }
 
-void linkInstrumentsToPresets(const dat::Skeleton& skeleton, SfTools::SoundFont* sf, SfDb& db)
+void linkInstrumentsToPresets(const dat::Skeleton& skeleton, SfDb& db)
 {
+	perf::ScopedPhase phase("linkInstrumentsToPresets");
 	for (const auto& rel : skeleton.instrument2Preset) {
 		if (!db.filter.keepInstrument(rel.instrument) || !db.filter.keepPreset(rel.preset)) {
 			continue;
@@ -439,7 +2203,7 @@ void linkInstrumentsToPresets(const dat::Skeleton& skeleton, SfTools::SoundFont*
 		if (db.instrumentIndices.find(rel.instrument) == db.instrumentIndices.end()) {
 			throw std::runtime_error("instrument " + std::to_string(rel.instrument) + " not found");
 		}
-		auto zone = getPresetZone(rel.preset, rel.zone, sf, db);
+		auto zone = getPresetZone(rel.preset, rel.zone, db);
 		auto instrumentIndex = db.instrumentIndices[rel.instrument];
 		auto gen = new SfTools::GeneratorList();
 		gen->gen = ::Gen_Instrument;
@@ -448,8 +2212,9 @@ void linkInstrumentsToPresets(const dat::Skeleton& skeleton, SfTools::SoundFont*
 	}
 }
 
-void linkSamplesToInstruments(const dat::Skeleton& skeleton, SfTools::SoundFont* sf, SfDb& db)
+void linkSamplesToInstruments(const dat::Skeleton& skeleton, SfDb& db)
 {
+	perf::ScopedPhase phase("linkSamplesToInstruments");
 	for (const auto& rel : skeleton.sample2Instruments) {
 		if (!db.filter.keepSample(rel.sample) || !db.filter.keepInstrument(rel.instrument)) {
 			continue;
@@ -457,7 +2222,7 @@ void linkSamplesToInstruments(const dat::Skeleton& skeleton, SfTools::SoundFont*
 		if (db.sampleIndices.find(rel.sample) == db.sampleIndices.end()) {
 			throw std::runtime_error("sample " + std::to_string(rel.sample) + " not found");
 		}
-		auto zone = getInstrumentZone(rel.instrument, rel.zone, sf, db);
+		auto zone = getInstrumentZone(rel.instrument, rel.zone, db);
 		auto sampleIndex = db.sampleIndices[rel.sample];
 		auto gen = new SfTools::GeneratorList();
 		gen->gen = ::Gen_SampleId;
@@ -469,29 +2234,196 @@ void linkSamplesToInstruments(const dat::Skeleton& skeleton, SfTools::SoundFont*
 void readSample(SfTools::Sample* sample, const SfDb& db, short* outBff, int length)
 {
 	auto headerIt = db.sampleHeaders.find(sample);
-	auto byteSize = length * sizeof(short);
 	if (headerIt == db.sampleHeaders.end()) {
 		throw std::runtime_error("sample header not found");
 	}
-	auto header = headerIt->second;
-	auto samplePath = db.sampleFolder + db.samplePathTemplate + std::to_string(header->id) + ".smpl";
+	readSampleData(headerIt->second, db, outBff, length);
+}
+
+std::string samplePath(const dat::SampleHeader* header, const SfDb& db)
+{
+	return db.sampleFolder + db.samplePathTemplate + std::to_string(header->id) + ".smpl";
+}
+
+/*
+	returns false if the sample file does not exist (yet), the data is zeroed then.
+	such a placeholder can be replaced later with --patch
+*/
+bool readSampleData(const dat::SampleHeader* header, const SfDb& db, short* outBff, int length)
+{
+	auto byteSize = length * sizeof(short);
+	perf::ScopedSpan span("readSample", header->id, byteSize, "file");
+	auto samplePath = ::samplePath(header, db);
 	std::fstream file(samplePath.c_str(), std::ios_base::in | std::ios_base::binary);
+	perf::count(perf::FileOpens);
 	auto fsize = file.tellg();
 	file.seekg(0, std::ios_base::end);
 	fsize = file.tellg() - fsize;
 	if (fsize == 0) {
-		// file not found, skip for now
-		return;
+		span.setSource("missing");
+		std::fill(outBff, outBff + length, 0);
+		if (db.sampleReport) {
+			db.sampleReport->addMissing(header->id);
+		}
+		return false;
 	}
-	if (fsize != byteSize) {
-		throw std::runtime_error(samplePath + " file size mismatch expected " + std::to_string(byteSize) + " but was " + std::to_string(fsize));
+	if ((size_t)fsize != byteSize) {
+		rejectSample(header, db, samplePath + " file size mismatch expected " + std::to_string(byteSize) + " but was " + std::to_string(fsize));
+		std::fill(outBff, outBff + length, 0);
+		return false;
 	}
 	file.seekg(0, std::ios_base::beg);
-	file.read((char*)outBff, byteSize);
+	const auto* checksum = findChecksum(db, header->id);
+	uint32_t crc32c = 0;
+	if (!checksum) {
+		file.read((char*)outBff, byteSize);
+	}
+	else {
+		// in chunks, each checksummed while it is still in the cache
+		const size_t ChunkSize = 128 * 1024;
+		for (size_t done = 0; done < byteSize; done += ChunkSize) {
+			auto chunk = std::min(ChunkSize, byteSize - done);
+			file.read((char*)outBff + done, chunk);
+			crc32c = hash::crc32c((const char*)outBff + done, chunk, crc32c);
+		}
+	}
+	perf::count(perf::SamplesRead);
+	perf::count(perf::SampleBytesRead, byteSize);
+	if (checksum && crc32c != checksum->crc32c) {
+		rejectSample(header, db, samplePath + " does not match its checksum");
+		std::fill(outBff, outBff + length, 0);
+		return false;
+	}
+	return true;
+}
+
+const dat::SampleChecksum* findChecksum(const SfDb& db, dat::Id id)
+{
+	if (!db.sampleChecksums) {
+		return nullptr;
+	}
+	auto it = std::lower_bound(db.sampleChecksums->begin(), db.sampleChecksums->end(), id, [](const dat::SampleChecksum& checksum, dat::Id id) {
+		return checksum.sample < id;
+	});
+	return it != db.sampleChecksums->end() && it->sample == id ? &*it : nullptr;
+}
+
+/*
+	a sample file with a wrong size or checksum fails the compose,
+	with --bad-samples zero it is listed and the caller zeroes the sample
+*/
+void rejectSample(const dat::SampleHeader* header, const SfDb& db, const std::string& error)
+{
+	if (!db.zeroBadSamples) {
+		throw std::runtime_error(error);
+	}
+	if (db.sampleReport) {
+		db.sampleReport->addBad(header->id);
+	}
+}
+
+void bindSampleChecks(SfDb& db, const dat::Skeleton& skeleton, const Options& options, SampleReport* report)
+{
+	db.sampleChecksums = &skeleton.sampleChecksums;
+	db.zeroBadSamples = options.zeroBadSamples;
+	db.sampleReport = report;
+}
+
+void SampleReport::addBad(dat::Id id)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	bad.push_back(id);
+}
+
+void SampleReport::addMissing(dat::Id id)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	missing.push_back(id);
+}
+
+bool SampleReport::empty()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return bad.empty() && missing.empty();
+}
+
+std::string SampleReport::jsonFields()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	// a sample may be read twice, through the sample cache and directly
+	for (auto* ids : { &bad, &missing }) {
+		std::sort(ids->begin(), ids->end());
+		ids->erase(std::unique(ids->begin(), ids->end()), ids->end());
+	}
+	std::stringstream ss;
+	for (auto* ids : { &bad, &missing }) {
+		ss << (ids == &bad ? "\"badSamples\": [" : ", \"missingSamples\": [");
+		for (size_t i = 0; i < ids->size(); ++i) {
+			ss << (i > 0 ? ", " : "") << (*ids)[i];
+		}
+		ss << "]";
+	}
+	return ss.str();
+}
+
+SfTools::SampleBuffer getSampleBuffer(SfTools::Sample* sample, const SfDb& db, int length)
+{
+	auto headerIt = db.sampleHeaders.find(sample);
+	if (headerIt == db.sampleHeaders.end()) {
+		throw std::runtime_error("sample header not found");
+	}
+	const auto* header = headerIt->second;
+	// "miss" if neither the pool nor the cache provide the sample, the caller reads it
+	perf::ScopedSpan span("getSampleBuffer", header->id, length * sizeof(short), "miss");
+	if (db.samplePool) {
+		auto it = db.samplePool->find(header->id);
+		if (it != db.samplePool->end()) {
+			span.setSource("pool");
+			return it->second;
+		}
+	}
+	if (!db.sampleCache) {
+		return nullptr;
+	}
+	cache::SampleKey key;
+	key.bytes = length * sizeof(short);
+	if (const auto* checksum = findChecksum(db, header->id)) {
+		key.skeleton = db.skeletonPath;
+		key.sample = header->id;
+		key.crc32c = checksum->crc32c;
+	}
+	else {
+		std::error_code error;
+		key.path = samplePath(header, db);
+		key.bytes = std::filesystem::file_size(key.path, error);
+		std::filesystem::file_time_type modified;
+		if (!error) {
+			modified = std::filesystem::last_write_time(key.path, error);
+		}
+		if (error) {
+			// missing, read (and reported) without the cache
+			span.setSource("missing");
+			return nullptr;
+		}
+		key.modified = (int64_t)modified.time_since_epoch().count();
+	}
+	auto buffer = db.sampleCache->getOrLoad(key, [header, &db, length]() {
+		auto buffer = std::make_shared<std::vector<short>>(length);
+		if (!readSampleData(header, db, buffer->data(), length)) {
+			// not cached, the sample may arrive later
+			return SfTools::SampleBuffer();
+		}
+		return SfTools::SampleBuffer(buffer);
+	});
+	if (buffer) {
+		span.setSource("cache");
+	}
+	return buffer;
 }
 
 filter::Filter createFilter(const filter::Presets& keep, const dat::Skeleton& skeleton)
 {
+	perf::ScopedPhase phase("createFilter");
 	filter::Filter filter;
 	filter.keep = keep;
 	for (const auto& preset : skeleton.presets) {
@@ -519,6 +2451,7 @@ filter::Filter createFilter(const filter::Presets& keep, const dat::Skeleton& sk
 
 void writeZonesSum(SfTools::SoundFont* sf)
 {
+	perf::ScopedPhase phase("writeZonesSum");
 	for (auto* preset : sf->presets) {
 		for (auto* zone : preset->zones) {
 			sf->pZones.push_back(zone);
@@ -532,17 +2465,203 @@ void writeZonesSum(SfTools::SoundFont* sf)
 	}
 }
 
-void printSampleIds(const filter::Filter& filter)
+void printSampleIds(const filter::Filter& filter, std::ostream& output)
+{
+	std::vector<dat::Id> ids(filter._samplesToKeep.begin(), filter._samplesToKeep.end());
+	std::sort(ids.begin(), ids.end());
+	printIds(ids, output);
+}
+
+namespace plan {
+	struct Entry {
+		dat::Id id = dat::Unknown;
+		uint32_t byteSize = 0;
+		int keyLo = 127;
+		int keyHi = 0;
+		double keyWeight = 0;
+		double score = 0;
+		filter::Presets presets;
+	};
+
+	/*
+		how often a key is played: a bell around the middle of the keyboard
+	*/
+	inline double keyWeight(int key)
+	{
+		double x = (key - 60) / 24.0;
+		return std::exp(-x * x);
+	}
+
+	/*
+		little endian, whatever the byte order of the host
+	*/
+	template <class TValue>
+	void writeValue(std::ostream& os, TValue value)
+	{
+		char bytes[sizeof(TValue)];
+		auto bits = (uint64_t)value;
+		for (size_t i = 0; i < sizeof(TValue); ++i) {
+			bytes[i] = (char)((bits >> (i * 8)) & 0xff);
+		}
+		os.write(bytes, sizeof(TValue));
+	}
+
+	/*
+		the binary plan as text, for results which are returned as C strings (wasm)
+	*/
+	std::string base64(const std::string& data)
+	{
+		static const char Digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+		std::string result;
+		result.reserve((data.size() + 2) / 3 * 4);
+		for (size_t i = 0; i < data.size(); i += 3) {
+			uint32_t bits = (uint32_t)(unsigned char)data[i] << 16;
+			if (i + 1 < data.size()) {
+				bits |= (uint32_t)(unsigned char)data[i + 1] << 8;
+			}
+			if (i + 2 < data.size()) {
+				bits |= (uint32_t)(unsigned char)data[i + 2];
+			}
+			result.push_back(Digits[(bits >> 18) & 63]);
+			result.push_back(Digits[(bits >> 12) & 63]);
+			result.push_back(i + 1 < data.size() ? Digits[(bits >> 6) & 63] : '=');
+			result.push_back(i + 2 < data.size() ? Digits[bits & 63] : '=');
+		}
+		return result;
+	}
+}
+
+/*
+	the needed samples with byte size and the presets using them, ordered by priority:
+	samples covering often played keys of many presets with few bytes first.
+	binary (little endian): "SFDP", uint32 version, uint32 count, uint64 totalBytes,
+	then per sample: int32 id, uint32 byteSize, uint8 keyLo, uint8 keyHi, uint16 presetCount,
+	presetCount * (uint16 bank, uint16 preset).
+	the wasm build returns the binary plan base64 encoded, as a C string ends at the first 0 byte
+*/
+void printDownloadPlan(const filter::Filter& filter, const dat::Skeleton& skeleton, const std::string& format, std::ostream& output)
+{
+	std::unordered_map<dat::Id, const dat::Preset*> presets;
+	for (const auto& preset : skeleton.presets) {
+		if (filter.keepPreset(preset.id)) {
+			presets.insert(std::make_pair(preset.id, &preset));
+		}
+	}
+	std::unordered_map<dat::Id, filter::Presets> instrumentPresets;
+	for (const auto& rel : skeleton.instrument2Preset) {
+		auto it = presets.find(rel.preset);
+		if (it != presets.end()) {
+			instrumentPresets[rel.instrument].push_back({ it->second->bank, it->second->preset });
+		}
+	}
+	std::unordered_map<dat::Id, std::pair<int, int>> keyRanges;
+	for (const auto& generator : skeleton.generators) {
+		if (generator.for_ == dat::ForInstrument && generator.gen == Gen_KeyRange && filter.keepInstrument(generator.relatedTo)) {
+			keyRanges[generator.zone] = std::make_pair((int)generator.amount.lo, (int)generator.amount.hi);
+		}
+	}
+	std::unordered_map<dat::Id, plan::Entry> entries;
+	std::unordered_map<dat::Id, std::vector<bool>> keys;
+	for (const auto& rel : skeleton.sample2Instruments) {
+		if (!filter.keepSample(rel.sample) || !filter.keepInstrument(rel.instrument)) {
+			continue;
+		}
+		auto& entry = entries[rel.sample];
+		const auto& usedBy = instrumentPresets[rel.instrument];
+		entry.presets.insert(entry.presets.end(), usedBy.begin(), usedBy.end());
+		auto range = std::make_pair(0, 127);
+		auto rangeIt = keyRanges.find(rel.zone);
+		if (rangeIt != keyRanges.end()) {
+			range = rangeIt->second;
+		}
+		auto& sampleKeys = keys[rel.sample];
+		sampleKeys.resize(128, false);
+		for (int key = range.first; key <= range.second && key < 128; ++key) {
+			sampleKeys[key] = true;
+		}
+		entry.keyLo = std::min(entry.keyLo, range.first);
+		entry.keyHi = std::max(entry.keyHi, range.second);
+	}
+	for (const auto& sample : skeleton.samples) {
+		auto it = entries.find(sample.id);
+		if (it == entries.end()) {
+			continue;
+		}
+		auto& entry = it->second;
+		entry.id = sample.id;
+		entry.byteSize = sample.end > sample.start ? (sample.end - sample.start) * sizeof(short) : 0;
+		filter::canonicalize(entry.presets);
+		const auto& sampleKeys = keys[sample.id];
+		for (int key = 0; key < 128; ++key) {
+			if (sampleKeys[key]) {
+				entry.keyWeight += plan::keyWeight(key);
+			}
+		}
+		entry.score = entry.keyWeight * entry.presets.size() / std::max<uint32_t>(entry.byteSize, 1);
+	}
+	std::vector<const plan::Entry*> ordered;
+	uint64_t totalBytes = 0;
+	for (const auto& it : entries) {
+		ordered.push_back(&it.second);
+		totalBytes += it.second.byteSize;
+	}
+	std::sort(ordered.begin(), ordered.end(), [](const auto* a, const auto* b) {
+		return a->score > b->score || (a->score == b->score && a->id < b->id);
+	});
+
+	std::stringstream os;
+	if (format == "binary") {
+		os.write("SFDP", 4);
+		plan::writeValue<uint32_t>(os, 1);
+		plan::writeValue<uint32_t>(os, (uint32_t)ordered.size());
+		plan::writeValue<uint64_t>(os, totalBytes);
+		for (const auto* entry : ordered) {
+			plan::writeValue<int32_t>(os, entry->id);
+			plan::writeValue<uint32_t>(os, entry->byteSize);
+			plan::writeValue<uint8_t>(os, (uint8_t)entry->keyLo);
+			plan::writeValue<uint8_t>(os, (uint8_t)entry->keyHi);
+			plan::writeValue<uint16_t>(os, (uint16_t)entry->presets.size());
+			for (const auto& preset : entry->presets) {
+				plan::writeValue<uint16_t>(os, (uint16_t)preset.bank);
+				plan::writeValue<uint16_t>(os, (uint16_t)preset.preset);
+			}
+		}
+	}
+	else {
+		os << "{\"samples\": [";
+		for (size_t i = 0; i < ordered.size(); ++i) {
+			const auto* entry = ordered[i];
+			os << (i > 0 ? ", " : "") << "{\"id\": " << entry->id
+				<< ", \"bytes\": " << entry->byteSize
+				<< ", \"keys\": [" << entry->keyLo << ", " << entry->keyHi << "]"
+				<< ", \"priority\": " << i
+				<< ", \"presets\": [";
+			for (size_t j = 0; j < entry->presets.size(); ++j) {
+				os << (j > 0 ? ", " : "") << "[" << entry->presets[j].bank << ", " << entry->presets[j].preset << "]";
+			}
+			os << "]}";
+		}
+		os << "], \"totalSamples\": " << ordered.size() << ", \"totalBytes\": " << totalBytes << "}" << std::endl;
+	}
+#ifdef __EMSCRIPTEN__
+	tty = format == "binary" ? plan::base64(os.str()) : os.str();
+#else
+	output << os.str();
+#endif
+}
+
+template <class TContainer>
+void printIds(const TContainer& ids, std::ostream& output)
 {
 #ifdef __EMSCRIPTEN__
 	std::stringstream ss;
 	auto &os = ss;
 	os << "[";
 #else
-	auto &os = std::cout;
+	auto &os = output;
 #endif
 	bool first = true;
-	for (auto sampleId : filter._samplesToKeep) {
+	for (auto sampleId : ids) {
 		if (first) {
 			os << sampleId;
 			first = false;
@@ -557,11 +2676,6 @@ void printSampleIds(const filter::Filter& filter)
 #endif
 }
 
-//const char* Help = "composes .smpl files and .skeleton to a soundfont file.\n\
-//usage: sfcompose <pathToSkeleton> <pathToSmplFolder> <samplePathTemplate> <outfile> [{bankNumber} {presetNumber} ...]\n\
-//	   to get a list of all needed samples (ids): \n\
-//	   sfcompose <pathToSkeleton> --getsampleids  [{bankNumber} {presetNumber} ...]\n\
-//";
 template <class TIterator>
 Options getOptions(TIterator begin, TIterator end)
 {
@@ -570,12 +2684,186 @@ Options getOptions(TIterator begin, TIterator end)
 	int i = 0;
 	auto it = begin + 1;
 	for (; it < end; ++it) {
-		++i;
 		auto arg = std::string(*it);
 		if (arg == "--getsampleids") {
 			options.printIds = true;
 			continue;
 		}
+		if (arg == "--extend") {
+			if (it + 1 == end) {
+				options.valid = false;
+				options.error += "missing soundfont to extend";
+				return options;
+			}
+			options.extend = true;
+			options.outfile = std::string(*(++it));
+			continue;
+		}
+		if (arg == "--patch") {
+			if (it + 1 == end) {
+				options.valid = false;
+				options.error += "missing soundfont to patch";
+				return options;
+			}
+			options.patch = true;
+			options.outfile = std::string(*(++it));
+			continue;
+		}
+		if (arg == "--layout") {
+			options.layout = true;
+			continue;
+		}
+		if (arg == "--shards") {
+			options.shards = true;
+			continue;
+		}
+		if (arg == "--optimize") {
+			options.optimize = true;
+			continue;
+		}
+		if (arg == "--bad-samples") {
+			if (it + 1 == end) {
+				options.valid = false;
+				options.error += "missing value for " + arg;
+				return options;
+			}
+			auto value = std::string(*(++it));
+			if (value != "fail" && value != "zero") {
+				options.valid = false;
+				options.error += "invalid value for " + arg + ": " + value;
+				return options;
+			}
+			options.zeroBadSamples = value == "zero";
+			continue;
+		}
+		if (arg == "--etag" || arg == "--sha256") {
+			options.etag = true;
+			options.sha256 = options.sha256 || arg == "--sha256";
+			continue;
+		}
+		if (arg == "--stats" || arg == "--alloc-stats") {
+			options.stats = true;
+			options.allocStats = options.allocStats || arg == "--alloc-stats";
+			continue;
+		}
+		if (arg == "--serve" || arg == "--root" || arg == "--loadtest" || arg == "--requests") {
+			if (it + 1 == end) {
+				options.valid = false;
+				options.error += "missing value for " + arg;
+				return options;
+			}
+			auto value = std::string(*(++it));
+			if (arg == "--serve") {
+				options.serveAddress = value;
+			}
+			else if (arg == "--root") {
+				options.serveRoot = value;
+			}
+			else if (arg == "--loadtest") {
+				options.loadtestAddress = value;
+			}
+			else {
+				options.requests = atoi(value.c_str());
+			}
+			continue;
+		}
+		if (arg == "--io" || arg == "--trace") {
+			if (it + 1 == end) {
+				options.valid = false;
+				options.error += "missing value for " + arg;
+				return options;
+			}
+			auto value = std::string(*(++it));
+			if (arg == "--io") {
+				options.ioBackend = value;
+			}
+			else {
+				options.traceFile = value;
+			}
+			continue;
+		}
+		if (arg == "--plan") {
+			if (it + 1 == end) {
+				options.valid = false;
+				options.error += "missing value for " + arg;
+				return options;
+			}
+			options.planFormat = std::string(*(++it));
+			if (options.planFormat != "json" && options.planFormat != "binary") {
+				options.valid = false;
+				options.error += "unknown plan format " + options.planFormat;
+				return options;
+			}
+			continue;
+		}
+		if (arg == "--preview" || arg == "--upgrade") {
+			if (it + 1 == end) {
+				options.valid = false;
+				options.error += "missing value for " + arg;
+				return options;
+			}
+			auto value = std::string(*(++it));
+			if (arg == "--preview") {
+				options.preview = atoi(value.c_str());
+			}
+			else {
+				options.upgradeFrom = value;
+			}
+			continue;
+		}
+		if (arg == "--merge" || arg == "--verify") {
+			if (it + 1 == end) {
+				options.valid = false;
+				options.error += "missing value for " + arg;
+				return options;
+			}
+			auto value = std::string(*(++it));
+			if (arg == "--merge") {
+				options.mergeFile = value;
+			}
+			else {
+				options.verifyFile = value;
+			}
+			continue;
+		}
+		if (arg == "--batch" || arg == "--jobs") {
+			if (it + 1 == end) {
+				options.valid = false;
+				options.error += "missing value for " + arg;
+				return options;
+			}
+			auto value = std::string(*(++it));
+			if (arg == "--batch") {
+				options.batchFile = value;
+			}
+			else {
+				options.jobs = atoi(value.c_str());
+			}
+			continue;
+		}
+		if (arg == "--cache" || arg == "--cache-size" || arg == "--sample-cache") {
+			if (it + 1 == end) {
+				options.valid = false;
+				options.error += "missing value for " + arg;
+				return options;
+			}
+			auto value = std::string(*(++it));
+			if (arg == "--cache") {
+				options.cacheDir = value;
+			}
+			else if (arg == "--sample-cache") {
+				options.sampleCacheBudget = std::stoull(value);
+			}
+			else {
+				options.cacheBudget = std::stoull(value);
+			}
+			continue;
+		}
+		++i;
+		if (i == 1 && !options.mergeFile.empty()) {
+			options.outfile = arg;
+			continue;
+		}
 		if (i == 1 && !options.printIds) {
 			options.skeletonPath = arg;
 			continue;
@@ -588,13 +2876,34 @@ Options getOptions(TIterator begin, TIterator end)
 			options.samplePathTemplate = arg;
 			continue;
 		}
-		if (i == 4 && !options.printIds) {
+		if (i == 4 && !options.printIds && !options.extend && !options.patch && options.batchFile.empty()) {
 			options.outfile = arg;
 			continue;
 		}
 		ids.push_back(atoi(arg.c_str()));
 	}
-	if (ids.empty() || ids.size() % 2 != 0) {
+	if (!options.serveAddress.empty() || !options.verifyFile.empty()) {
+		// the requests contain everything else
+		return options;
+	}
+	if (!options.mergeFile.empty()) {
+		if (options.outfile.empty()) {
+			options.valid = false;
+			options.error += "missing outfile";
+		}
+		return options;
+	}
+	if (options.patch) {
+		options.patchIds = ids;
+		ids.clear();
+		if (options.patchIds.empty()) {
+			options.valid = false;
+			options.error += "no sample ids to patch";
+		}
+	}
+	bool needsPresets = !options.extend && !options.patch && options.batchFile.empty() && options.loadtestAddress.empty() && options.upgradeFrom.empty();
+	bool needsOutfile = !options.printIds && options.batchFile.empty() && options.loadtestAddress.empty();
+	if ((ids.empty() && needsPresets) || ids.size() % 2 != 0) {
 		options.valid = false;
 		options.error += "instrument ids empty or count is odd";
 	}
@@ -610,15 +2919,17 @@ Options getOptions(TIterator begin, TIterator end)
 		options.valid = false;
 		options.error += "missing sample path template";
 	}
-	if (!options.printIds && options.outfile.empty()) {
+	if (needsOutfile && options.outfile.empty()) {
 		options.valid = false;
 		options.error += "missing outfile";
 	}
 	if (!options.valid) {
 		return options;
 	}
-	for (int i = 0; i < ids.size(); i += 2) {
-		options.filter.push_back({ids.at(i), ids.at((int)(i+1))});
+	for (size_t i = 0; i < ids.size(); i += 2) {
+		options.filter.push_back({ids.at(i), ids.at(i + 1)});
 	}
+	// canonical order, the output does not depend on the order of the request
+	filter::canonicalize(options.filter);
 	return options;
 }
\ No newline at end of file
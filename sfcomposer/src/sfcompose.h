@@ -0,0 +1,86 @@
+#ifndef SFCOMPOSE_H
+#define SFCOMPOSE_H
+
+/*
+	C API of sfcompose, exported by the wasm build and available
+	natively by linking the sfcomposelib library.
+
+	a session parses a skeleton once and composes from it as often as needed:
+
+	SfcSession* session = sfc_open("FluidR3_GM.sf2.skeleton");
+	int presets[] = { 0, 0, 0, 16 }; // bank, preset pairs
+	const char* ids = sfc_getsampleids(session, presets, 4); // {"sampleIds": [...]}
+	sfc_free(ids);
+	const char* result = sfc_compose(session, "samples", "FluidR3_GM.sf2.", "out.sf2", presets, 4);
+	sfc_free(result); // {"result": "ok", "etag": "..."} or {"error": "..."}
+	sfc_close(session);
+
+	every returned result has to be released with sfc_free, this includes the result of composejs.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct SfcSession SfcSession;
+
+/*
+	returns NULL if the skeleton can not be read, see sfc_last_error
+*/
+SfcSession* sfc_open(const char* skeletonPath);
+void sfc_close(SfcSession* session);
+/*
+	the bank and preset numbers of the skeleton: {"presets": [[0, 0], [0, 1], ...]}
+*/
+const char* sfc_getpresets(SfcSession* session);
+/*
+	presets: presetCount values, pairs of bank and preset number.
+	the session functions return {"error": "..."} for a null session or an invalid preset list
+*/
+const char* sfc_getsampleids(SfcSession* session, const int* presets, int presetCount);
+/*
+	the etag is the content hash of the written soundfont, see --etag.
+	missing samples are listed as "missingSamples", a sample not matching its checksum fails the compose
+*/
+const char* sfc_compose(SfcSession* session, const char* sampleFolder, const char* samplePathTemplate,
+	const char* outfile, const int* presets, int presetCount);
+/*
+	checks the structure of a soundfont without loading it:
+	{"valid": true} or {"valid": false, "error": "...", "offset": 1234}
+*/
+const char* sfc_verify(const char* soundfontPath);
+void sfc_free(const char* result);
+/*
+	runs sfcompose with command line arguments (argv[0] is the program name),
+	returns the exit code
+*/
+int sfc_run(int argc, const char** argv);
+/*
+	the error of the last failed sfc_open of the calling thread, must not be freed
+*/
+const char* sfc_last_error(void);
+/*
+	records the wall and cpu time of the compose phases and the io counters,
+	sfc_take_stats returns them as json (and resets them), it has to be released with sfc_free
+*/
+void sfc_enable_stats(int enable);
+const char* sfc_take_stats(void);
+/*
+	adds the heap allocations, peak live bytes and largest allocation of every phase to the stats.
+	the library does not replace operator new and delete, only its own string allocations are
+	counted unless the application links perf/allocoperators.cpp. the peaks are process wide,
+	several threads composing at once mix them
+*/
+void sfc_enable_alloc_stats(int enable);
+/*
+	records the phases and every sample read as chrome trace events,
+	sfc_take_trace returns them as json (and removes them), it has to be released with sfc_free
+*/
+void sfc_enable_trace(int enable);
+const char* sfc_take_trace(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
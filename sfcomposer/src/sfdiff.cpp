@@ -0,0 +1,631 @@
+
+const char* const Help = "composes preset sets of the bundled soundfonts with the default pipeline and with every fast path,\n\
+and compares the soundfonts structurally (INFO and pdta records, sample data) and byte for byte.\n\
+usage: sfdiff [--soundfonts <soundfontsFolder>] [--random <n>] [--seed <n>] [--exhaustive] [--jobs <numThreads>] [--out <results.json>]\n\
+	   --random: the number of random preset sets per soundfont (default 20)\n\
+	   --exhaustive: also every single preset of the soundfonts\n\
+	   the paths: jobs (--jobs), uring and pread (--io), samplecache (--sample-cache), session (sfc_compose)\n\
+	   and optimize (--optimize), which is compared by what a synthesizer plays instead of byte for byte\n\
+	   the results with the throughput ratio (default / path) are printed as json, the exit code is 1 on differences";
+
+#include "sfcompose.h"
+#include "io/mappedfile.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <tuple>
+#include <string_view>
+#include <functional>
+#include <algorithm>
+#include <filesystem>
+#include <chrono>
+#include <random>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <cctype>
+
+#ifndef SFBENCH_SOUNDFONTS
+#define SFBENCH_SOUNDFONTS "soundfonts"
+#endif
+
+// sfcomposelib has its own Options
+namespace diff {
+
+struct Options {
+	std::string soundfonts = SFBENCH_SOUNDFONTS;
+	int random = 20;
+	unsigned seed = 1;
+	bool exhaustive = false;
+	int jobs = 4;
+	std::string outfile;
+};
+
+struct PresetSet {
+	std::string name;
+	std::vector<int> presets; // bank, preset pairs
+};
+
+struct Source {
+	std::string soundfont;
+	std::string skeletonPath;
+	std::string folder;
+	std::string samplePathTemplate;
+};
+
+/*
+	an alternate pipeline: extra sfcompose arguments or the session api
+*/
+struct Path {
+	std::string name;
+	std::vector<std::string> args;
+	bool session = false;
+	// compared by compareSemantics only
+	bool semantic = false;
+};
+
+struct Result {
+	std::string soundfont;
+	std::string presets;
+	std::string path;
+	std::string difference;
+	bool identical = false;
+	double seconds = 0;
+	double legacySeconds = 0;
+};
+
+//---------------------------------------------------------
+//   Sf2
+//    the chunks of a soundfont, INFO and pdta sub chunks
+//    are named "INFO/ifil", "pdta/phdr", ...
+//---------------------------------------------------------
+
+struct Sf2 {
+	io::MappedFile file;
+	std::map<std::string, std::pair<const char*, uint32_t>> chunks;
+
+	explicit Sf2(const std::string& path) : file(path)
+	{
+		if (file.size() < 12 || memcmp(file.data(), "RIFF", 4) != 0 || memcmp(file.data() + 8, "sfbk", 4) != 0) {
+			throw std::runtime_error("not a soundfont: " + path);
+		}
+		uint64_t pos = 12;
+		while (pos + 8 <= file.size()) {
+			std::string id(file.data() + pos, 4);
+			uint32_t size = readDword(pos + 4);
+			if (id != "LIST") {
+				chunks[id] = { file.at(pos + 8, size), size };
+				pos += 8 + size + (size & 1);
+				continue;
+			}
+			std::string list(file.at(pos + 8, 4), 4);
+			uint64_t end = pos + 8 + size;
+			for (uint64_t sub = pos + 12; sub + 8 <= end;) {
+				std::string subId(file.data() + sub, 4);
+				uint32_t subSize = readDword(sub + 4);
+				chunks[list == "sdta" ? subId : list + "/" + subId] = { file.at(sub + 8, subSize), subSize };
+				sub += 8 + subSize + (subSize & 1);
+			}
+			pos = end + (size & 1);
+		}
+	}
+	uint32_t readDword(uint64_t pos) const
+	{
+		uint32_t value;
+		memcpy(&value, file.at(pos, 4), 4);
+		return value;
+	}
+};
+
+uint32_t dword(const char* p)
+{
+	uint32_t value;
+	memcpy(&value, p, 4);
+	return value;
+}
+
+/*
+	empty if both soundfonts have the same chunks, records and sample data.
+	the sample offsets may differ, the sample lengths and loops must not
+*/
+std::string compareStructure(const Sf2& legacy, const Sf2& other)
+{
+	const std::map<std::string, uint32_t> recordSizes = {
+		{ "pdta/phdr", 38 }, { "pdta/pbag", 4 }, { "pdta/pmod", 10 }, { "pdta/pgen", 4 },
+		{ "pdta/inst", 22 }, { "pdta/ibag", 4 }, { "pdta/imod", 10 }, { "pdta/igen", 4 }, { "pdta/shdr", 46 }
+	};
+	for (const auto& chunk : legacy.chunks) {
+		auto it = other.chunks.find(chunk.first);
+		if (it == other.chunks.end()) {
+			return "missing chunk " + chunk.first;
+		}
+		if (chunk.first == "smpl" || chunk.first == "sm24") {
+			continue;
+		}
+		auto recordSize = recordSizes.count(chunk.first) ? recordSizes.at(chunk.first) : chunk.second.second;
+		if (chunk.second.second != it->second.second) {
+			return chunk.first + " size " + std::to_string(chunk.second.second) + " != " + std::to_string(it->second.second);
+		}
+		for (uint32_t record = 0; recordSize > 0 && record * recordSize < chunk.second.second; ++record) {
+			const char* a = chunk.second.first + record * recordSize;
+			const char* b = it->second.first + record * recordSize;
+			bool equal = true;
+			if (chunk.first == "pdta/shdr") {
+				// name, then start, end, loops relative to the start, then rate, pitch, link and type
+				equal = memcmp(a, b, 20) == 0 && memcmp(a + 36, b + 36, 10) == 0;
+				for (int field = 24; field <= 32 && equal; field += 4) {
+					equal = dword(a + field) - dword(a + 20) == dword(b + field) - dword(b + 20);
+				}
+			}
+			else {
+				equal = memcmp(a, b, recordSize) == 0;
+			}
+			if (!equal) {
+				return chunk.first + " record " + std::to_string(record) + " differs";
+			}
+		}
+	}
+	if (other.chunks.size() != legacy.chunks.size()) {
+		return "different chunk count";
+	}
+	auto shdr = legacy.chunks.at("pdta/shdr");
+	auto otherShdr = other.chunks.at("pdta/shdr");
+	auto smpl = legacy.chunks.at("smpl");
+	auto otherSmpl = other.chunks.at("smpl");
+	for (uint32_t record = 0; (record + 1) * 46 < shdr.second; ++record) {
+		const char* a = shdr.first + record * 46;
+		const char* b = otherShdr.first + record * 46;
+		uint64_t start = dword(a + 20) * 2ull, end = dword(a + 24) * 2ull;
+		uint64_t otherStart = dword(b + 20) * 2ull;
+		if (end < start || end > smpl.second || otherStart + end - start > otherSmpl.second) {
+			return "sample " + std::to_string(record) + " out of bounds";
+		}
+		if (memcmp(smpl.first + start, otherSmpl.first + otherStart, end - start) != 0) {
+			return "sample " + std::to_string(record) + " data differs";
+		}
+	}
+	return "";
+}
+
+//---------------------------------------------------------
+//   semantics
+//    what a synthesizer plays, without rendering: every zone of a preset
+//    with the global zone merged in and the zones of its instrument, generators
+//    with their default value and modulators adding nothing left out
+//---------------------------------------------------------
+
+namespace semantic {
+	typedef std::pair<const char*, uint32_t> Chunk;
+	const int GenInstrument = 41, GenKeyRange = 43, GenVelRange = 44, GenSampleId = 53;
+
+	inline uint16_t word(const char* p)
+	{
+		uint16_t value;
+		memcpy(&value, p, 2);
+		return value;
+	}
+
+	/*
+		the spec default of an instrument generator, preset generators are offsets (0)
+	*/
+	int defaultAmount(bool preset, int gen)
+	{
+		if (gen == GenKeyRange || gen == GenVelRange) {
+			return 127 << 8;
+		}
+		if (preset) {
+			return 0;
+		}
+		switch (gen) {
+		case 8: return 13500;
+		case 21: case 23: case 25: case 26: case 27: case 28: case 30:
+		case 33: case 34: case 35: case 36: case 38: return (uint16_t)-12000;
+		case 46: case 47: case 58: return (uint16_t)-1;
+		case 56: return 100;
+		default: return 0;
+		}
+	}
+
+	struct Zone {
+		std::map<int, uint16_t> generators;
+		// src, dst, amount source, transform -> amount
+		std::map<std::tuple<int, int, int, int>, int16_t> modulators;
+		int target = -1;
+	};
+
+	struct Level {
+		Chunk headers, bags, modulators, generators;
+		uint32_t recordSize, bagOffset;
+		int terminal;
+		bool preset;
+
+		uint32_t count() const { return headers.second / recordSize - 1; }
+
+		/*
+			the zones played of header i, merged with the global zone and without default values
+		*/
+		std::vector<Zone> zones(uint32_t i) const
+		{
+			const char* header = headers.first + i * recordSize;
+			uint32_t bag = word(header + bagOffset), endBag = word(header + recordSize + bagOffset);
+			std::vector<Zone> result;
+			Zone global;
+			for (; bag < endBag; ++bag) {
+				Zone zone;
+				const char* record = bags.first + bag * 4;
+				for (uint32_t g = word(record); g < word(record + 4); ++g) {
+					const char* gen = generators.first + g * 4;
+					if (word(gen) == terminal) {
+						zone.target = word(gen + 2);
+					}
+					else {
+						zone.generators[word(gen)] = word(gen + 2);
+					}
+				}
+				for (uint32_t m = word(record + 2); m < word(record + 6); ++m) {
+					const char* mod = modulators.first + m * 10;
+					zone.modulators[{ word(mod), word(mod + 2), word(mod + 6), word(mod + 8) }] = (int16_t)word(mod + 4);
+				}
+				if (zone.target < 0) {
+					// a zone without instrument or sample is the global one if it comes first
+					if (result.empty() && bag == word(header + bagOffset)) {
+						global = zone;
+					}
+					continue;
+				}
+				for (const auto& generator : global.generators) {
+					zone.generators.insert(generator);
+				}
+				for (const auto& modulator : global.modulators) {
+					zone.modulators.insert(modulator);
+				}
+				for (auto it = zone.generators.begin(); it != zone.generators.end();) {
+					it = it->second == defaultAmount(preset, it->first) ? zone.generators.erase(it) : std::next(it);
+				}
+				// one with a source may replace a default modulator
+				for (auto it = zone.modulators.begin(); it != zone.modulators.end();) {
+					bool adds = it->second != 0 || (!preset && std::get<0>(it->first) != 0);
+					it = adds ? std::next(it) : zone.modulators.erase(it);
+				}
+				result.push_back(zone);
+			}
+			return result;
+		}
+	};
+
+	std::string describe(const Zone& zone, const std::string& target)
+	{
+		std::stringstream ss;
+		for (const auto& generator : zone.generators) {
+			ss << generator.first << "=" << generator.second << " ";
+		}
+		for (const auto& modulator : zone.modulators) {
+			const auto& key = modulator.first;
+			ss << "m" << std::get<0>(key) << "," << std::get<1>(key) << "," << std::get<2>(key) << "," << std::get<3>(key)
+				<< "=" << modulator.second << " ";
+		}
+		return ss.str() + "-> " + target;
+	}
+
+	/*
+		the zone descriptions sorted, the order of local zones does not matter
+	*/
+	std::string describe(std::vector<std::string> zones)
+	{
+		std::sort(zones.begin(), zones.end());
+		std::string result = "[";
+		for (const auto& zone : zones) {
+			result += zone + "; ";
+		}
+		return result + "]";
+	}
+
+	struct Soundfont {
+		Level presets, instruments;
+		Chunk shdr, smpl;
+
+		explicit Soundfont(const Sf2& sf2)
+		{
+			const auto& chunks = sf2.chunks;
+			presets = { chunks.at("pdta/phdr"), chunks.at("pdta/pbag"), chunks.at("pdta/pmod"), chunks.at("pdta/pgen"), 38, 24, GenInstrument, true };
+			instruments = { chunks.at("pdta/inst"), chunks.at("pdta/ibag"), chunks.at("pdta/imod"), chunks.at("pdta/igen"), 22, 20, GenSampleId, false };
+			shdr = chunks.at("pdta/shdr");
+			smpl = chunks.at("smpl");
+		}
+
+		std::string sample(int i) const
+		{
+			if ((uint32_t)(i + 1) * 46 >= shdr.second) {
+				return "sample out of range";
+			}
+			const char* record = shdr.first + i * 46;
+			uint32_t start = dword(record + 20), end = dword(record + 24);
+			std::stringstream ss;
+			ss << std::string(record, strnlen(record, 20)) << " " << end - start << " " << dword(record + 28) - start
+				<< " " << dword(record + 32) - start << " " << dword(record + 36) << " " << (int)record[40] << " " << (int)record[41]
+				<< " " << word(record + 44);
+			if (end >= start && end * 2ull <= smpl.second) {
+				ss << " " << std::hash<std::string_view>()(std::string_view(smpl.first + start * 2ull, (end - start) * 2ull));
+			}
+			return ss.str();
+		}
+
+		std::string instrument(int i) const
+		{
+			if (i < 0 || (uint32_t)i >= instruments.count()) {
+				return "instrument out of range";
+			}
+			std::vector<std::string> zones;
+			for (const auto& zone : instruments.zones(i)) {
+				zones.push_back(describe(zone, sample(zone.target)));
+			}
+			return describe(zones);
+		}
+
+		// bank:preset -> description
+		std::map<std::string, std::string> describePresets() const
+		{
+			std::map<int, std::string> instrumentCache;
+			std::map<std::string, std::string> result;
+			for (uint32_t i = 0; i < presets.count(); ++i) {
+				const char* header = presets.headers.first + i * 38;
+				std::vector<std::string> zones;
+				for (const auto& zone : presets.zones(i)) {
+					auto it = instrumentCache.find(zone.target);
+					if (it == instrumentCache.end()) {
+						it = instrumentCache.insert({ zone.target, instrument(zone.target) }).first;
+					}
+					zones.push_back(describe(zone, it->second));
+				}
+				std::stringstream ss;
+				ss << std::string(header, strnlen(header, 20)) << " " << dword(header + 26) << " " << dword(header + 30)
+					<< " " << dword(header + 34) << " " << describe(zones);
+				result[std::to_string(word(header + 22)) + ":" + std::to_string(word(header + 20))] = ss.str();
+			}
+			return result;
+		}
+	};
+}
+
+/*
+	empty if a synthesizer plays the same for every preset of both soundfonts,
+	the names of instruments and the layout of the records may differ
+*/
+std::string compareSemantics(const Sf2& legacy, const Sf2& other)
+{
+	auto expected = semantic::Soundfont(legacy).describePresets();
+	auto actual = semantic::Soundfont(other).describePresets();
+	for (const auto& preset : expected) {
+		auto it = actual.find(preset.first);
+		if (it == actual.end()) {
+			return "missing preset " + preset.first;
+		}
+		if (it->second != preset.second) {
+			return "preset " + preset.first + " plays differently";
+		}
+	}
+	if (actual.size() != expected.size()) {
+		return "different preset count";
+	}
+	return "";
+}
+
+bool identical(const Sf2& a, const Sf2& b)
+{
+	return a.file.size() == b.file.size() && memcmp(a.file.data(), b.file.data(), a.file.size()) == 0;
+}
+
+//---------------------------------------------------------
+//   composing
+//---------------------------------------------------------
+
+double compose(const Source& source, const PresetSet& presetSet, const Path* path, const std::string& outfile)
+{
+	std::vector<std::string> args = { "sfcompose", source.skeletonPath, source.folder, source.samplePathTemplate, outfile };
+	for (int id : presetSet.presets) {
+		args.push_back(std::to_string(id));
+	}
+	if (path) {
+		args.insert(args.end(), path->args.begin(), path->args.end());
+	}
+	std::vector<const char*> argv;
+	for (const auto& arg : args) {
+		argv.push_back(arg.c_str());
+	}
+	// the io paths print their statistics
+	std::stringstream discard;
+	auto* coutBuffer = std::cout.rdbuf(discard.rdbuf());
+	auto start = std::chrono::steady_clock::now();
+	int result = 0;
+	if (path && path->session) {
+		SfcSession* session = sfc_open(source.skeletonPath.c_str());
+		if (session) {
+			const char* json = sfc_compose(session, source.folder.c_str(), source.samplePathTemplate.c_str(), outfile.c_str(),
+				presetSet.presets.data(), (int)presetSet.presets.size());
+			result = strstr(json, "\"error\"") ? -1 : 0;
+			sfc_free(json);
+			sfc_close(session);
+		}
+		else {
+			result = -1;
+		}
+	}
+	else {
+		result = sfc_run((int)argv.size(), argv.data());
+	}
+	std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+	std::cout.rdbuf(coutBuffer);
+	if (result != 0) {
+		throw std::runtime_error("compose failed: " + source.soundfont + " " + presetSet.name + (path ? " " + path->name : ""));
+	}
+	return seconds.count();
+}
+
+std::vector<int> presetsOf(const Source& source)
+{
+	SfcSession* session = sfc_open(source.skeletonPath.c_str());
+	if (!session) {
+		throw std::runtime_error(sfc_last_error());
+	}
+	const char* json = sfc_getpresets(session);
+	std::vector<int> presets;
+	for (const char* p = json; *p; ++p) {
+		if (isdigit((unsigned char)*p)) {
+			char* end = nullptr;
+			presets.push_back((int)strtol(p, &end, 10));
+			p = end - 1;
+		}
+	}
+	sfc_free(json);
+	sfc_close(session);
+	return presets;
+}
+
+std::vector<PresetSet> presetSets(const std::vector<int>& all, const Options& options)
+{
+	std::vector<PresetSet> result = { { "all", all } };
+	int numPresets = (int)all.size() / 2;
+	std::mt19937 random(options.seed);
+	for (int i = 0; i < options.random && numPresets > 0; ++i) {
+		PresetSet set = { "random" + std::to_string(i), {} };
+		int count = 1 + random() % std::min(numPresets, 16);
+		for (int j = 0; j < count; ++j) {
+			int preset = random() % numPresets;
+			set.presets.push_back(all[preset * 2]);
+			set.presets.push_back(all[preset * 2 + 1]);
+		}
+		result.push_back(set);
+	}
+	if (options.exhaustive) {
+		for (int i = 0; i < numPresets; ++i) {
+			result.push_back({ std::to_string(all[i * 2]) + ":" + std::to_string(all[i * 2 + 1]), { all[i * 2], all[i * 2 + 1] } });
+		}
+	}
+	return result;
+}
+
+std::string results(const std::vector<Result>& results)
+{
+	std::stringstream os;
+	os << "{\"results\": [";
+	for (size_t i = 0; i < results.size(); ++i) {
+		const auto& result = results[i];
+		os << (i > 0 ? ",\n" : "\n") << "{\"soundfont\": \"" << result.soundfont << "\", \"presets\": \"" << result.presets
+			<< "\", \"path\": \"" << result.path << "\", \"structural\": " << (result.difference.empty() ? "true" : "false")
+			<< ", \"identical\": " << (result.identical ? "true" : "false")
+			<< ", \"legacyMs\": " << result.legacySeconds * 1000.0 << ", \"ms\": " << result.seconds * 1000.0
+			<< ", \"ratio\": " << (result.seconds > 0 ? result.legacySeconds / result.seconds : 0) << "}";
+	}
+	os << "\n]}";
+	return os.str();
+}
+
+Options getOptions(int argc, const char** argv)
+{
+	Options options;
+	for (int i = 1; i < argc; ++i) {
+		auto arg = std::string(argv[i]);
+		if (arg == "--exhaustive") {
+			options.exhaustive = true;
+			continue;
+		}
+		if (i + 1 == argc) {
+			throw std::runtime_error("missing value for " + arg);
+		}
+		auto value = std::string(argv[++i]);
+		if (arg == "--soundfonts") {
+			options.soundfonts = value;
+		}
+		else if (arg == "--random") {
+			options.random = std::max(atoi(value.c_str()), 0);
+		}
+		else if (arg == "--seed") {
+			options.seed = (unsigned)atoi(value.c_str());
+		}
+		else if (arg == "--jobs") {
+			options.jobs = std::max(atoi(value.c_str()), 2);
+		}
+		else if (arg == "--out") {
+			options.outfile = value;
+		}
+		else {
+			throw std::runtime_error("unknown option " + arg);
+		}
+	}
+	return options;
+}
+
+}
+
+int main(int argc, const char** argv)
+{
+	using namespace diff;
+	try {
+		if (argc >= 2 && std::string(argv[1]) == "--help") {
+			std::cout << Help << std::endl;
+			return 0;
+		}
+		auto options = getOptions(argc, argv);
+		auto folder = std::filesystem::temp_directory_path();
+		auto legacyFile = (folder / "sfdiff.legacy.sf2").string();
+		auto otherFile = (folder / "sfdiff.sf2").string();
+		const std::vector<Path> paths = {
+			{ "jobs", { "--jobs", std::to_string(options.jobs) } },
+			{ "uring", { "--io", "uring" } },
+			{ "pread", { "--io", "pread" } },
+			{ "samplecache", { "--sample-cache", std::to_string(256 * 1024 * 1024) } },
+			{ "session", {}, true },
+			{ "optimize", { "--optimize" }, false, true }
+		};
+		std::vector<Result> allResults;
+		int differences = 0;
+		for (const char* soundfont : { "FluidR3_GM", "choriumreva" }) {
+			Source source;
+			source.soundfont = soundfont;
+			source.folder = options.soundfonts + "/" + soundfont;
+			source.samplePathTemplate = std::string(soundfont) + ".sf2.";
+			source.skeletonPath = source.folder + "/" + source.samplePathTemplate + "skeleton";
+			for (const auto& presetSet : presetSets(presetsOf(source), options)) {
+				double legacySeconds = diff::compose(source, presetSet, nullptr, legacyFile);
+				Sf2 legacy(legacyFile);
+				for (const auto& path : paths) {
+					Result result;
+					result.soundfont = soundfont;
+					result.presets = presetSet.name;
+					result.path = path.name;
+					result.legacySeconds = legacySeconds;
+					result.seconds = diff::compose(source, presetSet, &path, otherFile);
+					Sf2 other(otherFile);
+					result.difference = path.semantic ? compareSemantics(legacy, other) : compareStructure(legacy, other);
+					result.identical = identical(legacy, other);
+					if (!result.difference.empty() || (!result.identical && !path.semantic)) {
+						++differences;
+						std::cerr << soundfont << " " << presetSet.name << " " << path.name << ": "
+							<< (result.difference.empty() ? "not byte identical" : result.difference) << std::endl;
+					}
+					allResults.push_back(result);
+				}
+			}
+			std::cerr << soundfont << " done" << std::endl;
+		}
+		std::remove(legacyFile.c_str());
+		std::remove(otherFile.c_str());
+		auto json = results(allResults);
+		std::cout << json << std::endl;
+		if (!options.outfile.empty()) {
+			std::ofstream file(options.outfile.c_str());
+			file << json << std::endl;
+		}
+		std::cerr << allResults.size() << " compared, " << differences << " differences" << std::endl;
+		return differences > 0 ? 1 : 0;
+	}
+	catch (const std::exception& ex) {
+		std::cout << ex.what() << std::endl;
+		return -1;
+	}
+}
@@ -1,7 +1,18 @@
 
 const char * Help ="Extracts the sample data of a soundfont into several files.\n\
 The header data will be saved as a skeleton file.\n\
-usage: sfsplit <pathToSoundfont>";
+usage: sfsplit <pathToSoundfont> [--jobs <numThreads>] [--io <uring|pread>] [--incremental] [--shards] [--optimize] [--stats] [--alloc-stats] [--trace <traceFile>]\n\
+	   --jobs: the number of threads writing the sample files\n\
+	   --io: write the sample files in one batch (io_uring on Linux) and print the io statistics\n\
+	   --incremental: write only samples whose content changed since the last split, and the skeleton only if the headers changed.\n\
+	     the changes are listed in <pathToSoundfont>.changes.json\n\
+	   --shards: also write a preset directory <pathToSoundfont>.presets and one skeleton shard per preset\n\
+	     <pathToSoundfont>.presets.<presetId>, to compose with sfcompose --shards\n\
+	   --optimize: drop redundant generators and modulators and merge identical instruments in the skeleton,\n\
+	     prints the reduction of the skeleton and pdta bytes as json\n\
+	   --stats: print the wall and cpu time of every phase and the io counters as one json line to stderr\n\
+	   --alloc-stats: --stats with the heap allocations, peak live bytes and largest allocation of every phase\n\
+	   --trace: write the phases and every sample file written as chrome trace events (chrome://tracing, ui.perfetto.dev)";
 
 #if WIN32
 #define _CRTDBG_MAP_ALLOC
@@ -12,6 +23,15 @@ usage: sfsplit <pathToSoundfont>";
 #include "dat/dat.h"
 #include "sf3/mydef.h"
 #include "sf3/sfont.h"
+#include "sf3/myfile.h"
+#include "io/batchio.h"
+#include "io/mappedfile.h"
+#include "threads/threadpool.h"
+#include "hash/hash.h"
+#include "hash/crc32c.h"
+#include "optimize/optimize.h"
+#include "perf/stats.h"
+#include "perf/trace.h"
 #include <iostream>
 #include <stdexcept>
 #include <string>
@@ -22,16 +42,58 @@ usage: sfsplit <pathToSoundfont>";
 #include <list>
 #include <set>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
 #include <fstream>
 #include <cstdint>
+#include <chrono>
+#include <sstream>
+#include <cstring>
+#include <cstdio>
+#include <filesystem>
+
+struct Options {
+	std::string sfPath;
+	int jobs = 0;
+	std::string ioBackend;
+	bool incremental = false;
+	bool shards = false;
+	bool optimize = false;
+	bool stats = false;
+	bool allocStats = false;
+	std::string traceFile;
+};
+
+/*
+	the result of an incremental re-split, written to <pathToSoundfont>.changes.json
+*/
+struct SampleChanges {
+	uint64_t unchanged = 0;
+	std::vector<dat::Id> added;
+	std::vector<dat::Id> changed;
+	std::vector<dat::Id> removed;
+	// content hash of the added and changed samples
+	std::map<dat::Id, uint64_t> hashes;
+};
 
 void getHeader(const SfTools::SoundFont* sf, dat::Skeleton& out);
 void getPresets(const SfTools::SoundFont* sf, dat::Skeleton& out);
 void getInstruments(const SfTools::SoundFont* sf, dat::Skeleton& out);
 void getSamples(const SfTools::SoundFont* sf, dat::Skeleton& out);
 void getZones(const QList<SfTools::Zone*> zones, dat::Skeleton& out, dat::For for_, dat::Id id);
+void getSampleChecksums(const SfTools::SoundFont* sf, dat::Skeleton& out, int numThreads);
+std::string serializeSkeleton(const dat::Skeleton& skeleton);
 void writeSkeleton(const dat::Skeleton& skeleton, const std::string& path);
-void writeSamples(const dat::Skeleton& skeleton, const SfTools::SoundFont* sf, const std::string& basePath);
+void writeShards(const dat::Skeleton& skeleton, const std::string& directoryPath);
+void optimizeSkeleton(dat::Skeleton& skeleton);
+bool hasContent(const std::string& path, const std::string& data);
+void writeSamples(const dat::Skeleton& skeleton, const SfTools::SoundFont* sf, const std::string& basePath, int numThreads);
+void writeSamplesBatched(const dat::Skeleton& skeleton, const SfTools::SoundFont* sf, const std::string& basePath, const std::string& ioBackend);
+std::string samplePath(const std::string& basePath, const dat::SampleHeader& sampleHeader);
+SampleChanges writeSamplesIncremental(const dat::Skeleton& skeleton, const SfTools::SoundFont* sf, const std::string& basePath, int numThreads);
+void removeSamples(const dat::Skeleton& skeleton, const std::string& basePath, SampleChanges& changes);
+void writeChanges(const SampleChanges& changes, const std::string& basePath, bool skeletonChanged);
+void writeAtomically(const std::string& path, const char* data, uint64_t byteSize);
 
 int zoneIdCounter = -1;
 
@@ -46,36 +108,62 @@ void getString(char* str, dat::StringType &dst) {
 	if (str == nullptr) {
 		return;
 	}
-	memcpy(&dst[0], str, dat::StringLength - 1);
+	strncpy(&dst[0], str, dat::StringLength - 1);
 	dst[dat::StringLength - 1] = 0;
 }
 
-void static _printInstument(SfTools::Instrument* i)
+void process(const Options& options)
 {
-	std::cout << i->name << std::endl;
-	std::cout << i->zones.size() << std::endl;
-	for (auto z : i->zones) {
-		for (auto g : z->generators)
-		{
-			std::cout << g->gen << ":" << g->amount.uword << std::endl;
+	perf::ScopedPhase phase("process");
+	const auto& sfPath = options.sfPath;
+	std::unique_ptr<SfTools::SoundFont> sf;
+	{
+		perf::ScopedPhase readPhase("read");
+		sf = load(sfPath);
+	}
+	dat::Skeleton skeleton;
+	{
+		perf::ScopedPhase skeletonPhase("createSkeleton");
+		getHeader(sf.get(), skeleton);
+		getPresets(sf.get(), skeleton);
+		getInstruments(sf.get(), skeleton);
+		getSamples(sf.get(), skeleton);
+	}
+	int numThreads = options.jobs > 0 ? options.jobs : threads::defaultNumThreads();
+	getSampleChecksums(sf.get(), skeleton, numThreads);
+	if (options.optimize) {
+		optimizeSkeleton(skeleton);
+	}
+	if (options.incremental) {
+		auto skeletonPath = sfPath + ".skeleton";
+		auto data = serializeSkeleton(skeleton);
+		// the records have no padding, so equal bytes are equal headers
+		bool skeletonChanged = !hasContent(skeletonPath, data);
+		// the samples first and the skeleton last, so that a reader of the new skeleton finds
+		// its samples. the samples only the old skeleton has are removed once it is replaced.
+		// shards are checked even if the skeleton is the same, they may be missing or out of date
+		auto changes = writeSamplesIncremental(skeleton, sf.get(), sfPath, numThreads);
+		if (options.shards) {
+			writeShards(skeleton, sfPath + ".presets");
 		}
-		for (auto g : z->modulators)
-		{
-			std::cout << g->dst << ":" << g->amount << std::endl;
+		if (skeletonChanged) {
+			perf::ScopedPhase skeletonPhase("writeSkeleton");
+			writeAtomically(skeletonPath, data.data(), data.size());
 		}
+		removeSamples(skeleton, sfPath, changes);
+		writeChanges(changes, sfPath, skeletonChanged);
+		return;
 	}
-}
-
-void process(const std::string& sfPath)
-{
-	auto sf = load(sfPath);
-	dat::Skeleton skeleton;
-	getHeader(sf.get(), skeleton);
-	getPresets(sf.get(), skeleton);
-	getInstruments(sf.get(), skeleton);
-	getSamples(sf.get(), skeleton);
 	writeSkeleton(skeleton, sfPath + ".skeleton");
-	writeSamples(skeleton, sf.get(), sfPath);
+	if (options.shards) {
+		writeShards(skeleton, sfPath + ".presets");
+	}
+	if (options.ioBackend.empty()) {
+		writeSamples(skeleton, sf.get(), sfPath, numThreads);
+	}
+	else {
+		writeSamplesBatched(skeleton, sf.get(), sfPath, options.ioBackend);
+	}
 }
 
 void printHelp() 
@@ -96,7 +184,53 @@ int main(int argc, const char** argv)
 			printHelp();
 			return 0;
 		}
-		process(argv[1]);
+		Options options;
+		options.sfPath = argv[1];
+		for (int i = 2; i < argc; ++i) {
+			auto arg = std::string(argv[i]);
+			if (arg == "--incremental") {
+				options.incremental = true;
+				continue;
+			}
+			if (arg == "--shards") {
+				options.shards = true;
+				continue;
+			}
+			if (arg == "--optimize") {
+				options.optimize = true;
+				continue;
+			}
+			if (arg == "--stats" || arg == "--alloc-stats") {
+				options.stats = true;
+				options.allocStats = options.allocStats || arg == "--alloc-stats";
+				continue;
+			}
+			if (i + 1 == argc) {
+				throw std::runtime_error("missing value for " + arg);
+			}
+			if (arg == "--jobs") {
+				options.jobs = atoi(argv[++i]);
+			}
+			else if (arg == "--io") {
+				options.ioBackend = argv[++i];
+			}
+			else if (arg == "--trace") {
+				options.traceFile = argv[++i];
+			}
+			else {
+				throw std::runtime_error("unknown option " + arg);
+			}
+		}
+		perf::enablePhases(options.stats);
+		perf::enableAllocStats(options.allocStats);
+		perf::enableTrace(!options.traceFile.empty());
+		process(options);
+		if (options.stats) {
+			std::cerr << perf::takeStats() << std::endl;
+		}
+		if (!options.traceFile.empty()) {
+			perf::writeTrace(options.traceFile);
+		}
 	} catch (const std::exception& ex) {
 		std::cout << ex.what() << std::endl;
 		return -1;
@@ -171,6 +305,27 @@ void getSamples(const SfTools::SoundFont* sf, dat::Skeleton& out)
 	}
 }
 
+/*
+	the checksum of every sample file, verified by sfcompose when it reads the file
+*/
+void getSampleChecksums(const SfTools::SoundFont* sf, dat::Skeleton& out, int numThreads)
+{
+	perf::ScopedPhase phase("sampleChecksums");
+	io::MappedFile infile(sf->path);
+	out.sampleChecksums.resize(out.samples.size());
+	threads::parallelFor(out.samples.size(), numThreads, [&](size_t i) {
+		const auto& sampleHeader = out.samples[i];
+		auto& checksum = out.sampleChecksums[i];
+		checksum.sample = sampleHeader.id;
+		if (sampleHeader.end <= sampleHeader.start) {
+			return;
+		}
+		uint64_t byteSize = sizeof(short) * (sampleHeader.end - sampleHeader.start);
+		const char* data = infile.at(static_cast<uint64_t>(sf->samplePos) + (sampleHeader.start * sizeof(short)), byteSize);
+		checksum.crc32c = hash::crc32c(data, byteSize);
+	});
+}
+
 void getZones(const QList<SfTools::Zone*> zones, dat::Skeleton& out, dat::For for_, dat::Id id)
 {
 	for (const auto* zone : zones) {
@@ -201,7 +356,7 @@ void getZones(const QList<SfTools::Zone*> zones, dat::Skeleton& out, dat::For fo
 			out.generators.push_back(outGenerator);
 		}
 		for (const auto* modulator : zone->modulators) {
-			dat::Modulator outModulator;
+			dat::Modulator outModulator = dat::Modulator();
 			outModulator.relatedTo = id;
 			outModulator.for_ = for_;
 			outModulator.amount = modulator->amount;
@@ -213,7 +368,7 @@ void getZones(const QList<SfTools::Zone*> zones, dat::Skeleton& out, dat::For fo
 }
 
 template<class TContainer>
-void writeContainer(const TContainer& container, std::fstream &file)
+void writeContainer(const TContainer& container, std::ostream &file)
 {
 	uint64_t byteSize = sizeof(typename TContainer::value_type) * container.size();
 	file.write(reinterpret_cast<char*>(&byteSize), sizeof(uint64_t));
@@ -223,9 +378,9 @@ void writeContainer(const TContainer& container, std::fstream &file)
 	file.write((const char*)container.data(), byteSize);
 }
 
-void writeSkeleton(const dat::Skeleton& skeleton, const std::string& path)
+std::string serializeSkeleton(const dat::Skeleton& skeleton)
 {
-	std::fstream file(path.c_str(), std::ios_base::out | std::ios::binary);
+	std::stringstream file(std::ios_base::out | std::ios::binary);
 	file.write((const char*)&skeleton.header, sizeof(dat::SoundFontHeader));
 	writeContainer(skeleton.generators, file);
 	writeContainer(skeleton.modulators, file);
@@ -234,21 +389,342 @@ void writeSkeleton(const dat::Skeleton& skeleton, const std::string& path)
 	writeContainer(skeleton.instrument2Preset, file);
 	writeContainer(skeleton.samples, file);
 	writeContainer(skeleton.sample2Instruments, file);
+	writeContainer(skeleton.sampleChecksums, file);
+	return file.str();
+}
+
+void writeSkeleton(const dat::Skeleton& skeleton, const std::string& path)
+{
+	perf::ScopedPhase phase("writeSkeleton");
+	auto data = serializeSkeleton(skeleton);
+	std::fstream file(path.c_str(), std::ios_base::out | std::ios::binary);
+	file.write(data.data(), data.size());
+	perf::count(perf::FileOpens);
+	perf::count(perf::WriteCalls);
+	perf::count(perf::BytesWritten, data.size());
+}
+
+void optimizeSkeleton(dat::Skeleton& skeleton)
+{
+	perf::ScopedPhase phase("optimize");
+	auto skeletonBytes = serializeSkeleton(skeleton).size();
+	auto pdtaBytes = optimize::pdtaBytes(skeleton);
+	auto reduction = optimize::skeleton(skeleton);
+	std::cout << "{\"skeletonBytes\": " << skeletonBytes << ", \"optimizedSkeletonBytes\": " << serializeSkeleton(skeleton).size()
+		<< ", \"pdtaBytes\": " << pdtaBytes << ", \"optimizedPdtaBytes\": " << optimize::pdtaBytes(skeleton)
+		<< ", " << reduction.jsonFields() << "}" << std::endl;
 }
 
-void writeSamples(const dat::Skeleton& skeleton, const SfTools::SoundFont* sf, const std::string& basePath)
+/*
+	the directory is a skeleton with the header and the presets only,
+	the shard of a preset holds its zones, instruments and sample headers.
+	all records keep their ids and their order in the skeleton, so that
+	sfcompose can merge the shards of a request back into a skeleton.
+	only missing and changed files are written, the directory last,
+	shards of presets which no longer exist are removed. the records have
+	no undefined bytes (see dat.h), a re-split of the same soundfont writes none
+*/
+void writeShards(const dat::Skeleton& skeleton, const std::string& directoryPath)
 {
+	perf::ScopedPhase phase("writeShards");
+	uint64_t written = 0;
+	auto writeIfChanged = [&written](const std::string& path, const std::string& data) {
+		if (!hasContent(path, data)) {
+			writeAtomically(path, data.data(), data.size());
+			++written;
+		}
+	};
+	std::string data;
+
+	std::unordered_map<dat::Id, std::vector<dat::Id>> instrumentsOfPreset;
+	for (const auto& rel : skeleton.instrument2Preset) {
+		instrumentsOfPreset[rel.preset].push_back(rel.instrument);
+	}
+	std::unordered_map<dat::Id, std::vector<dat::Id>> samplesOfInstrument;
+	for (const auto& rel : skeleton.sample2Instruments) {
+		samplesOfInstrument[rel.instrument].push_back(rel.sample);
+	}
+	uint64_t shardBytes = 0, largestShard = 0;
+	for (const auto& preset : skeleton.presets) {
+		std::unordered_set<dat::Id> instruments(instrumentsOfPreset[preset.id].begin(), instrumentsOfPreset[preset.id].end());
+		std::unordered_set<dat::Id> samples;
+		for (auto instrument : instruments) {
+			samples.insert(samplesOfInstrument[instrument].begin(), samplesOfInstrument[instrument].end());
+		}
+		auto inShard = [&](dat::For for_, dat::Id relatedTo) {
+			return for_ == dat::ForPreset ? relatedTo == preset.id : instruments.count(relatedTo) > 0;
+		};
+		dat::Skeleton shard;
+		for (const auto& generator : skeleton.generators) {
+			if (inShard(generator.for_, generator.relatedTo)) {
+				shard.generators.push_back(generator);
+			}
+		}
+		for (const auto& modulator : skeleton.modulators) {
+			if (inShard(modulator.for_, modulator.relatedTo)) {
+				shard.modulators.push_back(modulator);
+			}
+		}
+		for (const auto& instrument : skeleton.instruments) {
+			if (instruments.count(instrument.id)) {
+				shard.instruments.push_back(instrument);
+			}
+		}
+		for (const auto& rel : skeleton.instrument2Preset) {
+			if (rel.preset == preset.id) {
+				shard.instrument2Preset.push_back(rel);
+			}
+		}
+		for (const auto& sample : skeleton.samples) {
+			if (samples.count(sample.id)) {
+				shard.samples.push_back(sample);
+			}
+		}
+		for (const auto& rel : skeleton.sample2Instruments) {
+			if (instruments.count(rel.instrument)) {
+				shard.sample2Instruments.push_back(rel);
+			}
+		}
+		for (const auto& checksum : skeleton.sampleChecksums) {
+			if (samples.count(checksum.sample)) {
+				shard.sampleChecksums.push_back(checksum);
+			}
+		}
+		data = serializeSkeleton(shard);
+		writeIfChanged(directoryPath + "." + std::to_string(preset.id), data);
+		shardBytes += data.size();
+		largestShard = std::max<uint64_t>(largestShard, data.size());
+	}
+	dat::Skeleton directory;
+	directory.header = skeleton.header;
+	directory.presets = skeleton.presets;
+	data = serializeSkeleton(directory);
+	writeIfChanged(directoryPath, data);
+	// preset ids are consecutive, the old directory may still have referred to these
+	for (dat::Id id = (dat::Id)skeleton.presets.size();; ++id) {
+		auto path = directoryPath + "." + std::to_string(id);
+		if (std::remove(path.c_str()) != 0) {
+			break;
+		}
+	}
+	std::cout << "shards: " << skeleton.presets.size() << " presets, directory " << data.size() << " bytes, shards "
+		<< shardBytes << " bytes (largest " << largestShard << "), " << written << " files written" << std::endl;
+}
+
+/*
+	true if the file exists with exactly this content
+*/
+bool hasContent(const std::string& path, const std::string& data)
+{
+	std::fstream existing(path.c_str(), std::ios_base::in | std::ios::binary);
+	if (!existing.is_open()) {
+		return false;
+	}
+	std::stringstream content;
+	content << existing.rdbuf();
+	return content.str() == data;
+}
+
+void writeSamples(const dat::Skeleton& skeleton, const SfTools::SoundFont* sf, const std::string& basePath, int numThreads)
+{
+	perf::ScopedPhase phase("writeSamples");
+	auto startTime = std::chrono::steady_clock::now();
+	io::MappedFile infile(sf->path);
 	for (const auto& sampleHeader : skeleton.samples) {
 		if (sampleHeader.start >= sampleHeader.end) {
 			throw std::runtime_error("invalid sample length");
 		}
-		auto path = basePath + "." + std::to_string(sampleHeader.id) + ".smpl";
+	}
+	std::vector<uint64_t> written(skeleton.samples.size());
+	threads::parallelFor(skeleton.samples.size(), numThreads, [&](size_t i) {
+		const auto& sampleHeader = skeleton.samples[i];
+		auto path = samplePath(basePath, sampleHeader);
 		uint64_t byteSize = sizeof(short) * (sampleHeader.end - sampleHeader.start);
-		std::vector<char> bff(byteSize);
+		perf::ScopedSpan span("writeSample", sampleHeader.id, byteSize, "mapped");
+		const char* data = infile.at(static_cast<uint64_t>(sf->samplePos) + (sampleHeader.start * sizeof(short)), byteSize);
 		std::fstream outfile(path.c_str(), std::ios_base::out | std::ios::binary);
-		std::fstream infile(sf->path.c_str(), std::ios_base::in | std::ios::binary);
-		infile.seekg(static_cast<uint64_t>(sf->samplePos) + (sampleHeader.start * sizeof(short)));
-		infile.read(bff.data(), byteSize);
-		outfile.write(bff.data(), byteSize);
+		outfile.write(data, byteSize);
+		if (!outfile) {
+			throw std::runtime_error("could not write " + path);
+		}
+		perf::count(perf::SamplesRead);
+		perf::count(perf::SampleBytesRead, byteSize);
+		perf::count(perf::FileOpens);
+		perf::count(perf::WriteCalls);
+		perf::count(perf::BytesWritten, byteSize);
+		written[i] = byteSize;
+	});
+	std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - startTime;
+	uint64_t bytesWritten = 0;
+	for (auto size : written) {
+		bytesWritten += size;
+	}
+	const double MB = 1024.0 * 1024.0;
+	std::cout << "split: " << skeleton.samples.size() << " samples, "
+		<< bytesWritten / MB << " MB written in " << seconds.count() << " s ("
+		<< bytesWritten / MB / seconds.count() << " MB/s), "
+		<< numThreads << " threads" << std::endl;
+}
+
+std::string samplePath(const std::string& basePath, const dat::SampleHeader& sampleHeader)
+{
+	return basePath + "." + std::to_string(sampleHeader.id) + ".smpl";
+}
+
+/*
+	the soundfont is opened once, the sample files are created,
+	written and closed with one batch of io operations
+*/
+void writeSamplesBatched(const dat::Skeleton& skeleton, const SfTools::SoundFont* sf, const std::string& basePath, const std::string& ioBackend)
+{
+	perf::ScopedPhase phase("writeSamples");
+	MyFile infile(sf->path);
+	if (!infile.open(MyFile::ReadOnly)) {
+		throw std::runtime_error("could not open " + sf->path);
+	}
+	std::vector<io::CopyJob> jobs;
+	jobs.reserve(skeleton.samples.size());
+	for (const auto& sampleHeader : skeleton.samples) {
+		if (sampleHeader.start >= sampleHeader.end) {
+			throw std::runtime_error("invalid sample length");
+		}
+		io::CopyJob job;
+		job.srcFd = infile.handle();
+		job.srcOffset = static_cast<uint64_t>(sf->samplePos) + (sampleHeader.start * sizeof(short));
+		job.dstPath = samplePath(basePath, sampleHeader);
+		job.length = sizeof(short) * (sampleHeader.end - sampleHeader.start);
+		jobs.push_back(job);
+	}
+	io::IoOptions ioOptions;
+	ioOptions.backend = io::parseBackend(ioBackend);
+	auto stats = io::copy(jobs, ioOptions);
+	infile.close();
+	perf::count(perf::SamplesRead, jobs.size());
+	perf::count(perf::SampleBytesRead, stats.bytesRead);
+	perf::count(perf::FileOpens, stats.files);
+	perf::count(perf::BytesWritten, stats.bytesWritten);
+	std::cout << stats.json() << std::endl;
+}
+
+/*
+	writes a temporary file next to the target and renames it,
+	readers see either the old or the new content
+*/
+void writeAtomically(const std::string& path, const char* data, uint64_t byteSize)
+{
+	auto tempPath = path + ".tmp";
+	{
+		std::fstream outfile(tempPath.c_str(), std::ios_base::out | std::ios::binary);
+		outfile.write(data, byteSize);
+		perf::count(perf::FileOpens);
+		perf::count(perf::WriteCalls);
+		perf::count(perf::BytesWritten, byteSize);
+		if (!outfile) {
+			std::remove(tempPath.c_str());
+			throw std::runtime_error("could not write " + tempPath);
+		}
 	}
-}
\ No newline at end of file
+	if (std::rename(tempPath.c_str(), path.c_str()) != 0) {
+		std::remove(tempPath.c_str());
+		throw std::runtime_error("could not rename " + tempPath);
+	}
+}
+
+template<class TContainer>
+void writeIds(const std::string& name, const TContainer& ids, std::ostream& os)
+{
+	os << "\"" << name << "\": [";
+	for (size_t i = 0; i < ids.size(); ++i) {
+		os << (i > 0 ? ", " : "") << ids[i];
+	}
+	os << "]";
+}
+
+/*
+	compares the content hash of every sample with the existing sample file,
+	only new and changed samples are written
+*/
+SampleChanges writeSamplesIncremental(const dat::Skeleton& skeleton, const SfTools::SoundFont* sf, const std::string& basePath, int numThreads)
+{
+	perf::ScopedPhase phase("writeSamples");
+	enum State { Unchanged, Added, Changed };
+	io::MappedFile infile(sf->path);
+	for (const auto& sampleHeader : skeleton.samples) {
+		if (sampleHeader.start >= sampleHeader.end) {
+			throw std::runtime_error("invalid sample length");
+		}
+	}
+	std::vector<State> states(skeleton.samples.size(), Unchanged);
+	std::vector<uint64_t> hashes(skeleton.samples.size());
+	threads::parallelFor(skeleton.samples.size(), numThreads, [&](size_t i) {
+		const auto& sampleHeader = skeleton.samples[i];
+		auto path = samplePath(basePath, sampleHeader);
+		uint64_t byteSize = sizeof(short) * (sampleHeader.end - sampleHeader.start);
+		perf::ScopedSpan span("compareSample", sampleHeader.id, byteSize, "mapped");
+		const char* data = infile.at(static_cast<uint64_t>(sf->samplePos) + (sampleHeader.start * sizeof(short)), byteSize);
+		hashes[i] = hash::xxh64(data, byteSize);
+		perf::count(perf::SamplesRead);
+		perf::count(perf::SampleBytesRead, byteSize);
+		std::error_code error;
+		auto existingSize = std::filesystem::file_size(path, error);
+		if (error) {
+			states[i] = Added;
+		}
+		else if (existingSize != byteSize || hash::xxh64File(path) != hashes[i]) {
+			states[i] = Changed;
+		}
+		if (states[i] != Unchanged) {
+			writeAtomically(path, data, byteSize);
+		}
+	});
+	SampleChanges changes;
+	for (size_t i = 0; i < states.size(); ++i) {
+		auto id = skeleton.samples[i].id;
+		if (states[i] == Unchanged) {
+			++changes.unchanged;
+			continue;
+		}
+		(states[i] == Added ? changes.added : changes.changed).push_back(id);
+		changes.hashes[id] = hashes[i];
+	}
+	return changes;
+}
+
+/*
+	sample ids are consecutive, the files beyond the last sample are removed
+*/
+void removeSamples(const dat::Skeleton& skeleton, const std::string& basePath, SampleChanges& changes)
+{
+	for (dat::Id id = (dat::Id)skeleton.samples.size();; ++id) {
+		dat::SampleHeader header;
+		header.id = id;
+		auto path = samplePath(basePath, header);
+		if (std::remove(path.c_str()) != 0) {
+			break;
+		}
+		changes.removed.push_back(id);
+	}
+}
+
+void writeChanges(const SampleChanges& changes, const std::string& basePath, bool skeletonChanged)
+{
+	std::stringstream manifest;
+	manifest << "{\"skeletonChanged\": " << (skeletonChanged ? "true" : "false")
+		<< ", \"unchanged\": " << changes.unchanged << ", ";
+	writeIds("added", changes.added, manifest);
+	manifest << ", ";
+	writeIds("changed", changes.changed, manifest);
+	manifest << ", ";
+	writeIds("removed", changes.removed, manifest);
+	manifest << ", \"hashes\": {";
+	bool first = true;
+	for (const auto& hash : changes.hashes) {
+		manifest << (first ? "" : ", ") << "\"" << hash.first << "\": \"" << hash::toHex(hash.second) << "\"";
+		first = false;
+	}
+	manifest << "}}";
+	auto manifestData = manifest.str();
+	writeAtomically(basePath + ".changes.json", manifestData.data(), manifestData.size());
+	std::cout << "incremental split: " << changes.added.size() << " added, " << changes.changed.size() << " changed, "
+		<< changes.removed.size() << " removed, skeleton " << (skeletonChanged ? "changed" : "unchanged") << std::endl;
+}
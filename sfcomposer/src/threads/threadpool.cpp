@@ -0,0 +1,96 @@
+#include "threadpool.h"
+
+namespace threads {
+
+	ThreadPool::ThreadPool(int numThreads)
+	{
+		if (numThreads < 2) {
+			return;
+		}
+		for (int i = 0; i < numThreads; ++i) {
+			_workers.emplace_back(&ThreadPool::work, this);
+		}
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stop = true;
+		}
+		_taskAvailable.notify_all();
+		for (auto& worker : _workers) {
+			worker.join();
+		}
+	}
+
+	void ThreadPool::execute(Task& task)
+	{
+		try {
+			task();
+		}
+		catch (...) {
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (!_error) {
+				_error = std::current_exception();
+			}
+		}
+	}
+
+	void ThreadPool::run(Task task)
+	{
+		if (_workers.empty()) {
+			execute(task);
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_tasks.push_back(std::move(task));
+			++_pending;
+		}
+		_taskAvailable.notify_one();
+	}
+
+	void ThreadPool::wait()
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_done.wait(lock, [this]() { return _pending == 0; });
+		if (_error) {
+			auto error = _error;
+			_error = nullptr;
+			std::rethrow_exception(error);
+		}
+	}
+
+	void ThreadPool::work()
+	{
+		while (true) {
+			Task task;
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_taskAvailable.wait(lock, [this]() { return _stop || !_tasks.empty(); });
+				if (_tasks.empty()) {
+					return;
+				}
+				task = std::move(_tasks.front());
+				_tasks.pop_front();
+			}
+			execute(task);
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				--_pending;
+			}
+			_done.notify_all();
+		}
+	}
+
+	int defaultNumThreads()
+	{
+#ifdef __EMSCRIPTEN__
+		return 1;
+#else
+		auto n = std::thread::hardware_concurrency();
+		return n > 0 ? (int)n : 1;
+#endif
+	}
+}
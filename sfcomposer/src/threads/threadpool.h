@@ -0,0 +1,62 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <exception>
+
+/*
+	a fixed number of worker threads processing a task queue.
+	with less than two threads the tasks are executed synchronously,
+	which is the case for the emscripten build (no pthreads).
+*/
+
+namespace threads {
+	class ThreadPool {
+	public:
+		typedef std::function<void()> Task;
+		explicit ThreadPool(int numThreads);
+		~ThreadPool();
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+		void run(Task task);
+		/*
+			waits until all tasks are done,
+			rethrows the first exception thrown by a task
+		*/
+		void wait();
+		int numThreads() const { return (int)_workers.size(); }
+	private:
+		void work();
+		void execute(Task& task);
+		std::vector<std::thread> _workers;
+		std::deque<Task> _tasks;
+		std::mutex _mutex;
+		std::condition_variable _taskAvailable;
+		std::condition_variable _done;
+		size_t _pending = 0;
+		bool _stop = false;
+		std::exception_ptr _error;
+	};
+
+	/*
+		the number of threads used if nothing else was specified
+	*/
+	int defaultNumThreads();
+
+	template <class TFunction>
+	void parallelFor(size_t count, int numThreads, TFunction f)
+	{
+		ThreadPool pool(numThreads);
+		for (size_t i = 0; i < count; ++i) {
+			pool.run([&f, i]() { f(i); });
+		}
+		pool.wait();
+	}
+}
+
+#endif
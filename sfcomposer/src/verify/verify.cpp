@@ -0,0 +1,238 @@
+#include "verify.h"
+#include "io/mappedfile.h"
+#include <cstring>
+#include <sstream>
+
+namespace {
+	struct Chunk {
+		const char* data = nullptr;
+		uint32_t size = 0;
+	};
+
+	enum PdtaChunk { Phdr, Pbag, Pmod, Pgen, Inst, Ibag, Imod, Igen, Shdr, NumPdtaChunks };
+	const char* const PdtaIds[NumPdtaChunks] = { "phdr", "pbag", "pmod", "pgen", "inst", "ibag", "imod", "igen", "shdr" };
+	const uint32_t RecordSizes[NumPdtaChunks] = { 38, 4, 10, 4, 22, 4, 10, 4, 46 };
+	const int GenInstrument = 41;
+	const int GenSampleId = 53;
+	const int RightSample = 2, LeftSample = 4, LinkedSample = 8;
+
+	inline uint32_t dword(const char* p)
+	{
+		uint32_t value;
+		memcpy(&value, p, 4);
+		return value;
+	}
+
+	inline uint16_t word(const char* p)
+	{
+		uint16_t value;
+		memcpy(&value, p, 2);
+		return value;
+	}
+
+	struct Walker {
+		const char* base;
+		verify::Result result;
+
+		bool fail(const char* error, const char* at)
+		{
+			result.valid = false;
+			result.error = error;
+			result.offset = at - base;
+			return false;
+		}
+
+		/*
+			the bag index of every record (at offset) must not decrease,
+			the one of the terminal record points to the terminal bag
+		*/
+		bool checkBagIndices(const Chunk& headers, uint32_t recordSize, uint32_t offset, const Chunk& bags)
+		{
+			uint32_t count = headers.size / recordSize;
+			uint32_t bagCount = bags.size / 4;
+			uint32_t last = 0;
+			for (uint32_t i = 0; i < count; ++i) {
+				const char* record = headers.data + i * recordSize;
+				uint32_t index = word(record + offset);
+				if (index < last) {
+					return fail("bag index decreases", record);
+				}
+				if (index >= bagCount || (i + 1 == count && index != bagCount - 1)) {
+					return fail("bag index out of range", record);
+				}
+				last = index;
+			}
+			return true;
+		}
+
+		/*
+			the same for the generator and modulator indices of the bags
+		*/
+		bool checkBags(const Chunk& bags, const Chunk& generators, const Chunk& modulators)
+		{
+			uint32_t count = bags.size / 4;
+			uint32_t generatorCount = generators.size / 4;
+			uint32_t modulatorCount = modulators.size / 10;
+			uint32_t lastGenerator = 0, lastModulator = 0;
+			for (uint32_t i = 0; i < count; ++i) {
+				const char* record = bags.data + i * 4;
+				uint32_t generator = word(record);
+				uint32_t modulator = word(record + 2);
+				if (generator < lastGenerator || modulator < lastModulator) {
+					return fail("generator or modulator index decreases", record);
+				}
+				bool terminal = i + 1 == count;
+				if (generator >= generatorCount || (terminal && generator != generatorCount - 1)) {
+					return fail("generator index out of range", record);
+				}
+				if (modulator >= modulatorCount || (terminal && modulator != modulatorCount - 1)) {
+					return fail("modulator index out of range", record);
+				}
+				lastGenerator = generator;
+				lastModulator = modulator;
+			}
+			return true;
+		}
+
+		/*
+			the generator pointing to an instrument or sample must be in range
+		*/
+		bool checkGenerators(const Chunk& generators, int indexGenerator, uint32_t targetCount, const char* error)
+		{
+			uint32_t count = generators.size / 4;
+			for (uint32_t i = 0; i + 1 < count; ++i) {
+				const char* record = generators.data + i * 4;
+				if (word(record) == indexGenerator && word(record + 2) >= targetCount) {
+					return fail(error, record);
+				}
+			}
+			return true;
+		}
+
+		bool checkSampleHeaders(const Chunk& headers, uint32_t sampleCount)
+		{
+			uint32_t count = headers.size / 46;
+			for (uint32_t i = 0; i + 1 < count; ++i) {
+				const char* record = headers.data + i * 46;
+				uint32_t start = dword(record + 20);
+				uint32_t end = dword(record + 24);
+				uint32_t loopStart = dword(record + 28);
+				uint32_t loopEnd = dword(record + 32);
+				int type = word(record + 44);
+				if (start > end || end > sampleCount) {
+					return fail("sample start or end out of range", record);
+				}
+				if (loopStart > loopEnd || loopStart < start || loopEnd > end) {
+					return fail("sample loop out of range", record);
+				}
+				bool linked = (type & (RightSample | LeftSample | LinkedSample)) != 0;
+				if (linked && word(record + 42) + 1u >= count) {
+					return fail("sample link out of range", record);
+				}
+			}
+			return true;
+		}
+
+		bool walk(const char* data, uint64_t size)
+		{
+			if (size < 12 || memcmp(data, "RIFF", 4) != 0 || memcmp(data + 8, "sfbk", 4) != 0) {
+				return fail("not a RIFF sfbk file", data);
+			}
+			uint64_t end = 8 + (uint64_t)dword(data + 4);
+			if (end > size) {
+				return fail("RIFF size exceeds the file", data);
+			}
+			bool info = false, ifil = false;
+			Chunk smpl;
+			Chunk pdta[NumPdtaChunks];
+			int nextPdta = 0;
+			uint64_t pos = 12;
+			while (pos + 8 <= end) {
+				const char* chunk = data + pos;
+				uint64_t chunkEnd = pos + 8 + dword(chunk + 4);
+				if (chunkEnd > end) {
+					return fail("chunk exceeds the RIFF chunk", chunk);
+				}
+				if (memcmp(chunk, "LIST", 4) == 0) {
+					if (chunkEnd < pos + 12) {
+						return fail("LIST chunk without type", chunk);
+					}
+					const char* type = chunk + 8;
+					info = info || memcmp(type, "INFO", 4) == 0;
+					for (uint64_t sub = pos + 12; sub + 8 <= chunkEnd;) {
+						const char* subChunk = data + sub;
+						uint32_t subSize = dword(subChunk + 4);
+						if (sub + 8 + subSize > chunkEnd) {
+							return fail("sub chunk exceeds its LIST chunk", subChunk);
+						}
+						if (memcmp(type, "INFO", 4) == 0 && memcmp(subChunk, "ifil", 4) == 0) {
+							if (subSize != 4) {
+								return fail("ifil size is not 4", subChunk);
+							}
+							ifil = true;
+						}
+						else if (memcmp(type, "sdta", 4) == 0 && memcmp(subChunk, "smpl", 4) == 0) {
+							smpl = { subChunk + 8, subSize };
+						}
+						else if (memcmp(type, "pdta", 4) == 0) {
+							if (nextPdta >= NumPdtaChunks || memcmp(subChunk, PdtaIds[nextPdta], 4) != 0) {
+								return fail("unexpected pdta sub chunk", subChunk);
+							}
+							if (subSize == 0 || subSize % RecordSizes[nextPdta] != 0) {
+								return fail("pdta sub chunk size is not a multiple of its record size", subChunk);
+							}
+							pdta[nextPdta++] = { subChunk + 8, subSize };
+						}
+						sub += 8 + subSize + (subSize & 1);
+					}
+				}
+				pos = chunkEnd + (chunkEnd & 1);
+			}
+			if (!info || !ifil) {
+				return fail("missing INFO list or ifil chunk", data);
+			}
+			if (!smpl.data) {
+				return fail("missing smpl chunk", data);
+			}
+			if (nextPdta != NumPdtaChunks) {
+				return fail("missing pdta sub chunks", data);
+			}
+			uint32_t instrumentCount = pdta[Inst].size / RecordSizes[Inst] - 1;
+			uint32_t sampleHeaderCount = pdta[Shdr].size / RecordSizes[Shdr] - 1;
+			return checkBagIndices(pdta[Phdr], RecordSizes[Phdr], 24, pdta[Pbag])
+				&& checkBags(pdta[Pbag], pdta[Pgen], pdta[Pmod])
+				&& checkGenerators(pdta[Pgen], GenInstrument, instrumentCount, "instrument index out of range")
+				&& checkBagIndices(pdta[Inst], RecordSizes[Inst], 20, pdta[Ibag])
+				&& checkBags(pdta[Ibag], pdta[Igen], pdta[Imod])
+				&& checkGenerators(pdta[Igen], GenSampleId, sampleHeaderCount, "sample index out of range")
+				&& checkSampleHeaders(pdta[Shdr], smpl.size / 2);
+		}
+	};
+}
+
+namespace verify {
+
+	std::string Result::json() const
+	{
+		std::stringstream ss;
+		ss << "{\"valid\": " << (valid ? "true" : "false");
+		if (!valid) {
+			ss << ", \"error\": \"" << error << "\", \"offset\": " << offset;
+		}
+		ss << "}";
+		return ss.str();
+	}
+
+	Result soundfont(const char* data, uint64_t size)
+	{
+		Walker walker = { data, verify::Result() };
+		walker.walk(data, size);
+		return walker.result;
+	}
+
+	Result soundfontFile(const std::string& path)
+	{
+		io::MappedFile file(path);
+		return soundfont(file.data(), file.size());
+	}
+}
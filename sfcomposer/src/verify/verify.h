@@ -0,0 +1,31 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <string>
+#include <cstdint>
+
+/*
+	structural check of a soundfont in one pass over the RIFF chunks, without
+	heap allocation and without reading the sample data:
+	chunk bounds, bag and generator index order, instrument and sample
+	indices of the generators, start, end and loops of the sample headers.
+*/
+
+namespace verify {
+	struct Result {
+		bool valid = true;
+		// a string literal, empty if valid
+		const char* error = "";
+		// of the chunk or record with the error
+		uint64_t offset = 0;
+		std::string json() const;
+	};
+
+	Result soundfont(const char* data, uint64_t size);
+	/*
+		maps the file, throws if it can not be read
+	*/
+	Result soundfontFile(const std::string& path);
+}
+
+#endif